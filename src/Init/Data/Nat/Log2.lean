@@ -21,6 +21,10 @@ theorem log2_terminates : ∀ n, n ≥ 2 → n / 2 < n
 Computes `⌊max 0 (log₂ n)⌋`.
 
 `log2 0 = log2 1 = 0`, `log2 2 = 1`, ..., `log2 (2^i) = i`, etc.
+
+This definition is overridden in both the kernel and the compiler to efficiently
+evaluate using the "bignum" representation (see `Nat`). The definition provided
+here is the logical model.
 -/
 @[extern "lean_nat_log2"]
 def log2 (n : @& Nat) : Nat :=
@@ -24,6 +24,21 @@ def toNat! (s : String) : Nat :=
 @[extern "lean_string_from_utf8_unchecked"]
 opaque fromUTF8Unchecked (a : @& ByteArray) : String
 
+/--
+  Return `true` iff `a` is a valid [UTF-8](https://en.wikipedia.org/wiki/UTF-8) encoding of a
+  sequence of unicode scalar values, i.e. it contains no overlong encodings, surrogates or values
+  above `0x10FFFF`.
+-/
+@[extern "lean_string_validate_utf8"]
+opaque validateUTF8 (a : @& ByteArray) : Bool
+
+/--
+  Convert a [UTF-8](https://en.wikipedia.org/wiki/UTF-8) encoded `ByteArray` string to `String`,
+  or return `none` if `a` is not valid UTF-8 (see `validateUTF8`).
+-/
+@[extern "lean_string_from_utf8"]
+opaque fromUTF8? (a : @& ByteArray) : Option String
+
 /-- Convert the given `String` to a [UTF-8](https://en.wikipedia.org/wiki/UTF-8) encoded byte array. -/
 @[extern "lean_string_to_utf8"]
 opaque toUTF8 (a : @& String) : ByteArray
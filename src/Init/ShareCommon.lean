@@ -67,6 +67,28 @@ unsafe def StateFactory.mkImpl : StateFactoryBuilder → StateFactory
 @[implemented_by StateFactory.mkImpl]
 opaque StateFactory.mk : StateFactoryBuilder → StateFactory
 
+/-- Create the native hash-consing table used by `StateFactory.native`. -/
+@[extern "lean_sharecommon_mk_native_state"]
+unsafe opaque mkNativeState (u : Unit) : NonScalar
+
+unsafe def StateFactory.nativeImpl : StateFactory :=
+  unsafeCast {
+    Map := Unit, Set := Unit
+    mkState := fun _ => unsafeCast (mkNativeState ())
+    mapFind? := fun _ _ => none
+    mapInsert := fun m _ _ => m
+    setFind? := fun _ _ => none
+    setInsert := fun s _ => s
+    : StateFactoryImpl }
+
+/--
+State factory whose states are hash-consing tables implemented in C++.
+It avoids calling the map and set operations through closures, and the table is updated in place
+when the state is not shared.
+-/
+@[implemented_by StateFactory.nativeImpl]
+opaque StateFactory.native : StateFactory
+
 unsafe def StateFactory.get : StateFactory → StateFactoryImpl := unsafeCast
 
 /-- Internally `State` is implemented as a pair `ObjectMap` and `ObjectSet` -/
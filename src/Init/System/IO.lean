@@ -185,6 +185,12 @@ def sleep (ms : UInt32) : BaseIO Unit :=
   -- TODO: add a proper primitive for IO.sleep
   fun s => dbgSleep ms fun _ => EStateM.Result.ok () s
 
+/--
+Returns a task that finishes after `ms` milliseconds. Unlike `IO.sleep` in a task, no thread is
+blocked while waiting.
+-/
+@[extern "lean_io_sleep_async"] opaque sleepAsync (ms : UInt32) : BaseIO (Task Unit)
+
 /-- `IO` specialization of `EIO.asTask`. -/
 @[inline] def asTask (act : IO α) (prio := Task.Priority.default) : BaseIO (Task (Except IO.Error α)) :=
   EIO.asTask act prio
@@ -228,6 +234,13 @@ local macro "nonempty_list" : tactic =>
 /-- Helper method for implementing "deterministic" timeouts. It is the number of "small" memory allocations performed by the current execution thread. -/
 @[extern "lean_io_get_num_heartbeats"] opaque getNumHeartbeats : BaseIO Nat
 
+/--
+Return memory that is no longer in use to the operating system. The result is the number of bytes
+released by the small object allocator. Long-running processes such as the language server can
+use it to shed memory after a spike in usage.
+-/
+@[extern "lean_io_trim_heap"] opaque trimHeap : BaseIO Nat
+
 /--
 The mode of a file handle (i.e., a set of `open` flags and an `fdopen` mode).
 
@@ -378,6 +391,13 @@ If the returned array is empty, an end-of-file marker has been reached.
 Note that EOF does not actually close a handle, so further reads may block and return more data.
 -/
 @[extern "lean_io_prim_handle_read"] opaque read (h : @& Handle) (bytes : USize) : IO ByteArray
+/--
+Like `read`, but reuses the memory of `buf`, whose contents are replaced, if it is not shared and
+its capacity is at least `bytes`. Reading a file in chunks with `readInto` thus does not allocate
+a new array for each chunk.
+-/
+@[extern "lean_io_prim_handle_read_into"]
+opaque readInto (h : @& Handle) (buf : ByteArray) (bytes : USize) : IO ByteArray
 @[extern "lean_io_prim_handle_write"] opaque write (h : @& Handle) (buffer : @& ByteArray) : IO Unit
 
 /--
@@ -388,6 +408,21 @@ Note that EOF does not actually close a handle, so further reads may block and r
 @[extern "lean_io_prim_handle_get_line"] opaque getLine (h : @& Handle) : IO String
 @[extern "lean_io_prim_handle_put_str"] opaque putStr (h : @& Handle) (s : @& String) : IO Unit
 
+/--
+Read up to the given number of bytes from the handle in the background. If no data is available
+yet, no thread is blocked while waiting for it; this makes it possible to wait for the output of
+many processes at once. Unlike `read`, the result may be shorter than requested before the end of
+the file. If the returned array is empty, an end-of-file marker has been reached.
+-/
+@[extern "lean_io_prim_handle_read_async"]
+opaque readAsync (h : @& Handle) (bytes : USize) : BaseIO (Task (Except IO.Error ByteArray))
+/--
+Flush the handle and write the given bytes to it in the background, without blocking a thread
+while the receiving end of a pipe is full.
+-/
+@[extern "lean_io_prim_handle_write_async"]
+opaque writeAsync (h : @& Handle) (buffer : ByteArray) : BaseIO (Task (Except IO.Error Unit))
+
 end Handle
 
 @[extern "lean_io_realpath"] opaque realPath (fname : FilePath) : IO FilePath
@@ -404,6 +439,35 @@ see there for more information.
 -/
 @[extern "lean_io_rename"] opaque rename (old new : @& FilePath) : IO Unit
 
+/-- A file mapped read-only into memory by `IO.FS.mmap`. The mapping is removed when it is freed. -/
+opaque MappedFile : Type := Unit
+
+/--
+Maps the file read-only into memory so that its contents can be accessed without copying them into
+a fresh array, which is useful for inputs larger than the available memory. The result of changing
+the file while it is mapped is unspecified; truncating it may terminate the process. On Windows,
+the file is read into memory instead.
+-/
+@[extern "lean_io_mmap"] opaque mmap (fn : @& FilePath) : IO MappedFile
+
+namespace MappedFile
+
+/--
+The contents of the mapped file. The array is not a copy but refers to the mapping, so it must not
+be used after `m` has been freed; this is why this function is unsafe. Modifying the array copies it.
+-/
+@[extern "lean_io_mapped_file_bytes"]
+unsafe opaque bytes (m : @& MappedFile) : ByteArray
+
+/--
+The contents of the mapped file as a string, or `none` if they are not valid UTF-8. As with `bytes`,
+the string refers to the mapping and must not be used after `m` has been freed.
+-/
+@[extern "lean_io_mapped_file_to_string"]
+unsafe opaque toString? (m : @& MappedFile) : Option String
+
+end MappedFile
+
 end FS
 
 @[extern "lean_io_getenv"] opaque getEnv (var : @& String) : BaseIO (Option String)
@@ -663,6 +727,13 @@ structure Child (cfg : StdioConfig) where
 
 @[extern "lean_io_process_child_wait"] opaque Child.wait {cfg : @& StdioConfig} : @& Child cfg → IO UInt32
 
+/--
+Wait for the child process to exit in the background. Unlike `IO.asTask child.wait`, this does not
+block a thread per process.
+-/
+@[extern "lean_io_process_child_wait_async"]
+opaque Child.waitAsync {cfg : @& StdioConfig} : @& Child cfg → BaseIO (Task (Except IO.Error UInt32))
+
 /-- Terminates the child process using the SIGTERM signal or a platform analogue.
     If the process was started using `SpawnArgs.setsid`, terminates the entire process group instead. -/
 @[extern "lean_io_process_child_kill"] opaque Child.kill {cfg : @& StdioConfig} : @& Child cfg → IO Unit
@@ -0,0 +1,154 @@
+/-
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+-/
+prelude
+import Init.Data.String.Basic
+
+universe u
+
+namespace Lean
+
+/--
+A persistent string represented as a balanced tree of `String` chunks.
+
+Appending to a `String` that is shared copies all of it, so building a large output through a
+builder that is also kept alive elsewhere (e.g. a snapshot for backtracking) is quadratic. A `Rope`
+shares its chunks instead: `++` and `extract` are `O(log n)`, and `toString` flattens it in
+linear time. Nodes cache the byte size, character length and height of their subtree; the tree
+is kept AVL-balanced, and adjacent small chunks are merged into one leaf.
+-/
+inductive Rope where
+  | leaf (s : String)
+  | node (l r : Rope) (size length height : Nat)
+  deriving Inhabited
+
+namespace Rope
+
+/-- Adjacent leaves are merged while their combined size is at most this many bytes. -/
+def leafSize : Nat := 256
+
+/-- The size of the UTF-8 encoding of the rope. `O(1)` -/
+@[inline] def utf8ByteSize : Rope → Nat
+  | leaf s => s.utf8ByteSize
+  | node _ _ size _ _ => size
+
+/-- The number of characters of the rope. `O(1)` -/
+@[inline] def length : Rope → Nat
+  | leaf s => s.length
+  | node _ _ _ length _ => length
+
+@[inline] def height : Rope → Nat
+  | leaf _ => 0
+  | node _ _ _ _ height => height
+
+def empty : Rope := leaf ""
+
+instance : EmptyCollection Rope := ⟨empty⟩
+
+@[inline] def ofString (s : String) : Rope := leaf s
+
+instance : Coe String Rope := ⟨ofString⟩
+
+@[inline] def isEmpty (r : Rope) : Bool := r.utf8ByteSize == 0
+
+@[inline] private def mkNode (l r : Rope) : Rope :=
+  node l r (l.utf8ByteSize + r.utf8ByteSize) (l.length + r.length) (max l.height r.height + 1)
+
+/-- Create a node from subtrees whose heights differ by at most two, rotating to restore balance. -/
+private def balance (l r : Rope) : Rope :=
+  if l.height > r.height + 1 then
+    match l with
+    | node ll lr _ _ _ =>
+      if ll.height ≥ lr.height then
+        mkNode ll (mkNode lr r)
+      else match lr with
+        | node lrl lrr _ _ _ => mkNode (mkNode ll lrl) (mkNode lrr r)
+        | leaf _ => mkNode l r
+    | leaf _ => mkNode l r
+  else if r.height > l.height + 1 then
+    match r with
+    | node rl rr _ _ _ =>
+      if rr.height ≥ rl.height then
+        mkNode (mkNode l rl) rr
+      else match rl with
+        | node rll rlr _ _ _ => mkNode (mkNode l rll) (mkNode rlr rr)
+        | leaf _ => mkNode l r
+    | leaf _ => mkNode l r
+  else
+    mkNode l r
+
+/-- Concatenate two ropes. `O(|l.height - r.height|)` -/
+partial def append (l r : Rope) : Rope :=
+  if l.isEmpty then r
+  else if r.isEmpty then l
+  else if l.height > r.height + 1 then
+    match l with
+    | node ll lr _ _ _ => balance ll (append lr r)
+    | leaf _ => mkNode l r
+  else if r.height > l.height + 1 then
+    match r with
+    | node rl rr _ _ _ => balance (append l rl) rr
+    | leaf _ => mkNode l r
+  else
+    match l, r with
+    | leaf a, leaf b => if a.utf8ByteSize + b.utf8ByteSize ≤ leafSize then leaf (a ++ b) else mkNode l r
+    | node ll lr _ _ _, leaf b =>
+      match lr with
+      | leaf a => if a.utf8ByteSize + b.utf8ByteSize ≤ leafSize then balance ll (leaf (a ++ b)) else mkNode l r
+      | _ => mkNode l r
+    | _, _ => mkNode l r
+
+instance : Append Rope := ⟨append⟩
+
+instance : HAppend Rope String Rope := ⟨fun r s => r.append (leaf s)⟩
+
+@[inline] def push (r : Rope) (c : Char) : Rope :=
+  r.append (leaf (String.singleton c))
+
+/--
+Split the rope before byte position `i`, which must be at a character boundary.
+Returns `(r.extract 0 i, r.extract i r.endPos)`. `O(log n)`
+-/
+partial def splitAt (r : Rope) (i : String.Pos) : Rope × Rope :=
+  if i.byteIdx == 0 then (empty, r)
+  else if i.byteIdx ≥ r.utf8ByteSize then (r, empty)
+  else match r with
+    | leaf s => (leaf (s.extract 0 i), leaf (s.extract i s.endPos))
+    | node l rr _ _ _ =>
+      let n := l.utf8ByteSize
+      if i.byteIdx < n then
+        let (a, b) := l.splitAt i
+        (a, b.append rr)
+      else if i.byteIdx == n then
+        (l, rr)
+      else
+        let (a, b) := rr.splitAt ⟨i.byteIdx - n⟩
+        (l.append a, b)
+
+def endPos (r : Rope) : String.Pos := ⟨r.utf8ByteSize⟩
+
+/--
+The part of the rope between the byte positions `b` and `e`, which must be at character
+boundaries. Agrees with `String.extract` on the flattened rope. `O(log n)`
+-/
+def extract (r : Rope) (b e : String.Pos) : Rope :=
+  if b.byteIdx ≥ e.byteIdx then empty
+  else ((r.splitAt e).1.splitAt b).2
+
+/-- Fold over the chunks of the rope from left to right. -/
+@[specialize] def foldlChunks {α : Type u} (f : α → String → α) (init : α) : Rope → α
+  | leaf s => f init s
+  | node l r _ _ _ => foldlChunks f (foldlChunks f init l) r
+
+/-- Flatten the rope into a `String`. `O(n)` -/
+protected def toString (r : Rope) : String :=
+  r.foldlChunks (· ++ ·) ""
+
+instance : ToString Rope := ⟨Rope.toString⟩
+
+instance : BEq Rope := ⟨fun a b => a.utf8ByteSize == b.utf8ByteSize && a.toString == b.toString⟩
+
+end Rope
+
+end Lean
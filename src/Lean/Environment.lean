@@ -242,6 +242,14 @@ namespace Environment
 @[extern "lean_add_decl"]
 opaque addDecl (env : Environment) (decl : @& Declaration) : Except KernelException Environment
 
+/--
+Type check the given declarations and add them to the environment, in order.
+The values of theorems are checked in parallel using the task manager.
+If some declarations are rejected, the error for the first one in `decls` is reported.
+-/
+@[extern "lean_add_decls"]
+opaque addDecls (env : Environment) (decls : @& List Declaration) : Except KernelException Environment
+
 end Environment
 
 namespace ConstantInfo
@@ -628,9 +636,29 @@ end MapDeclarationExtension
 
 @[extern "lean_save_module_data"]
 opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
+/--
+  Like `saveModuleData`, but compresses the data. Compressed `.olean` files are smaller but must be
+  decompressed into memory when imported instead of being memory-mapped. `saveModuleData` also
+  produces compressed files when the environment variable `LEAN_OLEAN_COMPRESS` is set to `1`. -/
+@[extern "lean_save_module_data_compressed"]
+opaque saveModuleDataCompressed (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
+/-- Compress `data` using the codec of compressed `.olean` files. Exposed for testing only. -/
+@[extern "lean_lz_compress"]
+opaque Internal.lzCompress (data : @& ByteArray) : ByteArray
+/-- Decompress the result of `Internal.lzCompress`, returning `none` if `data` is malformed or does not decompress
+to exactly `size` bytes. Exposed for testing only. -/
+@[extern "lean_lz_decompress"]
+opaque Internal.lzDecompress? (data : @& ByteArray) (size : @& Nat) : Option ByteArray
 @[extern "lean_read_module_data"]
 opaque readModuleData (fname : @& System.FilePath) : IO (ModuleData × CompactedRegion)
 
+/--
+  Read the given `.olean` files in parallel using the task manager's worker threads. The results are
+  returned in the order of `fnames`. -/
+def readModuleDataParallel (fnames : Array System.FilePath) : IO (Array (ModuleData × CompactedRegion)) := do
+  let tasks ← fnames.mapM fun fname => IO.asTask (readModuleData fname)
+  tasks.mapM fun t => IO.ofExcept t.get
+
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
   particular, `env` should be the last reference to any `Environment` derived from these imports. -/
@@ -753,21 +781,50 @@ abbrev ImportStateM := StateRefT ImportState IO
 @[inline] nonrec def ImportStateM.run (x : ImportStateM α) (s : ImportState := {}) : IO (α × ImportState) :=
   x.run s
 
-partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
+/--
+  Read the `.olean` files of all modules transitively imported by `imports` that are not in `seen`.
+  The import graph is explored breadth-first so that all files of a layer are read in parallel. -/
+partial def readImportedModules (imports : Array Import) (seen : NameHashSet := {})
+    (loaded : HashMap Name (ModuleData × CompactedRegion) := {}) :
+    IO (HashMap Name (ModuleData × CompactedRegion)) := do
+  let mut seen := seen
+  let mut todo := #[]
   for i in imports do
-    if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
+    if i.runtimeOnly || seen.contains i.module then
       continue
-    modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
+    seen := seen.insert i.module
     let mFile ← findOLean i.module
     unless (← mFile.pathExists) do
       throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-    let (mod, region) ← readModuleData mFile
-    importModulesCore mod.imports
-    modify fun s => { s with
-      moduleData  := s.moduleData.push mod
-      regions     := s.regions.push region
-      moduleNames := s.moduleNames.push i.module
-    }
+    todo := todo.push (i.module, mFile)
+  if todo.isEmpty then
+    return loaded
+  let mods ← readModuleDataParallel (todo.map (·.2))
+  let mut loaded := loaded
+  let mut next := #[]
+  for (modName, _) in todo, mod in mods do
+    loaded := loaded.insert modName mod
+    next := next ++ mod.1.imports
+  readImportedModules next seen loaded
+
+partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
+  let loaded ← readImportedModules imports (← get).moduleNameSet
+  go loaded imports
+where
+  /- Add the modules in dependency order. -/
+  go (loaded : HashMap Name (ModuleData × CompactedRegion)) (imports : Array Import) : ImportStateM Unit := do
+    for i in imports do
+      if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
+        continue
+      modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
+      let some (mod, region) := loaded.find? i.module
+        | throw <| IO.userError s!"import {i.module} failed, module has not been loaded"
+      go loaded mod.imports
+      modify fun s => { s with
+        moduleData  := s.moduleData.push mod
+        regions     := s.regions.push region
+        moduleNames := s.moduleNames.push i.module
+      }
 
 /--
   Construct environment from `importModulesCore` results.
@@ -811,7 +868,7 @@ def finalizeImport (s : ImportState) (imports : Array Import) (opts : Options) (
       moduleData   := s.moduleData
     }
   }
-  env ← setImportedEntries env s.moduleData
+  env ← profileitIO "import of environment extensions" opts <| setImportedEntries env s.moduleData
   if leakEnv then
     /- Mark persistent a first time before `finalizePersistenExtensions`, which
        avoids costly MT markings when e.g. an interpreter closure (which
@@ -824,7 +881,7 @@ def finalizeImport (s : ImportState) (imports : Array Import) (opts : Options) (
        extensions, from this. There is no significant extra cost to calling
        `markPersistent` multiple times like this. -/
     env := Runtime.markPersistent env
-  env ← finalizePersistentExtensions env s.moduleData opts
+  env ← profileitIO "import of environment extensions" opts <| finalizePersistentExtensions env s.moduleData opts
   if leakEnv then
     /- Ensure the final environment including environment extension states is
        marked persistent as documented. -/
@@ -838,7 +895,7 @@ def importModules (imports : Array Import) (opts : Options) (trustLevel : UInt32
     if imp.module matches .anonymous then
       throw <| IO.userError "import failed, trying to import module with anonymous name"
   withImporting do
-    let (_, s) ← importModulesCore imports |>.run
+    let (_, s) ← profileitIO ".olean deserialization" opts (importModulesCore imports |>.run)
     finalizeImport (leakEnv := leakEnv) s imports opts trustLevel
 
 /--
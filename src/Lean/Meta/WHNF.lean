@@ -882,6 +882,8 @@ def reduceNat? (e : Expr) : MetaM (Option Expr) :=
   | .app (.const fn _) a =>
     if fn == ``Nat.succ then
       reduceUnaryNatOp Nat.succ a
+    else if fn == ``Nat.log2 then
+      reduceUnaryNatOp Nat.log2 a
     else
       return none
   | .app (.app (.const fn _) a1) a2 =>
@@ -12,6 +12,7 @@ import Lean.Util.FoldConsts
 
 `replay env constantMap` will "replay" all the constants in `constantMap : HashMap Name ConstantInfo` into `env`,
 sending each declaration to the kernel for checking.
+Declarations are sent in a single batch, so the values of theorems are checked in parallel.
 
 `replay` does not send constructors or recursors in `constantMap` to the kernel,
 but rather checks that they are identical to constructors or recursors generated in the enviroment
@@ -36,6 +37,8 @@ structure State where
   pending : NameSet := {}
   postponedConstructors : NameSet := {}
   postponedRecursors : NameSet := {}
+  /-- Declarations to be sent to the kernel, in dependency order. -/
+  decls : Array Declaration := #[]
 
 abbrev M := ReaderT Context <| StateRefT State IO
 
@@ -54,10 +57,14 @@ def throwKernelException (ex : KernelException) : M Unit := do
     let state := { env := (← get).env }
     Prod.fst <$> (Lean.Core.CoreM.toIO · ctx state) do Lean.throwKernelException ex
 
-/-- Add a declaration, possibly throwing a `KernelException`. -/
-def addDecl (d : Declaration) : M Unit := do
-  match (← get).env.addDecl d with
-  | .ok env => modify fun s => { s with env := env }
+/-- Queue a declaration for `addDecls`. -/
+def addDecl (d : Declaration) : M Unit :=
+  modify fun s => { s with decls := s.decls.push d }
+
+/-- Add all queued declarations, possibly throwing a `KernelException`. -/
+def addDecls : M Unit := do
+  match (← get).env.addDecls (← get).decls.toList with
+  | .ok env => modify fun s => { s with env := env, decls := #[] }
   | .error ex => throwKernelException ex
 
 mutual
@@ -165,6 +172,7 @@ def replay (newConstants : HashMap Name ConstantInfo) (env : Environment) : IO E
     ReaderT.run (r := { newConstants }) do
       for n in remaining do
         replayConstant n
+      addDecls
       checkPostponedConstructors
       checkPostponedRecursors
   return s.env
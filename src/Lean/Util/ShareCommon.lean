@@ -25,7 +25,7 @@ def persistentObjectFactory :=
     Set := PersistentHashSet, mkSet := fun _ => .empty, setFind? := (·.find?), setInsert := (·.insert)
   }
 
-abbrev ShareCommonT := _root_.ShareCommonT objectFactory
+abbrev ShareCommonT := _root_.ShareCommonT StateFactory.native
 abbrev PShareCommonT := _root_.ShareCommonT persistentObjectFactory
 abbrev ShareCommonM := ShareCommonT Id
 abbrev PShareCommonM := PShareCommonT Id
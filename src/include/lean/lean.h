@@ -108,6 +108,7 @@ These two fields together have 48-bits, and this is enough for modern computers.
 In 32-bit machines, the field `m_rc` is sufficient.
 
 The field `m_other` is used to store the number of fields in a constructor object and the element size in a scalar array.
+In strings stored in compact regions, it records whether the string caches its hash code.
 */
 typedef struct {
     int      m_rc;
@@ -198,21 +199,30 @@ typedef struct {
 
 struct lean_task;
 
-/* Data required for executing a Lean task. It is released as soon as
-   the task terminates even if the task object itself is still referenced. */
+/* Data required for executing a Lean task. It is released together with the task object. */
 typedef struct {
-    lean_object *        m_closure;
-    struct lean_task *   m_head_dep;
-    struct lean_task *   m_next_dep;
-    unsigned             m_prio;
-    uint8_t              m_canceled;
+    _Atomic(lean_object *)      m_closure;
+    /* Dependent tasks linked via `m_next_dep`, or `LEAN_TASK_DEPS_CLOSED` after the task has finished or was deactivated. */
+    _Atomic(struct lean_task *) m_head_dep;
+    struct lean_task *          m_next_dep;
+    unsigned                    m_prio;
+    _Atomic(uint8_t)            m_canceled;
     // If true, task will not be freed until finished
-    uint8_t              m_keep_alive;
-    uint8_t              m_deleted;
+    uint8_t                     m_keep_alive;
+    // Set of `LEAN_TASK_DROPPED` and `LEAN_TASK_UNSCHEDULED`
+    _Atomic(uint8_t)            m_released;
 } lean_task_imp;
 
+#define LEAN_TASK_DEPS_CLOSED ((struct lean_task *)1)
+// the RC of the task reached zero
+#define LEAN_TASK_DROPPED     1
+// the task manager does not reference the task anymore
+#define LEAN_TASK_UNSCHEDULED 2
+
 /* Object of type `Task _`. The lifetime of a `lean_task` object can be represented as a state machine with atomic
-   state transitions.
+   state transitions. None of them takes a lock: closures are handed over by atomic exchange of `m_closure`,
+   dependencies are pushed by CAS on `m_head_dep`, and a task object with an `m_imp` is freed by whichever of
+   `deactivate_task` and the task manager is the second to set its flag in `m_released`.
 
    In the following, `condition` describes a predicate uniquely identifying a state.
 
@@ -224,34 +234,32 @@ typedef struct {
 
    states:
    * Queued
-     * condition: in task_manager::m_queues && m_imp != nullptr && !m_imp->m_deleted
+     * condition: in task_manager::m_queues or a worker deque && m_imp->m_closure != nullptr
      * invariant: m_value == nullptr
-     * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: dequeued by worker thread            ==> Running     (`spawn_worker` lock)
+     * transition: RC becomes 0 ==> Deactivated (`deactivate_task` takes the closure)
+     * transition: dequeued by worker thread            ==> Running     (`run_task` takes the closure)
    * Waiting
-     * condition: reachable from task via `m_head_dep->m_next_dep->...` && !m_imp->m_deleted
+     * condition: reachable from task via `m_head_dep->m_next_dep->...` && m_imp->m_closure != nullptr
      * invariant: m_imp != nullptr && m_value == nullptr
-     * invariant: task dependency is Queued/Waiting/Running
+     * invariant: task dependency is Queued/Waiting/Running/Promised
        * It cannot become Deactivated because this task should be holding an owned reference to it
-     * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: task dependency Finished ==> Queued (`handle_finished` under `spawn_worker` lock)
+     * transition: RC becomes 0 ==> Deactivated
+     * transition: task dependency Finished ==> Queued (`resolve_core` closes the dependency list)
    * Promised
      * condition: obtained as result from promise
-     * invariant: m_imp != nullptr && m_value == nullptr
-     * transition: promise resolved ==> Finished (`resolve_core` under `spawn_worker` lock)
-     * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
+     * invariant: m_imp != nullptr && m_value == nullptr && (m_imp->m_released & LEAN_TASK_UNSCHEDULED)
+     * transition: promise resolved ==> Finished (`resolve_core`)
+     * transition: RC becomes 0 ==> Deactivated
    * Running
-     * condition: m_imp != nullptr && m_imp->m_closure == nullptr
+     * condition: m_imp != nullptr && m_imp->m_closure == nullptr && m_value == nullptr
        * The worker takes ownership of the closure when running it
-     * invariant: m_value == nullptr
-     * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: finished execution                   ==> Finished    (`spawn_worker` lock)
+     * transition: RC becomes 0 ==> Deactivated
+     * transition: finished execution                   ==> Finished    (`resolve_core`)
    * Deactivated
-     * condition: m_imp != nullptr && m_imp->m_deleted
+     * condition: m_imp != nullptr && (m_imp->m_released & LEAN_TASK_DROPPED)
      * invariant: RC == 0
-     * invariant: m_imp->m_closure == nullptr && m_imp->m_head_dep == nullptr (both freed by `deactivate_task_core`)
+     * invariant: m_imp->m_closure == nullptr && m_imp->m_head_dep == LEAN_TASK_DEPS_CLOSED
        * Note that all dependent tasks must have already been Deactivated by the converse of the second Waiting invariant
-     * invariant: m_value == nullptr
      * transition: dequeued by worker thread   ==> freed
      * transition: finished execution          ==> freed
      * transition: task dependency Finished    ==> freed
@@ -260,8 +268,8 @@ typedef struct {
      * transition: task dependency Deactivated ==> freed
    * Finished
      * condition: m_value != nullptr
-     * invariant: m_imp == nullptr
-     * transition: RC becomes 0 ==> freed (`deactivate_task` lock) */
+     * invariant: m_imp == nullptr || m_imp->m_head_dep == LEAN_TASK_DEPS_CLOSED
+     * transition: RC becomes 0 ==> freed (`deactivate_task`) */
 typedef struct lean_task {
     lean_object            m_header;
     _Atomic(lean_object *) m_value;
@@ -314,6 +322,8 @@ LEAN_SHARED void * lean_alloc_small(unsigned sz, unsigned slot_idx);
 LEAN_SHARED void lean_free_small(void * p);
 LEAN_SHARED unsigned lean_small_mem_size(void * p);
 LEAN_SHARED void lean_inc_heartbeat(void);
+/* Return unused memory to the OS. The result is the number of bytes released by the small object allocator. */
+LEAN_SHARED size_t lean_heap_trim(void);
 
 #ifndef __cplusplus
 void * malloc(size_t);  // avoid including big `stdlib.h`
@@ -173,16 +173,21 @@ environment environment::add_definition(declaration const & d, bool check) const
     }
 }
 
+/* Check the value of the theorem `d`. Its header must have been checked already. */
+static void check_theorem_value(environment const & env, declaration const & d, type_checker & checker) {
+    theorem_val const & v = d.to_theorem_val();
+    check_no_metavar_no_fvar(env, v.get_name(), v.get_value());
+    expr val_type = checker.check(v.get_value(), v.get_lparams());
+    if (!checker.is_def_eq(val_type, v.get_type()))
+        throw definition_type_mismatch_exception(env, d, val_type);
+}
+
 environment environment::add_theorem(declaration const & d, bool check) const {
     theorem_val const & v = d.to_theorem_val();
     if (check) {
-        // TODO(Leo): we must add support for handling tasks here
         type_checker checker(*this);
         check_constant_val(*this, v.to_constant_val(), checker);
-        check_no_metavar_no_fvar(*this, v.get_name(), v.get_value());
-        expr val_type = checker.check(v.get_value(), v.get_lparams());
-        if (!checker.is_def_eq(val_type, v.get_type()))
-            throw definition_type_mismatch_exception(*this, d, val_type);
+        check_theorem_value(*this, d, checker);
     }
     return add(constant_info(d));
 }
@@ -252,6 +257,55 @@ extern "C" LEAN_EXPORT object * lean_add_decl(object * env, object * decl) {
         });
 }
 
+/* Task body for `lean_add_decls`: check the value of the theorem `d` in `env`. */
+static obj_res check_theorem_value_fn(obj_arg env, obj_arg d, obj_arg /* unit */) {
+    environment e(env);
+    declaration decl(d);
+    return catch_kernel_exceptions<object_ref>([&]() {
+            type_checker checker(e);
+            check_theorem_value(e, decl, checker);
+            return object_ref(box(0));
+        });
+}
+
+/* Add the declarations `decls` to `env`, in order.
+   Theorem headers are checked and added sequentially, but theorem values are checked by tasks
+   on the task manager. The error reported is the one of the first declaration in `decls` that
+   is rejected, independently of how the tasks are scheduled. */
+extern "C" LEAN_EXPORT object * lean_add_decls(object * env, object * decls) {
+    buffer<std::pair<unsigned, object_ref>> tasks;
+    unsigned i = 0;
+    object_ref r(catch_kernel_exceptions<environment>([&]() {
+            environment new_env(env);
+            for (declaration const & d : list_ref<declaration>(decls, true)) {
+                if (d.is_theorem()) {
+                    check_constant_val(new_env, d.to_theorem_val().to_constant_val(), definition_safety::safe);
+                    object * c = alloc_closure(check_theorem_value_fn, 2);
+                    closure_set(c, 0, new_env.to_obj_arg());
+                    closure_set(c, 1, d.to_obj_arg());
+                    tasks.push_back(mk_pair(i, object_ref(task_spawn(c))));
+                    new_env = new_env.add(d, false);
+                } else {
+                    new_env = new_env.add(d);
+                }
+                i++;
+            }
+            return new_env;
+        }));
+    /* `i` is the index of the declaration rejected by the sequential loop, if any.
+       Tasks are sorted by index, so the first failing task before `i` has priority. */
+    for (auto const & t : tasks) {
+        if (t.first >= i)
+            break;
+        object * v = task_get(t.second.raw());
+        if (cnstr_tag(v) == 0) {
+            inc(v);
+            return v;
+        }
+    }
+    return r.steal();
+}
+
 void environment::for_each_constant(std::function<void(constant_info const & d)> const & f) const {
     smap_foreach(cnstr_get(raw(), 1), [&](object *, object * v) {
             constant_info cinfo(v, true);
@@ -117,40 +117,40 @@ static expr const & get_dummy() {
 expr::expr():expr(get_dummy()) {}
 
 extern "C" object * lean_expr_mk_lit(obj_arg l);
-expr mk_lit(literal const & l) { return expr(lean_expr_mk_lit(l.to_obj_arg())); }
+expr mk_lit(literal const & l) { return expr(kernel_intern(lean_expr_mk_lit(l.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_mdata(obj_arg m, obj_arg e);
-expr mk_mdata(kvmap const & m, expr const & e) { return expr(lean_expr_mk_mdata(m.to_obj_arg(), e.to_obj_arg())); }
+expr mk_mdata(kvmap const & m, expr const & e) { return expr(kernel_intern(lean_expr_mk_mdata(m.to_obj_arg(), e.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_proj(obj_arg s, obj_arg idx, obj_arg e);
-expr mk_proj(name const & s, nat const & idx, expr const & e) { return expr(lean_expr_mk_proj(s.to_obj_arg(), idx.to_obj_arg(), e.to_obj_arg())); }
+expr mk_proj(name const & s, nat const & idx, expr const & e) { return expr(kernel_intern(lean_expr_mk_proj(s.to_obj_arg(), idx.to_obj_arg(), e.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_bvar(obj_arg idx);
-expr mk_bvar(nat const & idx) { return expr(lean_expr_mk_bvar(idx.to_obj_arg())); }
+expr mk_bvar(nat const & idx) { return expr(kernel_intern(lean_expr_mk_bvar(idx.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_fvar(obj_arg n);
-expr mk_fvar(name const & n) { return expr(lean_expr_mk_fvar(n.to_obj_arg())); }
+expr mk_fvar(name const & n) { return expr(kernel_intern(lean_expr_mk_fvar(n.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_mvar(object * n);
-expr mk_mvar(name const & n) { return expr(lean_expr_mk_mvar(n.to_obj_arg())); }
+expr mk_mvar(name const & n) { return expr(kernel_intern(lean_expr_mk_mvar(n.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_const(obj_arg n, obj_arg ls);
-expr mk_const(name const & n, levels const & ls) { return expr(lean_expr_mk_const(n.to_obj_arg(), ls.to_obj_arg())); }
+expr mk_const(name const & n, levels const & ls) { return expr(kernel_intern(lean_expr_mk_const(n.to_obj_arg(), ls.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_app(obj_arg f, obj_arg a);
-expr mk_app(expr const & f, expr const & a) { return expr(lean_expr_mk_app(f.to_obj_arg(), a.to_obj_arg())); }
+expr mk_app(expr const & f, expr const & a) { return expr(kernel_intern(lean_expr_mk_app(f.to_obj_arg(), a.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_sort(obj_arg l);
-expr mk_sort(level const & l) { return expr(lean_expr_mk_sort(l.to_obj_arg())); }
+expr mk_sort(level const & l) { return expr(kernel_intern(lean_expr_mk_sort(l.to_obj_arg()))); }
 
 extern "C" object * lean_expr_mk_lambda(obj_arg n, obj_arg t, obj_arg e, uint8 bi);
 expr mk_lambda(name const & n, expr const & t, expr const & e, binder_info bi) {
-    return expr(lean_expr_mk_lambda(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
+    return expr(kernel_intern(lean_expr_mk_lambda(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi))));
 }
 
 extern "C" object * lean_expr_mk_forall(obj_arg n, obj_arg t, obj_arg e, uint8 bi);
 expr mk_pi(name const & n, expr const & t, expr const & e, binder_info bi) {
-    return expr(lean_expr_mk_forall(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
+    return expr(kernel_intern(lean_expr_mk_forall(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi))));
 }
 
 static name * g_default_name = nullptr;
@@ -160,7 +160,7 @@ expr mk_arrow(expr const & t, expr const & e) {
 
 extern "C" object * lean_expr_mk_let(object * n, object * t, object * v, object * b);
 expr mk_let(name const & n, expr const & t, expr const & v, expr const & b) {
-    return expr(lean_expr_mk_let(n.to_obj_arg(), t.to_obj_arg(), v.to_obj_arg(), b.to_obj_arg()));
+    return expr(kernel_intern(lean_expr_mk_let(n.to_obj_arg(), t.to_obj_arg(), v.to_obj_arg(), b.to_obj_arg())));
 }
 
 static expr * g_Prop  = nullptr;
@@ -4,6 +4,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <iostream>
+#include "runtime/thread.h"
 #include "kernel/expr_cache.h"
 
 namespace lean {
@@ -30,4 +32,28 @@ void expr_cache::clear() {
     }
     m_used.clear();
 }
+
+static atomic<uint64> g_expr_cache_stats[3][4];
+
+void flush_expr_cache_stats(expr_cache_kind k, expr_cache_stats & s) {
+    atomic<uint64> * g = g_expr_cache_stats[static_cast<unsigned>(k)];
+    g[0] += s.m_lookups;
+    g[1] += s.m_hits;
+    g[2] += s.m_evictions;
+    g[3] += s.m_resizes;
+    s = expr_cache_stats();
+}
+
+void display_expr_cache_stats(std::ostream & out) {
+    char const * names[3] = { "expr equality cache", "shared expr equality cache", "replace cache" };
+    for (unsigned k = 0; k < 3; k++) {
+        atomic<uint64> * g = g_expr_cache_stats[k];
+        uint64 lookups = g[0].load();
+        if (lookups == 0)
+            continue;
+        out << names[k] << ": " << lookups << " lookups, " << g[1].load() << " hits ("
+            << (100 * g[1].load() / lookups) << "%), " << g[2].load() << " evictions, "
+            << g[3].load() << " resizes\n";
+    }
+}
 }
@@ -6,8 +6,14 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <vector>
+#include <iosfwd>
 #include "kernel/expr.h"
 
+/* Number of entries per set in the set-associative caches used by `expr_eq_fn` and `replace_fn`. */
+#define LEAN_EXPR_CACHE_WAYS 4
+/* Thread-local counters are added to the global ones after this number of lookups. */
+#define LEAN_EXPR_CACHE_STATS_FLUSH 1024
+
 namespace lean {
 /** \brief Cache for storing mappings from expressions to expressions.
 
@@ -28,4 +34,19 @@ public:
     expr * find(expr const & e);
     void clear();
 };
+
+/** \brief Counters of the caches used by `expr_eq_fn` and `replace_fn`. */
+struct expr_cache_stats {
+    uint64 m_lookups   = 0;
+    uint64 m_hits      = 0;
+    uint64 m_evictions = 0;
+    uint64 m_resizes   = 0;
+};
+
+enum class expr_cache_kind { Eq, SharedEq, Replace };
+
+/** \brief Add the thread-local counters \c s to the global counters for \c k, and reset \c s. */
+void flush_expr_cache_stats(expr_cache_kind k, expr_cache_stats & s);
+/** \brief Display the global counters of the `expr_eq_fn` and `replace_fn` caches. */
+void display_expr_cache_stats(std::ostream & out);
 }
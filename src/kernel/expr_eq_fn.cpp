@@ -6,52 +6,150 @@ Author: Leonardo de Moura
 */
 #include <vector>
 #include <memory>
+#include <cstdlib>
 #include "runtime/interrupt.h"
 #include "runtime/thread.h"
+#include "runtime/compact.h"
 #include "kernel/expr.h"
 #include "kernel/expr_sets.h"
+#include "kernel/expr_cache.h"
 
 #ifndef LEAN_EQ_CACHE_CAPACITY
 #define LEAN_EQ_CACHE_CAPACITY 1024*8
 #endif
 
+#ifndef LEAN_EQ_CACHE_MAX_CAPACITY
+#define LEAN_EQ_CACHE_MAX_CAPACITY 1024*1024
+#endif
+
 namespace lean {
+/* Set-associative cache of the pairs of expressions visited by an `expr_eq_fn` call.
+   If a call evicts more than a quarter of the entries, the capacity is doubled for the next calls
+   (up to `LEAN_EQ_CACHE_MAX_CAPACITY`). */
 struct eq_cache {
     struct entry {
         object * m_a;
         object * m_b;
         entry():m_a(nullptr), m_b(nullptr) {}
     };
-    unsigned              m_capacity;
+    unsigned              m_num_sets;
     std::vector<entry>    m_cache;
     std::vector<unsigned> m_used;
-    eq_cache():m_capacity(LEAN_EQ_CACHE_CAPACITY), m_cache(LEAN_EQ_CACHE_CAPACITY) {}
+    unsigned              m_evictions;
+    expr_cache_stats      m_stats;
+    expr_cache_stats      m_stats_shared;
+    eq_cache():
+        m_num_sets(LEAN_EQ_CACHE_CAPACITY / LEAN_EXPR_CACHE_WAYS),
+        m_cache(LEAN_EQ_CACHE_CAPACITY), m_evictions(0) {}
+    ~eq_cache() { flush_stats(); }
+
+    void flush_stats() {
+        flush_expr_cache_stats(expr_cache_kind::Eq, m_stats);
+        flush_expr_cache_stats(expr_cache_kind::SharedEq, m_stats_shared);
+    }
+
+    unsigned capacity() const { return m_cache.size(); }
 
     bool check(expr const & a, expr const & b) {
         if (!is_shared(a) || !is_shared(b))
             return false;
-        unsigned i = hash(hash(a), hash(b)) % m_capacity;
-        if (m_cache[i].m_a == a.raw() && m_cache[i].m_b == b.raw()) {
-            return true;
-        } else {
-            if (m_cache[i].m_a == nullptr)
-                m_used.push_back(i);
-            m_cache[i].m_a = a.raw();
-            m_cache[i].m_b = b.raw();
-            return false;
+        m_stats.m_lookups++;
+        uint64 h    = hash(hash(a), hash(b));
+        unsigned i  = h & (m_num_sets - 1);
+        entry * set = m_cache.data() + i * LEAN_EXPR_CACHE_WAYS;
+        for (unsigned j = 0; j < LEAN_EXPR_CACHE_WAYS; j++) {
+            if (set[j].m_a == a.raw() && set[j].m_b == b.raw()) {
+                m_stats.m_hits++;
+                return true;
+            }
+            if (set[j].m_a == nullptr) {
+                if (j == 0)
+                    m_used.push_back(i);
+                set[j].m_a = a.raw();
+                set[j].m_b = b.raw();
+                return false;
+            }
         }
+        entry & victim = set[(h >> 32) % LEAN_EXPR_CACHE_WAYS];
+        victim.m_a = a.raw();
+        victim.m_b = b.raw();
+        m_evictions++;
+        m_stats.m_evictions++;
+        return false;
     }
 
     void clear() {
-        for (unsigned i : m_used)
-            m_cache[i].m_a = nullptr;
+        for (unsigned i : m_used) {
+            for (unsigned j = 0; j < LEAN_EXPR_CACHE_WAYS; j++)
+                m_cache[i * LEAN_EXPR_CACHE_WAYS + j].m_a = nullptr;
+        }
         m_used.clear();
+        if (m_evictions > capacity() / 4 && capacity() < LEAN_EQ_CACHE_MAX_CAPACITY) {
+            m_num_sets *= 2;
+            m_cache = std::vector<entry>(m_num_sets * LEAN_EXPR_CACHE_WAYS);
+            m_stats.m_resizes++;
+        }
+        m_evictions = 0;
+        if (m_stats.m_lookups + m_stats_shared.m_lookups >= LEAN_EXPR_CACHE_STATS_FLUSH)
+            flush_stats();
     }
 };
 
 /* CACHE_RESET: No */
 MK_THREAD_LOCAL_GET_DEF(eq_cache, get_eq_cache);
 
+/* Optional tier of the equality cache shared by all threads, enabled by setting `LEAN_SHARED_EQ_CACHE`
+   to its number of entries. It stores pairs of persistent expressions (e.g., from imported `.olean` files)
+   that are known to be equal, so that threads comparing the same imported terms do not repeat the work.
+   Each entry is protected by a sequence lock, so lookups do not write to shared memory.
+   Entries are tagged with the number of freed compacted regions, since freeing a region may
+   reuse the addresses of its objects. */
+class shared_eq_cache {
+    struct entry {
+        atomic<uint64>   m_seq;
+        atomic<object *> m_a;
+        atomic<object *> m_b;
+        atomic<uint64>   m_tag;
+        entry():m_seq(0), m_a(nullptr), m_b(nullptr), m_tag(0) {}
+    };
+    size_t                   m_mask;
+    std::unique_ptr<entry[]> m_entries;
+
+    static uint64 mk_tag(bool bi) { return (get_num_freed_compacted_regions() << 1) | static_cast<uint64>(bi); }
+    entry & get_entry(object * a, object * b) {
+        return m_entries[hash(reinterpret_cast<size_t>(a), reinterpret_cast<size_t>(b)) & m_mask];
+    }
+public:
+    shared_eq_cache(size_t capacity) {
+        size_t sz = 1;
+        while (sz < capacity) sz *= 2;
+        m_mask = sz - 1;
+        m_entries.reset(new entry[sz]);
+    }
+
+    bool find(object * a, object * b, bool bi) {
+        entry & e = get_entry(a, b);
+        uint64 seq = e.m_seq.load();
+        if (seq % 2 == 1)
+            return false;
+        bool r = e.m_a.load() == a && e.m_b.load() == b && e.m_tag.load() == mk_tag(bi);
+        return r && e.m_seq.load() == seq;
+    }
+
+    void insert(object * a, object * b, bool bi) {
+        entry & e = get_entry(a, b);
+        uint64 seq = e.m_seq.load();
+        if (seq % 2 == 1 || !e.m_seq.compare_exchange_strong(seq, seq + 1))
+            return; // another thread is updating this entry
+        e.m_a.store(a);
+        e.m_b.store(b);
+        e.m_tag.store(mk_tag(bi));
+        e.m_seq.store(seq + 2);
+    }
+};
+
+static shared_eq_cache * g_shared_eq_cache = nullptr;
+
 /** \brief Functional object for comparing expressions.
 
     Remark if CompareBinderInfo is true, then functional object will also compare
@@ -71,6 +169,21 @@ class expr_eq_fn {
         if (is_bvar(a))            return bvar_idx(a) == bvar_idx(b);
         if (m_cache.check(a, b))
             return true;
+        if (g_shared_eq_cache && lean_is_persistent(a.raw()) && lean_is_persistent(b.raw()) && !is_atomic(a)) {
+            m_cache.m_stats_shared.m_lookups++;
+            if (g_shared_eq_cache->find(a.raw(), b.raw(), CompareBinderInfo)) {
+                m_cache.m_stats_shared.m_hits++;
+                return true;
+            }
+            bool r = apply_core(a, b);
+            if (r)
+                g_shared_eq_cache->insert(a.raw(), b.raw(), CompareBinderInfo);
+            return r;
+        }
+        return apply_core(a, b);
+    }
+
+    bool apply_core(expr const & a, expr const & b) {
         /*
            We increase the number of heartbeats here because some code (e.g., `simp`) may spend a lot of time comparing
            `Expr`s (e.g., checking a cache with many collisions) without allocating any significant amount of memory.
@@ -128,6 +241,17 @@ public:
     bool operator()(expr const & a, expr const & b) { return apply(a, b); }
 };
 
+void initialize_expr_eq_fn() {
+    if (char const * n = std::getenv("LEAN_SHARED_EQ_CACHE")) {
+        if (atoi(n) > 0)
+            g_shared_eq_cache = new shared_eq_cache(atoi(n));
+    }
+}
+
+void finalize_expr_eq_fn() {
+    delete g_shared_eq_cache;
+}
+
 bool is_equal(expr const & a, expr const & b) {
     return expr_eq_fn<false>()(a, b);
 }
@@ -26,4 +26,7 @@ struct is_cond_bi_equal_proc {
     is_cond_bi_equal_proc(bool b):m_use_bi(b) {}
     bool operator()(expr const & e1, expr const & e2) const { return m_use_bi ? is_bi_equal(e1, e2) : e1 == e2; }
 };
+
+void initialize_expr_eq_fn();
+void finalize_expr_eq_fn();
 }
@@ -7,6 +7,7 @@ Author: Leonardo de Moura
 #include "kernel/environment.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr.h"
+#include "kernel/expr_eq_fn.h"
 #include "kernel/level.h"
 #include "kernel/declaration.h"
 #include "kernel/local_ctx.h"
@@ -17,6 +18,7 @@ namespace lean {
 void initialize_kernel_module() {
     initialize_level();
     initialize_expr();
+    initialize_expr_eq_fn();
     initialize_declaration();
     initialize_type_checker();
     initialize_environment();
@@ -32,6 +34,7 @@ void finalize_kernel_module() {
     finalize_environment();
     finalize_type_checker();
     finalize_declaration();
+    finalize_expr_eq_fn();
     finalize_expr();
     finalize_level();
 }
@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <unordered_set>
+#include <cstdlib>
 #include "runtime/debug.h"
 #include "runtime/interrupt.h"
 #include "runtime/hash.h"
@@ -30,11 +31,13 @@ extern "C" object * lean_level_mk_param(obj_arg);
 extern "C" object * lean_level_mk_max(obj_arg, obj_arg);
 extern "C" object * lean_level_mk_imax(obj_arg, obj_arg);
 
-level mk_succ(level const & l) { return level(lean_level_mk_succ(l.to_obj_arg())); }
-level mk_max_core(level const & l1, level const & l2) { return level(lean_level_mk_max(l1.to_obj_arg(), l2.to_obj_arg())); }
-level mk_imax_core(level const & l1, level const & l2) { return level(lean_level_mk_imax(l1.to_obj_arg(), l2.to_obj_arg())); }
-level mk_univ_param(name const & n) { return level(lean_level_mk_param(n.to_obj_arg())); }
-level mk_univ_mvar(name const & n) { return level(lean_level_mk_mvar(n.to_obj_arg())); }
+bool g_kernel_intern = false;
+
+level mk_succ(level const & l) { return level(kernel_intern(lean_level_mk_succ(l.to_obj_arg()))); }
+level mk_max_core(level const & l1, level const & l2) { return level(kernel_intern(lean_level_mk_max(l1.to_obj_arg(), l2.to_obj_arg()))); }
+level mk_imax_core(level const & l1, level const & l2) { return level(kernel_intern(lean_level_mk_imax(l1.to_obj_arg(), l2.to_obj_arg()))); }
+level mk_univ_param(name const & n) { return level(kernel_intern(lean_level_mk_param(n.to_obj_arg()))); }
+level mk_univ_mvar(name const & n) { return level(kernel_intern(lean_level_mk_mvar(n.to_obj_arg()))); }
 
 unsigned level::hash() const { return lean_level_hash(to_obj_arg()); }
 unsigned get_depth(level const & l) { return lean_level_depth(l.to_obj_arg()); }
@@ -528,6 +531,8 @@ level::level():level(*g_level_zero) {
 }
 
 void initialize_level() {
+    if (char const * v = std::getenv("LEAN_KERNEL_INTERN"))
+        g_kernel_intern = atoi(v) != 0;
     g_level_zero = new level(lean_level_mk_zero(box(0)));
     mark_persistent(g_level_zero->raw());
     g_level_one  = new level(mk_succ(*g_level_zero));
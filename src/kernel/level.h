@@ -12,8 +12,15 @@ Author: Leonardo de Moura
 #include "runtime/list_ref.h"
 #include "util/name.h"
 #include "util/options.h"
+#include "runtime/sharecommon.h"
 
 namespace lean {
+/** \brief When `LEAN_KERNEL_INTERN` is set, the kernel constructors for `level` and `expr` return objects
+    from the global intern table (see `intern_object`). Then, structurally equal terms built by the kernel
+    are physically equal, and are compared in constant time. */
+extern bool g_kernel_intern;
+inline object * kernel_intern(object * o) { return g_kernel_intern ? intern_object(o) : o; }
+
 class environment;
 struct level_cell;
 /**
@@ -8,12 +8,19 @@ Author: Leonardo de Moura
 #include <memory>
 #include "kernel/replace_fn.h"
 #include "kernel/cache_stack.h"
+#include "kernel/expr_cache.h"
 
 #ifndef LEAN_DEFAULT_REPLACE_CACHE_CAPACITY
 #define LEAN_DEFAULT_REPLACE_CACHE_CAPACITY 1024*8
 #endif
 
+#ifndef LEAN_REPLACE_CACHE_MAX_CAPACITY
+#define LEAN_REPLACE_CACHE_MAX_CAPACITY 1024*256
+#endif
+
 namespace lean {
+/* Set-associative cache for `replace_rec_fn`. As for `eq_cache`, the capacity is doubled
+   (up to `LEAN_REPLACE_CACHE_MAX_CAPACITY`) after a call that evicted more than a quarter of it. */
 struct replace_cache {
     struct entry {
         object  *  m_cell;
@@ -21,34 +28,75 @@ struct replace_cache {
         expr       m_result;
         entry():m_cell(nullptr) {}
     };
-    unsigned              m_capacity;
+    unsigned              m_num_sets;
     std::vector<entry>    m_cache;
     std::vector<unsigned> m_used;
-    replace_cache(unsigned c):m_capacity(c), m_cache(c) {}
+    unsigned              m_evictions;
+    expr_cache_stats      m_stats;
+    replace_cache(unsigned c):m_num_sets(c / LEAN_EXPR_CACHE_WAYS), m_cache(c), m_evictions(0) {}
+    ~replace_cache() { flush_expr_cache_stats(expr_cache_kind::Replace, m_stats); }
+
+    unsigned capacity() const { return m_cache.size(); }
+
+    entry * get_set(expr const & e, unsigned offset, uint64 & h) {
+        h = hash(hash(e), offset);
+        return m_cache.data() + (h & (m_num_sets - 1)) * LEAN_EXPR_CACHE_WAYS;
+    }
 
     expr * find(expr const & e, unsigned offset) {
-        unsigned i = hash(hash(e), offset) % m_capacity;
-        if (m_cache[i].m_cell == e.raw() && m_cache[i].m_offset == offset)
-            return &m_cache[i].m_result;
-        else
-            return nullptr;
+        m_stats.m_lookups++;
+        uint64 h;
+        entry * set = get_set(e, offset, h);
+        for (unsigned j = 0; j < LEAN_EXPR_CACHE_WAYS; j++) {
+            if (set[j].m_cell == e.raw() && set[j].m_offset == offset) {
+                m_stats.m_hits++;
+                return &set[j].m_result;
+            }
+            if (set[j].m_cell == nullptr)
+                break;
+        }
+        return nullptr;
     }
 
     void insert(expr const & e, unsigned offset, expr const & v) {
-        unsigned i = hash(hash(e), offset) % m_capacity;
-        if (m_cache[i].m_cell == nullptr)
-            m_used.push_back(i);
-        m_cache[i].m_cell   = e.raw();
-        m_cache[i].m_offset = offset;
-        m_cache[i].m_result = v;
+        uint64 h;
+        entry * set = get_set(e, offset, h);
+        entry * victim = nullptr;
+        for (unsigned j = 0; j < LEAN_EXPR_CACHE_WAYS; j++) {
+            if (set[j].m_cell == nullptr) {
+                if (j == 0)
+                    m_used.push_back(h & (m_num_sets - 1));
+                victim = &set[j];
+                break;
+            }
+        }
+        if (!victim) {
+            victim = &set[(h >> 32) % LEAN_EXPR_CACHE_WAYS];
+            m_evictions++;
+            m_stats.m_evictions++;
+        }
+        victim->m_cell   = e.raw();
+        victim->m_offset = offset;
+        victim->m_result = v;
     }
 
     void clear() {
         for (unsigned i : m_used) {
-            m_cache[i].m_cell   = nullptr;
-            m_cache[i].m_result = expr();
+            for (unsigned j = 0; j < LEAN_EXPR_CACHE_WAYS; j++) {
+                entry & en = m_cache[i * LEAN_EXPR_CACHE_WAYS + j];
+                en.m_cell   = nullptr;
+                en.m_result = expr();
+            }
         }
         m_used.clear();
+        if (m_evictions > capacity() / 4 && capacity() < LEAN_REPLACE_CACHE_MAX_CAPACITY) {
+            m_num_sets *= 2;
+            m_cache = std::vector<entry>(m_num_sets * LEAN_EXPR_CACHE_WAYS);
+            m_stats.m_resizes++;
+        }
+        m_evictions = 0;
+        if (m_stats.m_lookups >= LEAN_EXPR_CACHE_STATS_FLUSH)
+            flush_expr_cache_stats(expr_cache_kind::Replace, m_stats);
     }
 };
 
@@ -6,9 +6,14 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <unordered_map>
 #include "runtime/interrupt.h"
+#include "runtime/thread.h"
 #include "runtime/sstream.h"
 #include "runtime/flet.h"
+#include "runtime/compact.h"
 #include "util/lbool.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
@@ -40,10 +45,159 @@ static expr * g_nat_lor      = nullptr;
 static expr * g_nat_xor      = nullptr;
 static expr * g_nat_shiftLeft  = nullptr;
 static expr * g_nat_shiftRight = nullptr;
+static expr * g_nat_log2     = nullptr;
 
 type_checker::state::state(environment const & env):
     m_env(env), m_ngen(*g_kernel_fresh) {}
 
+/* Cross-declaration cache for `whnf` and `infer_type` results.
+
+   It is disabled by default, and enabled by setting `LEAN_KERNEL_CACHE` to the maximum number of
+   entries per table. Only closed terms are cached, i.e., terms without free variables, loose bound
+   variables, metavariables and universe parameters. Each entry also stores the `constant_info` objects
+   of the constants occurring in the key, and it is only used if the current environment maps
+   each of them to the same object. Environments only grow, so an entry created while checking a
+   declaration remains valid for all environments extending that one, but it is not used in
+   environments where one of these constants was declared differently (e.g., when the server
+   re-elaborates a file). The cache is cleared before a compacted region is freed (see `Environment.freeRegions`),
+   since its entries may refer to objects of imported modules, and their addresses may be reused. */
+#define LEAN_KERNEL_CACHE_MAX_DEPS   32
+#define LEAN_KERNEL_CACHE_MAX_VISITS 4096
+
+class kernel_cache {
+public:
+    enum class kind { Whnf, InferType };
+private:
+    struct entry {
+        expr                       m_value;
+        std::vector<constant_info> m_deps;
+    };
+    typedef std::unordered_map<expr, entry, expr_hash> table;
+    mutex  m_mutex;
+    size_t m_max_size;
+    table  m_tables[2];
+    size_t m_hits    = 0;
+    size_t m_misses  = 0;
+    size_t m_stale   = 0;
+    size_t m_flushes = 0;
+
+    static bool is_valid(environment const & env, std::vector<constant_info> const & deps) {
+        for (constant_info const & d : deps) {
+            optional<constant_info> info = env.find(d.get_name());
+            if (!info || !is_eqp(*info, d))
+                return false;
+        }
+        return true;
+    }
+
+    /* Store in `deps` the `constant_info` objects of the constants occurring in `e`.
+       Return false if `e` is not closed, or if it is too big or refers to too many constants. */
+    static bool collect_deps(environment const & env, expr const & e, std::vector<constant_info> & deps) {
+        if (has_fvar(e) || has_loose_bvars(e) || has_mvar(e) || has_univ_param(e))
+            return false;
+        buffer<name> cs;
+        unsigned visits = 0;
+        bool ok = true;
+        for_each(e, [&](expr const & c, unsigned) {
+                if (!ok) return false;
+                if (++visits > LEAN_KERNEL_CACHE_MAX_VISITS) {
+                    ok = false;
+                    return false;
+                }
+                if (is_constant(c) && std::find(cs.begin(), cs.end(), const_name(c)) == cs.end()) {
+                    if (cs.size() >= LEAN_KERNEL_CACHE_MAX_DEPS) {
+                        ok = false;
+                        return false;
+                    }
+                    cs.push_back(const_name(c));
+                }
+                return true;
+            });
+        if (!ok)
+            return false;
+        for (name const & n : cs) {
+            optional<constant_info> info = env.find(n);
+            if (!info)
+                return false;
+            deps.push_back(*info);
+        }
+        return true;
+    }
+
+public:
+    kernel_cache(size_t max_size):m_max_size(max_size) {}
+
+    optional<expr> find(environment const & env, kind k, expr const & e) {
+        if (has_fvar(e) || has_univ_param(e))
+            return none_expr();
+        lock_guard<mutex> _(m_mutex);
+        table & t = m_tables[static_cast<unsigned>(k)];
+        auto it = t.find(e);
+        if (it == t.end()) {
+            m_misses++;
+            return none_expr();
+        }
+        if (!is_valid(env, it->second.m_deps)) {
+            m_stale++;
+            return none_expr();
+        }
+        m_hits++;
+        return some_expr(it->second.m_value);
+    }
+
+    void insert(environment const & env, kind k, expr const & e, expr const & r) {
+        entry en;
+        if (!collect_deps(env, e, en.m_deps))
+            return;
+        en.m_value = r;
+        /* The entry is going to be shared with other threads. */
+        mark_mt(e.raw());
+        mark_mt(r.raw());
+        for (constant_info const & d : en.m_deps)
+            mark_mt(d.raw());
+        lock_guard<mutex> _(m_mutex);
+        table & t = m_tables[static_cast<unsigned>(k)];
+        if (t.size() >= m_max_size) {
+            t.clear();
+            m_flushes++;
+        }
+        t.insert(mk_pair(e, std::move(en)));
+    }
+
+    void clear() {
+        lock_guard<mutex> _(m_mutex);
+        for (table & t : m_tables)
+            t.clear();
+        m_flushes++;
+    }
+
+    void display_stats(std::ostream & out) {
+        lock_guard<mutex> _(m_mutex);
+        out << "kernel cache: " << m_tables[0].size() << " whnf entries, "
+            << m_tables[1].size() << " infer_type entries, "
+            << m_hits << " hits, " << m_misses << " misses, "
+            << m_stale << " stale, " << m_flushes << " flushes\n";
+    }
+};
+
+static kernel_cache * g_kernel_cache = nullptr;
+
+static optional<expr> kernel_cache_find(environment const & env, kernel_cache::kind k, expr const & e) {
+    if (!g_kernel_cache)
+        return none_expr();
+    return g_kernel_cache->find(env, k, e);
+}
+
+static void kernel_cache_insert(environment const & env, kernel_cache::kind k, expr const & e, expr const & r) {
+    if (g_kernel_cache && !is_eqp(e, r))
+        g_kernel_cache->insert(env, k, e, r);
+}
+
+void display_kernel_cache_stats(std::ostream & out) {
+    if (g_kernel_cache)
+        g_kernel_cache->display_stats(out);
+}
+
 /** \brief Make sure \c e "is" a sort, and return the corresponding sort.
     If \c e is not a sort, then the whnf procedure is invoked.
 
@@ -298,6 +452,14 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     if (it != m_st->m_infer_type[infer_only].end())
         return it->second;
 
+    bool use_kernel_cache = infer_only && (is_app(e) || is_proj(e) || is_let(e) || is_binding(e));
+    if (use_kernel_cache) {
+        if (auto r = kernel_cache_find(env(), kernel_cache::kind::InferType, e)) {
+            m_st->m_infer_type[infer_only].insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
     expr r;
     switch (e.kind()) {
     case expr_kind::Lit:      r = lit_type(lit_value(e)); break;
@@ -319,6 +481,8 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     }
 
     m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    if (use_kernel_cache)
+        kernel_cache_insert(env(), kernel_cache::kind::InferType, e, r);
     return r;
 }
 
@@ -571,6 +735,13 @@ static inline nat get_nat_val(expr const & e) {
     return lit_value(e).get_nat();
 }
 
+template<typename F> optional<expr> type_checker::reduce_unary_nat_op(F const & f, expr const & e) {
+    expr arg = whnf(app_arg(e));
+    if (!is_nat_lit_ext(arg)) return none_expr();
+    nat v = get_nat_val(arg);
+    return some_expr(mk_lit(literal(nat(f(v.raw())))));
+}
+
 template<typename F> optional<expr> type_checker::reduce_bin_nat_op(F const & f, expr const & e) {
     expr arg1 = whnf(app_arg(app_fn(e)));
     if (!is_nat_lit_ext(arg1)) return none_expr();
@@ -578,7 +749,17 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_op(F const & f,
     if (!is_nat_lit_ext(arg2)) return none_expr();
     nat v1 = get_nat_val(arg1);
     nat v2 = get_nat_val(arg2);
-    return some_expr(mk_lit(literal(nat(f(v1.raw(), v2.raw())))));
+    if (v1.is_small() && v2.is_small())
+        return some_expr(mk_lit(literal(nat(f(v1.raw(), v2.raw())))));
+    /* Operations on big literals are memoized: `decide` and `rfl` proofs over large numerals
+       tend to evaluate the same products and remainders many times, reached through different terms. */
+    expr key = mk_app(app_fn(app_fn(e)), arg1, arg2);
+    auto it = m_st->m_nat_ops.find(key);
+    if (it != m_st->m_nat_ops.end())
+        return some_expr(it->second);
+    expr r = mk_lit(literal(nat(f(v1.raw(), v2.raw()))));
+    m_st->m_nat_ops.insert(mk_pair(key, r));
+    return some_expr(r);
 }
 
 template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const & f, expr const & e) {
@@ -602,6 +783,7 @@ optional<expr> type_checker::reduce_nat(expr const & e) {
             nat v = get_nat_val(arg);
             return some_expr(mk_lit(literal(nat(v+nat(1)))));
         }
+        if (f == *g_nat_log2) return reduce_unary_nat_op(nat_log2, e);
     } else if (nargs == 2) {
         expr const & f = app_fn(app_fn(e));
         if (!is_constant(f)) return none_expr();
@@ -646,24 +828,31 @@ expr type_checker::whnf(expr const & e) {
     auto it = m_st->m_whnf.find(e);
     if (it != m_st->m_whnf.end())
         return it->second;
+    if (auto r = kernel_cache_find(env(), kernel_cache::kind::Whnf, e)) {
+        m_st->m_whnf.insert(mk_pair(e, *r));
+        return *r;
+    }
 
     expr t = e;
+    expr r;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            r = t1;
+            break;
         }
     }
+    m_st->m_whnf.insert(mk_pair(e, r));
+    kernel_cache_insert(env(), kernel_cache::kind::Whnf, e, r);
+    return r;
 }
 
 /** \brief Given lambda/Pi expressions \c t and \c s, return true iff \c t is def eq to \c s.
@@ -1173,10 +1362,17 @@ void initialize_type_checker() {
     g_nat_xor      = new_persistent_expr_const({"Nat", "xor"});
     g_nat_shiftLeft  = new_persistent_expr_const({"Nat", "shiftLeft"});
     g_nat_shiftRight = new_persistent_expr_const({"Nat", "shiftRight"});
+    g_nat_log2     = new_persistent_expr_const({"Nat", "log2"});
     g_string_mk    = new_persistent_expr_const({"String", "mk"});
     g_lean_reduce_bool = new_persistent_expr_const({"Lean", "reduceBool"});
     g_lean_reduce_nat  = new_persistent_expr_const({"Lean", "reduceNat"});
     register_name_generator_prefix(*g_kernel_fresh);
+    if (char const * n = std::getenv("LEAN_KERNEL_CACHE")) {
+        if (atoi(n) > 0) {
+            g_kernel_cache = new kernel_cache(atoi(n));
+            register_compacted_region_free_hook([]() { if (g_kernel_cache) g_kernel_cache->clear(); });
+        }
+    }
 }
 
 void finalize_type_checker() {
@@ -1199,8 +1395,11 @@ void finalize_type_checker() {
     delete g_nat_xor;
     delete g_nat_shiftLeft;
     delete g_nat_shiftRight;
+    delete g_nat_log2;
     delete g_string_mk;
     delete g_lean_reduce_bool;
     delete g_lean_reduce_nat;
+    delete g_kernel_cache;
+    g_kernel_cache = nullptr;
 }
 }
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include <memory>
 #include <utility>
 #include <algorithm>
+#include <iosfwd>
 #include "util/lbool.h"
 #include "util/name_set.h"
 #include "util/name_generator.h"
@@ -30,6 +31,8 @@ public:
         infer_cache               m_infer_type[2];
         expr_map<expr>            m_whnf_core;
         expr_map<expr>            m_whnf;
+        /* Results of `Nat` operations on big literals, keyed by the operation applied to the literal arguments. */
+        expr_map<expr>            m_nat_ops;
         equiv_manager             m_eqv_manager;
         expr_pair_set             m_failure;
         friend type_checker;
@@ -96,6 +99,7 @@ private:
     expr check_ignore_undefined_universes(expr const & e);
     optional<expr> try_unfold_proj_app(expr const & e);
 
+    template<typename F> optional<expr> reduce_unary_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_pred(F const & f, expr const & e);
     optional<expr> reduce_nat(expr const & e);
@@ -157,6 +161,9 @@ public:
     optional<expr> unfold_definition(expr const & e);
 };
 
+/** \brief Display the hit/miss counters of the cross-declaration kernel cache (see `LEAN_KERNEL_CACHE`). */
+void display_kernel_cache_stats(std::ostream & out);
+
 void initialize_type_checker();
 void finalize_type_checker();
 }
@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "runtime/flet.h"
+#include "runtime/hash.h"
+#include "runtime/compact.h"
+#include "runtime/array_ref.h"
+#include "util/option_declarations.h"
+#include "util/path.h"
+#include "kernel/for_each_fn.h"
+#include "library/trace.h"
+#include "library/util.h"
+#include "library/class.h"
+#include "library/compiler/compile_cache.h"
+#include "library/compiler/csimp.h"
+#include "library/compiler/closed_term_cache.h"
+#include "library/compiler/export_attribute.h"
+#include "library/compiler/extern_attribute.h"
+#include "library/compiler/implemented_by_attribute.h"
+#include "githash.h" // NOLINT
+
+namespace lean {
+static name * g_cache_dir = nullptr;
+
+extern "C" uint8 lean_has_macro_inline_attribute(object * env, object * n);
+extern "C" uint8 lean_has_specialize_attribute(object * env, object * n);
+extern "C" uint8 lean_has_nospecialize_attribute(object * env, object * n);
+extern "C" object * lean_csimp_replace_constants(object * env, object * e);
+extern "C" object * lean_add_specialization_info(object * env, object * fn, object * info);
+extern "C" object * lean_cache_specialization(object * env, object * e, object * fn);
+extern "C" object * lean_get_cached_specialization(object * env, object * e);
+
+/* Changes made by the compiler pipeline to the environment, and cache entries it used. */
+enum class cache_effect { Add, ClosedTerm, SpecInfo, Specialization };
+enum class cache_use { ClosedTerm, Specialization };
+
+struct compile_cache_recorder {
+    buffer<object_ref> m_effects;
+    buffer<object_ref> m_uses;
+};
+
+LEAN_THREAD_PTR(compile_cache_recorder, g_recorder);
+
+void compile_cache_record_add(declaration const & d) {
+    if (g_recorder)
+        g_recorder->m_effects.push_back(mk_cnstr(static_cast<unsigned>(cache_effect::Add), d));
+}
+
+void compile_cache_record_closed_term(expr const & e, name const & n) {
+    if (g_recorder)
+        g_recorder->m_effects.push_back(mk_cnstr(static_cast<unsigned>(cache_effect::ClosedTerm), e, n));
+}
+
+void compile_cache_record_closed_term_use(expr const & e, name const & n) {
+    if (g_recorder)
+        g_recorder->m_uses.push_back(mk_cnstr(static_cast<unsigned>(cache_use::ClosedTerm), e, n));
+}
+
+void compile_cache_record_spec_info(name const & fn, object_ref const & info) {
+    if (g_recorder)
+        g_recorder->m_effects.push_back(mk_cnstr(static_cast<unsigned>(cache_effect::SpecInfo), fn, info));
+}
+
+void compile_cache_record_specialization(expr const & key, name const & fn) {
+    if (g_recorder)
+        g_recorder->m_effects.push_back(mk_cnstr(static_cast<unsigned>(cache_effect::Specialization), key, fn));
+}
+
+void compile_cache_record_specialization_use(expr const & key, name const & fn) {
+    if (g_recorder)
+        g_recorder->m_uses.push_back(mk_cnstr(static_cast<unsigned>(cache_use::Specialization), key, fn));
+}
+
+static object_ref mk_option(optional<object_ref> const & o) {
+    return o ? object_ref(mk_option_some(o->to_obj_arg())) : object_ref(box(0));
+}
+
+static object_ref mk_option(optional<expr> const & e) {
+    return mk_option(e ? optional<object_ref>(*e) : optional<object_ref>());
+}
+
+static optional<expr> get_value_of(environment const & env, name const & n) {
+    if (optional<constant_info> info = env.find(n))
+        if (info->is_definition())
+            return some_expr(info->get_value());
+    return none_expr();
+}
+
+/* The information about the constant `c` that may affect compiling declarations using it. */
+static object_ref mk_dependency_key(environment const & env, name const & c) {
+    buffer<object_ref> r;
+    r.push_back(c);
+    if (optional<constant_info> info = env.find(c)) {
+        r.push_back(info->get_type());
+        optional<expr> stage1 = get_value_of(env, mk_cstage1_name(c));
+        r.push_back(mk_option(stage1));
+        r.push_back(mk_option(get_value_of(env, mk_cstage2_name(c))));
+        // definitions without stage1 code, such as structure projections, may be unfolded
+        r.push_back(mk_option(stage1 ? none_expr() : get_value_of(env, c)));
+        unsigned attrs =
+            has_inline_attribute(env, c) | has_noinline_attribute(env, c) << 1 |
+            has_inline_if_reduce_attribute(env, c) << 2 | lean_has_macro_inline_attribute(env.to_obj_arg(), c.to_obj_arg()) << 3 |
+            lean_has_specialize_attribute(env.to_obj_arg(), c.to_obj_arg()) << 4 |
+            lean_has_nospecialize_attribute(env.to_obj_arg(), c.to_obj_arg()) << 5 |
+            has_never_extract_attribute(env, c) << 6 | is_extern_or_init_constant(env, c) << 7;
+        r.push_back(object_ref(box(attrs)));
+        r.push_back(object_ref(lean_csimp_replace_constants(env.to_obj_arg(), mk_constant(c).to_obj_arg())));
+        optional<name> impl = get_implemented_by_attribute(env, c);
+        r.push_back(mk_option(impl ? optional<object_ref>(*impl) : optional<object_ref>()));
+        optional<name> exp = get_export_name_for(env, c);
+        r.push_back(mk_option(exp ? optional<object_ref>(*exp) : optional<object_ref>()));
+    }
+    return array_ref<object_ref>(r);
+}
+
+static void collect_constants(expr const & e, name_set & visited, buffer<name> & todo) {
+    for_each(e, [&](expr const & e, unsigned) {
+            if (is_constant(e) && !visited.contains(const_name(e))) {
+                visited.insert(const_name(e));
+                todo.push_back(const_name(e));
+            }
+            return true;
+        });
+}
+
+/* Return true if the code of `c` may be copied into its callers by `csimp` or `specialize`. Then the constants it
+   uses are dependencies of the callers as well. */
+static bool is_inlinable(environment const & env, name const & c, optional<expr> const & stage1,
+                         optional<expr> const & stage2, unsigned inline_threshold) {
+    if (!stage1 ||
+        has_inline_attribute(env, c) || has_inline_if_reduce_attribute(env, c) ||
+        lean_has_macro_inline_attribute(env.to_obj_arg(), c.to_obj_arg()) ||
+        lean_has_specialize_attribute(env.to_obj_arg(), c.to_obj_arg()) ||
+        is_instance(env, c) || is_matcher(env, c))
+        return true;
+    // "cheap" functions are inlined as well
+    return get_lcnf_size(env, *stage1) <= inline_threshold ||
+        (stage2 && get_lcnf_size(env, *stage2) <= inline_threshold);
+}
+
+static object_ref mk_key(environment const & env, options const & opts, comp_decls const & ds) {
+    buffer<object_ref> inputs;
+    buffer<name> todo;
+    name_set visited;
+    for (comp_decl const & d : ds) {
+        inputs.push_back(d.fst());
+        inputs.push_back(d.snd());
+        if (optional<constant_info> info = env.find(d.fst())) {
+            inputs.push_back(info->get_type());
+            inputs.push_back(info->get_lparams());
+        }
+        collect_constants(d.snd(), visited, todo);
+    }
+    /* Hash the transitive closure of the dependencies reachable through code that may be inlined or specialized,
+       since changing any of them may change the result without changing the direct dependencies. */
+    unsigned inline_threshold = csimp_cfg(opts).m_inline_threshold;
+    buffer<object_ref> dep_keys;
+    for (unsigned i = 0; i < todo.size(); i++) {
+        name c = todo[i];
+        dep_keys.push_back(mk_dependency_key(env, c));
+        if (!env.find(c))
+            continue;
+        optional<expr> stage1 = get_value_of(env, mk_cstage1_name(c));
+        optional<expr> stage2 = get_value_of(env, mk_cstage2_name(c));
+        if (!is_inlinable(env, c, stage1, stage2, inline_threshold))
+            continue;
+        if (stage1)
+            collect_constants(*stage1, visited, todo);
+        else if (optional<expr> val = get_value_of(env, c))
+            collect_constants(*val, visited, todo);
+        if (stage2)
+            collect_constants(*stage2, visited, todo);
+    }
+    return mk_cnstr(0, string_ref(std::string(LEAN_GITHASH) + " " + get_version_string()),
+                    object_ref(opts.to_obj_arg()), array_ref<object_ref>(inputs), array_ref<object_ref>(dep_keys));
+}
+
+/* Entry files start with a header containing a checksum of the compacted data. */
+struct compile_cache_header {
+    char   m_marker[8];
+    uint64 m_size;
+    uint64 m_checksum;
+};
+
+static char const g_marker[8] = {'l', 'e', 'a', 'n', 'c', 'c', '0', '1'};
+
+static uint64 checksum(void const * data, size_t size) {
+    return hash_bytes(size, static_cast<unsigned char const *>(data), 31);
+}
+
+compile_cache::compile_cache(environment const & env, options const & opts, comp_decls const & ds) {
+    char const * dir = opts.get_string(*g_cache_dir, "");
+    if (*dir == 0 || is_trace_enabled())
+        return;
+    object_ref key = mk_key(env, opts, ds);
+    object_compactor compactor;
+    compactor(key.raw());
+    unsigned char const * data = static_cast<unsigned char const *>(compactor.data());
+    char hex[33];
+    snprintf(hex, sizeof(hex), "%016llx%016llx",
+             static_cast<unsigned long long>(hash_bytes(compactor.size(), data, 11)),
+             static_cast<unsigned long long>(hash_bytes(compactor.size(), data, 0x9e3779b97f4a7c15ull)));
+    m_file = std::string(dir) + get_dir_sep() + hex + ".ccache";
+}
+
+optional<pair<environment, optional<comp_decls>>> compile_cache::load(environment const & env) {
+    typedef optional<pair<environment, optional<comp_decls>>> result;
+    if (m_file.empty())
+        return result();
+    std::ifstream in(m_file, std::ios_base::binary);
+    if (in.fail())
+        return result();
+    compile_cache_header header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (in.fail() || memcmp(header.m_marker, g_marker, sizeof(g_marker)) != 0)
+        return result();
+    char * data = static_cast<char *>(malloc(header.m_size));
+    if (!data)
+        return result();
+    in.read(data, header.m_size);
+    if (in.fail() || checksum(data, header.m_size) != header.m_checksum) {
+        free(data);
+        return result();
+    }
+    // Like the regions of imported modules, the region is never freed: its objects may become part of the
+    // environment, and even if the entry is invalid, they may be referenced by discarded environments.
+    compacted_region * region = new compacted_region(header.m_size, data, nullptr, false, [=]() { free(data); });
+    object * entry = region->read();
+    if (!entry)
+        return result();
+    environment new_env = env;
+    try {
+        array_ref<object_ref> effects(cnstr_get(entry, 0), true);
+        for (object_ref const & e : effects) {
+            object * a = cnstr_get(e.raw(), 0);
+            object * b = lean_ctor_num_objs(e.raw()) > 1 ? cnstr_get(e.raw(), 1) : nullptr;
+            switch (static_cast<cache_effect>(cnstr_tag(e.raw()))) {
+            case cache_effect::Add:
+                new_env = new_env.add(declaration(a, true), false);
+                break;
+            case cache_effect::ClosedTerm:
+                new_env = cache_closed_term_name(new_env, expr(a, true), name(b, true));
+                break;
+            case cache_effect::SpecInfo:
+                new_env = environment(lean_add_specialization_info(new_env.to_obj_arg(), a, b));
+                break;
+            case cache_effect::Specialization:
+                new_env = environment(lean_cache_specialization(new_env.to_obj_arg(), a, b));
+                break;
+            }
+        }
+    } catch (exception &) {
+        return result();
+    }
+    // The shared caches must map the keys that were used to the same declarations.
+    array_ref<object_ref> uses(cnstr_get(entry, 1), true);
+    for (object_ref const & u : uses) {
+        expr key(cnstr_get(u.raw(), 0), true);
+        name n(cnstr_get(u.raw(), 1), true);
+        optional<name> cur;
+        switch (static_cast<cache_use>(cnstr_tag(u.raw()))) {
+        case cache_use::ClosedTerm:
+            cur = get_closed_term_name(new_env, key);
+            break;
+        case cache_use::Specialization:
+            cur = to_optional<name>(lean_get_cached_specialization(new_env.to_obj_arg(), key.to_obj_arg()));
+            break;
+        }
+        if (!cur || *cur != n)
+            return result();
+    }
+    object * ds = cnstr_get(entry, 2);
+    if (is_scalar(ds))
+        return result(mk_pair(new_env, optional<comp_decls>()));
+    return result(mk_pair(new_env, optional<comp_decls>(comp_decls(cnstr_get(ds, 0), true))));
+}
+
+pair<environment, optional<comp_decls>> compile_cache::record(
+        std::function<pair<environment, optional<comp_decls>>()> const & fn) {
+    if (m_file.empty()) {
+        flet<compile_cache_recorder *> set(g_recorder, nullptr);
+        return fn();
+    }
+    compile_cache_recorder rec;
+    pair<environment, optional<comp_decls>> r;
+    {
+        flet<compile_cache_recorder *> set(g_recorder, &rec);
+        r = fn();
+    }
+    object_ref ds = r.second ? object_ref(mk_option_some(r.second->to_obj_arg())) : object_ref(box(0));
+    object_ref entry = mk_cnstr(0, array_ref<object_ref>(rec.m_effects), array_ref<object_ref>(rec.m_uses), ds);
+    object_compactor compactor;
+    compactor(entry.raw());
+    compile_cache_header header;
+    memcpy(header.m_marker, g_marker, sizeof(g_marker));
+    header.m_size     = compactor.size();
+    header.m_checksum = checksum(compactor.data(), compactor.size());
+    // Write to a fresh file and rename it so that concurrent readers never see a partial entry. Errors are ignored,
+    // the entry is merely not cached.
+    std::string tmp_file = m_file + ".tmp" + std::to_string(reinterpret_cast<uintptr_t>(&rec));
+    {
+        std::ofstream out(tmp_file, std::ios_base::binary);
+        out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        if (out.fail()) {
+            out.close();
+            std::remove(tmp_file.c_str());
+            return r;
+        }
+    }
+    if (std::rename(tmp_file.c_str(), m_file.c_str()) != 0)
+        std::remove(tmp_file.c_str());
+    return r;
+}
+
+void initialize_compile_cache() {
+    g_cache_dir = new name{"compiler", "cache_dir"};
+    mark_persistent(g_cache_dir->raw());
+    register_option(*g_cache_dir, {}, data_value_kind::String, "",
+                    "(compiler) directory of an on-disk cache of compilation results, disabled if empty");
+}
+
+void finalize_compile_cache() {
+    delete g_cache_dir;
+}
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <functional>
+#include <string>
+#include "kernel/environment.h"
+#include "library/compiler/util.h"
+
+namespace lean {
+/* On-disk cache of the results of the compiler pipeline up to IR generation (see `compile` at `compiler.cpp`), so
+   that rebuilding a module does not run `csimp`, `specialize`, etc. again for declarations that did not change.
+   It is enabled by setting the option `compiler.cache_dir` to a directory.
+
+   Entries are keyed by a hash of the Lean version, the options, the input declarations, and the types, stage1 and
+   stage2 code and compiler attributes of the constants they use, including the constants used by the code of
+   dependencies that may be inlined or specialized, transitively. An entry contains the resulting declarations and
+   the changes the pipeline made to the environment (auxiliary declarations, specialization and closed term cache
+   entries), which are recorded by the `record_*` functions below. Since the specialization and closed term caches
+   are shared between declarations, the entries of these caches that were used are stored as well, and an entry is
+   only reused if they are still the same. */
+class compile_cache {
+    std::string m_file;
+public:
+    /* Prepare caching the compilation of `ds`. Does nothing unless `compiler.cache_dir` is set and no `compiler`
+       trace class is enabled. */
+    compile_cache(environment const & env, options const & opts, comp_decls const & ds);
+
+    /* If there is a valid entry for the declarations, return the environment after replaying the recorded changes,
+       and the declarations to be compiled to IR (`none` for matchers). */
+    optional<pair<environment, optional<comp_decls>>> load(environment const & env);
+
+    /* Run `fn` (the compiler pipeline), recording its changes to the environment, and store the result. */
+    pair<environment, optional<comp_decls>> record(std::function<pair<environment, optional<comp_decls>>()> const & fn);
+};
+
+void compile_cache_record_add(declaration const & d);
+void compile_cache_record_closed_term(expr const & e, name const & n);
+void compile_cache_record_closed_term_use(expr const & e, name const & n);
+void compile_cache_record_spec_info(name const & fn, object_ref const & info);
+void compile_cache_record_specialization(expr const & key, name const & fn);
+void compile_cache_record_specialization_use(expr const & key, name const & fn);
+
+void initialize_compile_cache();
+void finalize_compile_cache();
+}
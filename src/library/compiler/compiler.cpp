@@ -31,6 +31,7 @@ Author: Leonardo de Moura
 #include "library/compiler/extern_attribute.h"
 #include "library/compiler/struct_cases_on.h"
 #include "library/compiler/ir.h"
+#include "library/compiler/compile_cache.h"
 
 namespace lean {
 static name * g_extract_closed = nullptr;
@@ -168,37 +169,8 @@ bool is_matcher(environment const & env, comp_decls const & ds) {
     return length(ds) == 1 && is_matcher(env, head(ds).fst());
 }
 
-environment compile(environment const & env, options const & opts, names cs) {
-    /* Do not generate code for irrelevant decls */
-    cs = filter(cs, [&](name const & c) { return !is_irrelevant_type(env, env.get(c).get_type());});
-    if (empty(cs)) return env;
-
-    for (name const & c : cs) {
-        if (is_main_fn(env, c) && !is_main_fn_type(env.get(c).get_type())) {
-            throw exception("invalid `main` function, it must have type `List String -> IO UInt32`");
-        }
-    }
-
-    if (length(cs) == 1) {
-        name c = get_real_name(head(cs));
-        if (has_implemented_by_attribute(env, c))
-            return env;
-        if (is_extern_or_init_constant(env, c)) {
-            /* Generate boxed version for extern/native constant if needed. */
-            return ir::add_extern(env, c);
-        }
-    }
-
-    for (name const & c : cs) {
-        lean_assert(!is_extern_constant(env, get_real_name(c)));
-        constant_info cinfo = env.get(c);
-        if (!cinfo.is_definition() && !cinfo.is_opaque()) return env;
-    }
-
-    time_task t("compilation", opts, head(cs));
-    scope_trace_env scope_trace(env, opts);
-
-    comp_decls ds = to_comp_decls(env, cs);
+/* Run the compiler pipeline on `ds` up to IR generation. Return `none` if no code should be generated. */
+static pair<environment, optional<comp_decls>> compile_core(environment const & env, options const & opts, comp_decls ds) {
     csimp_cfg cfg(opts);
     // Use the following line to see compiler intermediate steps
     // scope_traces_as_string trace_scope;
@@ -231,7 +203,7 @@ environment compile(environment const & env, options const & opts, names cs) {
 
            TODO: we should have a "[strong_inline]" annotation that will inline a definition even
            when it is partially applied. Then, we can mark all `match` auxiliary functions as `[strong_inline]` */
-        return new_env;
+        return mk_pair(new_env, optional<comp_decls>());
     }
     std::tie(new_env, ds) = specialize(new_env, ds, cfg);
     // The following check is incorrect. It was exposed by issue #1812.
@@ -269,8 +241,48 @@ environment compile(environment const & env, options const & opts, names cs) {
     ds = apply(elim_dead_let, ds);
     trace_compiler(name({"compiler", "simp_app_args"}), ds);
     // std::cout << trace_scope.get_string() << "\n";
+    return mk_pair(new_env, optional<comp_decls>(ds));
+}
+
+environment compile(environment const & env, options const & opts, names cs) {
+    /* Do not generate code for irrelevant decls */
+    cs = filter(cs, [&](name const & c) { return !is_irrelevant_type(env, env.get(c).get_type());});
+    if (empty(cs)) return env;
+
+    for (name const & c : cs) {
+        if (is_main_fn(env, c) && !is_main_fn_type(env.get(c).get_type())) {
+            throw exception("invalid `main` function, it must have type `List String -> IO UInt32`");
+        }
+    }
+
+    if (length(cs) == 1) {
+        name c = get_real_name(head(cs));
+        if (has_implemented_by_attribute(env, c))
+            return env;
+        if (is_extern_or_init_constant(env, c)) {
+            /* Generate boxed version for extern/native constant if needed. */
+            return ir::add_extern(env, c);
+        }
+    }
+
+    for (name const & c : cs) {
+        lean_assert(!is_extern_constant(env, get_real_name(c)));
+        constant_info cinfo = env.get(c);
+        if (!cinfo.is_definition() && !cinfo.is_opaque()) return env;
+    }
+
+    time_task t("compilation", opts, head(cs));
+    scope_trace_env scope_trace(env, opts);
+
+    comp_decls ds = to_comp_decls(env, cs);
+    compile_cache cache(env, opts, ds);
+    optional<pair<environment, optional<comp_decls>>> r = cache.load(env);
+    if (!r)
+        r = cache.record([&]() { return compile_core(env, opts, ds); });
+    if (!r->second)
+        return r->first;
     /* compile IR. */
-    return compile_ir(new_env, opts, ds);
+    return compile_ir(r->first, opts, *r->second);
 }
 
 extern "C" LEAN_EXPORT object * lean_compile_decls(object * env, object * opts, object * decls) {
@@ -15,6 +15,7 @@ Author: Leonardo de Moura
 #include "library/compiler/util.h"
 #include "library/compiler/csimp.h"
 #include "library/compiler/closed_term_cache.h"
+#include "library/compiler/compile_cache.h"
 
 namespace lean {
 extern "C" object* lean_mk_eager_lambda_lifting_name(object* n, object* idx);
@@ -239,6 +240,7 @@ class eager_lambda_lifting_fn {
                other definitions that use `n`.
                We used a similar hack at `specialize.cpp`. */
             declaration aux_ax = mk_axiom(n, names(), type, true /* meta */);
+            compile_cache_record_add(aux_ax);
             m_st.env() = env().add(aux_ax, false);
             m_new_decls.push_back(comp_decl(n, code));
             return mk_app(mk_constant(n), new_params);
@@ -4,6 +4,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include "util/name_flat_map.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/instantiate.h"
 #include "kernel/abstract.h"
@@ -13,10 +14,10 @@ namespace lean {
 
 /* Find join-points */
 class find_jp_fn {
-    environment const & m_env;
-    local_ctx           m_lctx;
-    name_generator      m_ngen;
-    name_map<unsigned>  m_candidates;
+    environment const &     m_env;
+    local_ctx               m_lctx;
+    name_generator          m_ngen;
+    name_flat_map<unsigned> m_candidates;
 
     /* Remove all candidates occurring in `e`. */
     void remove_candidates_occurring_at(expr const & e) {
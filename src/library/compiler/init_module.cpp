@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include "library/compiler/specialize.h"
 #include "library/compiler/llnf.h"
 #include "library/compiler/compiler.h"
+#include "library/compiler/compile_cache.h"
 #include "library/compiler/borrowed_annotation.h"
 #include "library/compiler/ll_infer_type.h"
 #include "library/compiler/ir.h"
@@ -25,6 +26,7 @@ void initialize_compiler_module() {
     initialize_specialize();
     initialize_llnf();
     initialize_compiler();
+    initialize_compile_cache();
     initialize_borrowed_annotation();
     initialize_ll_infer_type();
     initialize_ir();
@@ -36,6 +38,7 @@ void finalize_compiler_module() {
     finalize_ir();
     finalize_ll_infer_type();
     finalize_borrowed_annotation();
+    finalize_compile_cache();
     finalize_compiler();
     finalize_llnf();
     finalize_specialize();
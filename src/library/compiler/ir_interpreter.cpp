@@ -25,9 +25,22 @@ code by checking for the mangled symbol via dlsym/GetProcAddress, which is also
 functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
 `call/lookup_symbol` below.
 
+Bytecode
+========
+
+Walking the IR objects directly repeatedly pays for decoding them: unboxing variable indices, looking up join points
+and callees by name, and recomputing literals. Before a declaration is run for the first time, `bc_lowering` therefore
+translates its body into a flat array of `bc_instr`s over a register frame on the same value stack (`x_i` is register
+`i-1`), with join points and `case` alternatives resolved to instruction offsets, literals precomputed, and self tail
+calls turned into jumps. Call sites resolve their target (native symbol or bytecode) on first execution and cache it.
+With GCC/Clang, `run` dispatches through computed gotos, otherwise through a `switch`. The original tree-walking
+evaluator is still available via `set_option interpreter.bytecode false`.
+
 */
 #include <string>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #include <psapi.h>
@@ -45,12 +58,17 @@ functions, which have a (relatively) homogeneous ABI that we can use without run
 #include "library/compiler/ir.h"
 #include "library/compiler/init_attribute.h"
 #include "util/nat.h"
+#include "util/name_flat_map.h"
 #include "util/option_declarations.h"
 
 #ifndef LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE
 #define LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE true
 #endif
 
+#ifndef LEAN_DEFAULT_INTERPRETER_BYTECODE
+#define LEAN_DEFAULT_INTERPRETER_BYTECODE true
+#endif
+
 namespace lean {
 namespace ir {
 // C++ wrappers of Lean data types
@@ -191,9 +209,10 @@ static string_ref * g_mangle_prefix = nullptr;
 static string_ref * g_boxed_suffix = nullptr;
 static string_ref * g_boxed_mangled_suffix = nullptr;
 static name * g_interpreter_prefer_native = nullptr;
+static name * g_interpreter_bytecode = nullptr;
 
 // constants (lacking native declarations) initialized by `lean_run_init`
-static name_map<object *> * g_init_globals;
+static name_flat_map<object *> * g_init_globals;
 
 // reuse the compiler's name mangling to compute native symbol names
 extern "C" object * lean_name_mangle(object * n, object * pre);
@@ -345,16 +364,63 @@ class interpreter {
       value m_val;
     };
     // caches values of nullary functions ("constants")
-    name_map<constant_cache_entry> m_constant_cache;
+    name_flat_map<constant_cache_entry> m_constant_cache;
     struct symbol_cache_entry {
         decl m_decl;
         // symbol address; `nullptr` if function does not have native code
-        void * m_addr;
+        void * m_addr = nullptr;
         // true iff we chose the boxed version of a function where the IR uses the unboxed version
-        bool m_boxed;
+        bool m_boxed = false;
     };
     // caches symbol lookup successes _and_ failures
-    name_map<symbol_cache_entry> m_symbol_cache;
+    name_flat_map<symbol_cache_entry> m_symbol_cache;
+
+    // if `true`, run function bodies lowered to bytecode instead of walking the IR
+    bool m_bytecode;
+    // bytecode operations, see `run` for their semantics
+#define LEAN_IR_BYTECODE_OPS(X) \
+    X(Ctor) X(Reset) X(Reuse) X(Proj) X(UProj) X(SProj) X(Call) X(TailCall) X(Load) X(PAp) X(Ap) X(Box) X(Unbox) \
+    X(Lit) X(LitObj) X(IsShared) X(IsTaggedPtr) X(Set) X(SetTag) X(USet) X(SSet) X(Inc) X(Dec) X(Del) X(CaseObj) \
+    X(CaseNum) X(Ret) X(Jmp) X(Invalid) X(Unreachable) X(IncompleteCase)
+#define LEAN_IR_BYTECODE_OP_NAME(op) op,
+    enum class bc_op : uint8 { LEAN_IR_BYTECODE_OPS(LEAN_IR_BYTECODE_OP_NAME) };
+#undef LEAN_IR_BYTECODE_OP_NAME
+    struct bc_instr {
+        // address of the handler of `m_op` in `run` when using direct threading
+        void * m_handler;
+        bc_op  m_op;
+        type   m_type;
+        uint32 m_dst;
+        uint32 m_a;
+        uint32 m_b;
+        uint32 m_c;
+    };
+    struct bc_code;
+    struct bc_call_site {
+        fun_id             m_fn;
+        // argument registers are `m_operands[m_args]`, ..., `m_operands[m_args + m_num_args - 1]`
+        uint32             m_args;
+        uint32             m_num_args;
+        bool               m_resolved = false;
+        symbol_cache_entry m_sym;
+        // bytecode of the callee if it is interpreted
+        bc_code *          m_code = nullptr;
+    };
+    /* Bytecode of a function body. Registers are the stack slots of the current frame: IR variable `x_i` is
+       register `i - 1`, and the last register of the frame holds `box(0)` for irrelevant arguments. */
+    struct bc_code {
+        // keeps the objects in `m_consts` alive
+        decl                      m_decl;
+        std::vector<bc_instr>     m_instrs;
+        // variable-length operands: argument registers, jump tables, ...
+        std::vector<uint32>       m_operands;
+        std::vector<value>        m_consts;
+        std::vector<bc_call_site> m_sites;
+        uint32                    m_frame_size = 0;
+        bool                      m_threaded = false;
+    };
+    std::vector<std::unique_ptr<bc_code>> m_codes;
+    name_flat_map<bc_code *>              m_code_cache;
 
     /** \brief Get current stack frame */
     inline frame & get_frame() {
@@ -824,7 +890,7 @@ private:
             throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn << "' in the same module");
         }
         push_frame(e.m_decl, m_arg_stack.size());
-        value r = eval_body(decl_fun_body(e.m_decl));
+        value r = eval_decl(e.m_decl);
         pop_frame(r, decl_type(e.m_decl));
         if (!type_is_scalar(t)) {
             inc(r.m_obj);
@@ -833,54 +899,766 @@ private:
         return r;
     }
 
-    value call(name const & fn, array_ref<arg> const & args) {
-        size_t old_size = m_arg_stack.size();
+    /** \brief Call the native code of `e` with the given argument values. */
+    value call_native(symbol_cache_entry const & e, size_t n, value const * args) {
+        object ** args2 = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+        for (size_t i = 0; i < n; i++) {
+            type t = param_type(decl_params(e.m_decl)[i]);
+            args2[i] = box_t(args[i], t);
+            if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
+                // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
+                // originally borrowed parameters because the wrapper will decrement these after the call.
+                // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
+                // would need in this instance.
+                inc(args2[i]);
+            }
+        }
         value r;
+        push_frame(e.m_decl, m_arg_stack.size());
+        object * o = curry(e.m_addr, n, args2);
+        type t = decl_type(e.m_decl);
+        if (type_is_scalar(t)) {
+            lean_assert(e.m_boxed);
+            // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
+            r = unbox_t(o, t);
+            lean_dec(o);
+        } else {
+            r = o;
+        }
+        pop_frame(r, t);
+        return r;
+    }
+
+    [[noreturn]] void throw_missing_extern(name const & fn) {
+        string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+        string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+        throw exception(sstream() << "Could not find native implementation of external declaration '" << fn
+                                  << "' (symbols '" << boxed_mangled.data() << "' or '" << mangled.data() << "').\n"
+                                  << "For declarations from `Init` or `Lean`, you need to set `supportInterpreter := true` "
+                                  << "in the relevant `lean_exe` statement in your `lakefile.lean`.");
+    }
+
+    /** \brief Evaluate the body of `d`, whose frame has already been pushed. */
+    value eval_decl(decl const & d) {
+        return m_bytecode ? run(get_code(d)) : eval_body(decl_fun_body(d));
+    }
+
+    value call(name const & fn, array_ref<arg> const & args) {
         symbol_cache_entry e = lookup_symbol(fn);
         if (e.m_addr) {
-            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
+            value * vals = static_cast<value *>(LEAN_ALLOCA(args.size() * sizeof(value))); // NOLINT
             for (size_t i = 0; i < args.size(); i++) {
-                type t = param_type(decl_params(e.m_decl)[i]);
-                args2[i] = box_t(eval_arg(args[i]), t);
-                if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
-                    // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
-                    // originally borrowed parameters because the wrapper will decrement these after the call.
-                    // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
-                    // would need in this instance.
-                    inc(args2[i]);
-                }
-            }
-            push_frame(e.m_decl, old_size);
-            object * o = curry(e.m_addr, args.size(), args2);
-            type t = decl_type(e.m_decl);
-            if (type_is_scalar(t)) {
-                lean_assert(e.m_boxed);
-                // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
-                r = unbox_t(o, t);
-                lean_dec(o);
-            } else {
-                r = o;
+                vals[i] = eval_arg(args[i]);
             }
+            return call_native(e, args.size(), vals);
         } else {
             if (decl_tag(e.m_decl) == decl_kind::Extern) {
-                string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-                string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-                throw exception(sstream() << "Could not find native implementation of external declaration '" << fn
-                                          << "' (symbols '" << boxed_mangled.data() << "' or '" << mangled.data() << "').\n"
-                                          << "For declarations from `Init` or `Lean`, you need to set `supportInterpreter := true` "
-                                          << "in the relevant `lean_exe` statement in your `lakefile.lean`.");
+                throw_missing_extern(fn);
             }
+            size_t old_size = m_arg_stack.size();
             // evaluate args in old stack frame
             for (const auto & arg : args) {
                 m_arg_stack.push_back(eval_arg(arg));
             }
             push_frame(e.m_decl, old_size);
-            r = eval_body(decl_fun_body(e.m_decl));
+            value r = eval_decl(e.m_decl);
+            pop_frame(r, decl_type(e.m_decl));
+            return r;
         }
-        pop_frame(r, decl_type(e.m_decl));
+    }
+
+    // ==========================
+    // Bytecode
+    //
+    // Function bodies are lowered to bytecode for a register machine when they are first called, and the bytecode is
+    // cached for the lifetime of the interpreter. Compared to walking the IR, this removes the decoding of IR objects,
+    // resolves variables to fixed frame slots and join points and `case` alternatives to code offsets, precomputes
+    // literals, and resolves the target of each call site once.
+
+    /** \brief Lowering of the body of a declaration to `bc_code`. */
+    class bc_lowering {
+        struct jp_entry {
+            size_t                   m_id;
+            array_ref<param> const * m_params;
+            uint32                   m_label;
+            // enclosing join point, or `-1`
+            int                      m_parent;
+        };
+        struct todo_entry {
+            uint32          m_label;
+            fn_body const * m_body;
+            int             m_scope;
+        };
+        // stands for the register holding `box(0)` until the frame size is known
+        static constexpr uint32 g_irrelevant = static_cast<uint32>(-1);
+
+        decl const &            m_decl;
+        bc_code &               m_code;
+        std::vector<uint32>     m_label_pcs;
+        std::vector<jp_entry>   m_jps;
+        std::vector<todo_entry> m_todo;
+        uint32                  m_num_vars = 0;
+        uint32                  m_incomplete_case_label = g_irrelevant;
+
+        uint32 reg(var_id const & x) {
+            size_t i = x.get_small_value();
+            lean_assert(i > 0);
+            if (i > m_num_vars)
+                m_num_vars = i;
+            return i - 1;
+        }
+        uint32 arg_reg(arg const & a) { return arg_is_irrelevant(a) ? g_irrelevant : reg(arg_var_id(a)); }
+
+        uint32 new_label() { m_label_pcs.push_back(0); return m_label_pcs.size() - 1; }
+
+        void emit(bc_op op, type t = type::Irrelevant, uint32 dst = 0, uint32 a = 0, uint32 b = 0, uint32 c = 0) {
+            m_code.m_instrs.push_back(bc_instr { nullptr, op, t, dst, a, b, c });
+        }
+
+        uint32 emit_args(array_ref<arg> const & args) {
+            uint32 off = m_code.m_operands.size();
+            for (arg const & a : args)
+                m_code.m_operands.push_back(arg_reg(a));
+            return off;
+        }
+
+        uint32 add_const(value v) {
+            m_code.m_consts.push_back(v);
+            return m_code.m_consts.size() - 1;
+        }
+
+        uint32 add_site(fun_id const & fn, array_ref<arg> const & args) {
+            bc_call_site s;
+            s.m_fn       = fn;
+            s.m_args     = emit_args(args);
+            s.m_num_args = args.size();
+            m_code.m_sites.push_back(s);
+            return m_code.m_sites.size() - 1;
+        }
+
+        /* Operands of `Ctor` and `Reuse`: tag, number of object fields, byte size of scalar fields,
+           whether to update the tag, and the argument registers. */
+        uint32 emit_ctor(ctor_info const & i, array_ref<arg> const & args, bool update_header) {
+            uint32 off = m_code.m_operands.size();
+            m_code.m_operands.push_back(ctor_info_tag(i).get_small_value());
+            m_code.m_operands.push_back(ctor_info_size(i).get_small_value());
+            m_code.m_operands.push_back(ctor_info_usize(i).get_small_value() * sizeof(void *) + ctor_info_ssize(i).get_small_value());
+            m_code.m_operands.push_back(update_header);
+            emit_args(args);
+            return off;
+        }
+
+        jp_entry const & find_jp(int scope, jp_id const & j) {
+            for (; scope >= 0; scope = m_jps[scope].m_parent) {
+                if (m_jps[scope].m_id == j.get_small_value())
+                    return m_jps[scope];
+            }
+            throw exception(sstream() << "unknown join point " << j.get_small_value());
+        }
+
+        bool is_self_tail_call(fn_body const & b) {
+            expr const & e = fn_body_vdecl_expr(b);
+            fn_body const & cont = fn_body_vdecl_cont(b);
+            return expr_tag(e) == expr_kind::FAp && expr_fap_args(e).size() > 0 && expr_fap_fun(e) == decl_fun_id(m_decl) &&
+                fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
+                arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b);
+        }
+
+        void lower_lit(uint32 dst, lit_val const & l, type t) {
+            switch (lit_val_tag(l)) {
+                case lit_val_kind::Num: {
+                    nat const & n = lit_val_num(l);
+                    switch (t) {
+                        case type::Float:
+                            lean_inc(n.raw());
+                            return emit(bc_op::Lit, t, dst, add_const(value::from_float(lean_float_of_nat(n.raw()))));
+                        case type::UInt8:
+                        case type::UInt16:
+                        case type::UInt32:
+                        case type::USize:
+                            return emit(bc_op::Lit, t, dst, add_const(lean_usize_of_nat(n.raw())));
+                        case type::UInt64:
+                            return emit(bc_op::Lit, t, dst, add_const(lean_uint64_of_nat(n.raw())));
+                        case type::Object:
+                        case type::TObject:
+                            return emit(bc_op::LitObj, t, dst, add_const(n.raw()));
+                        case type::Irrelevant:
+                            return emit(bc_op::Invalid);
+                    }
+                    break;
+                }
+                case lit_val_kind::Str:
+                    return emit(bc_op::LitObj, t, dst, add_const(lit_val_str(l).raw()));
+            }
+            emit(bc_op::Invalid);
+        }
+
+        void lower_vdecl(fn_body const & b) {
+            expr const & e = fn_body_vdecl_expr(b);
+            type t = fn_body_vdecl_type(b);
+            uint32 dst = reg(fn_body_vdecl_var(b));
+            switch (expr_tag(e)) {
+                case expr_kind::Ctor: {
+                    ctor_info const & i = expr_ctor_info(e);
+                    if (ctor_info_size(i).get_small_value() == 0 && ctor_info_usize(i).get_small_value() == 0 &&
+                        ctor_info_ssize(i).get_small_value() == 0) {
+                        // a constructor without data is optimized to a tagged pointer
+                        return emit(bc_op::Lit, t, dst, add_const(box(ctor_info_tag(i).get_small_value())));
+                    }
+                    return emit(bc_op::Ctor, t, dst, emit_ctor(i, expr_ctor_args(e), false), expr_ctor_args(e).size());
+                }
+                case expr_kind::Reset:
+                    return emit(bc_op::Reset, t, dst, reg(expr_reset_obj(e)), expr_reset_num_objs(e).get_small_value());
+                case expr_kind::Reuse:
+                    return emit(bc_op::Reuse, t, dst, reg(expr_reuse_obj(e)),
+                                emit_ctor(expr_reuse_ctor(e), expr_reuse_args(e), expr_reuse_update_header(e)),
+                                expr_reuse_args(e).size());
+                case expr_kind::Proj:
+                    return emit(bc_op::Proj, t, dst, reg(expr_proj_obj(e)), expr_proj_idx(e).get_small_value());
+                case expr_kind::UProj:
+                    return emit(bc_op::UProj, t, dst, reg(expr_uproj_obj(e)), expr_uproj_idx(e).get_small_value());
+                case expr_kind::SProj:
+                    if (!type_is_scalar(t) || t == type::USize)
+                        return emit(bc_op::Invalid);
+                    return emit(bc_op::SProj, t, dst, reg(expr_sproj_obj(e)),
+                                expr_sproj_idx(e).get_small_value() * sizeof(void *) + expr_sproj_offset(e).get_small_value());
+                case expr_kind::FAp:
+                    if (expr_fap_args(e).size()) {
+                        return emit(bc_op::Call, t, dst, add_site(expr_fap_fun(e), expr_fap_args(e)));
+                    } else {
+                        return emit(bc_op::Load, t, dst, add_site(expr_fap_fun(e), expr_fap_args(e)));
+                    }
+                case expr_kind::PAp:
+                    return emit(bc_op::PAp, t, dst, add_site(expr_pap_fun(e), expr_pap_args(e)));
+                case expr_kind::Ap:
+                    return emit(bc_op::Ap, t, dst, reg(expr_ap_fun(e)), emit_args(expr_ap_args(e)), expr_ap_args(e).size());
+                case expr_kind::Box:
+                    return emit(bc_op::Box, expr_box_type(e), dst, reg(expr_box_obj(e)));
+                case expr_kind::Unbox:
+                    return emit(bc_op::Unbox, t, dst, reg(expr_unbox_obj(e)));
+                case expr_kind::Lit:
+                    return lower_lit(dst, expr_lit_val(e), t);
+                case expr_kind::IsShared:
+                    return emit(bc_op::IsShared, t, dst, reg(expr_is_shared_obj(e)));
+                case expr_kind::IsTaggedPtr:
+                    return emit(bc_op::IsTaggedPtr, t, dst, reg(expr_is_tagged_ptr_obj(e)));
+            }
+            throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e)));
+        }
+
+        void lower_case(fn_body const & b, int scope) {
+            array_ref<alt_core> const & alts = fn_body_case_alts(b);
+            std::vector<uint32> labels;
+            uint32 default_label = g_irrelevant;
+            size_t num_tags = 0;
+            for (alt_core const & a : alts) {
+                uint32 l = new_label();
+                labels.push_back(l);
+                if (alt_core_tag(a) == alt_core_kind::Ctor) {
+                    m_todo.push_back(todo_entry { l, &alt_core_ctor_cont(a), scope });
+                    num_tags = std::max(num_tags, ctor_info_tag(alt_core_ctor_info(a)).get_small_value() + 1);
+                } else {
+                    m_todo.push_back(todo_entry { l, &alt_core_default_cont(a), scope });
+                    // later alternatives are unreachable
+                    default_label = l;
+                    break;
+                }
+            }
+            if (default_label == g_irrelevant) {
+                if (m_incomplete_case_label == g_irrelevant) {
+                    m_incomplete_case_label = new_label();
+                    m_todo.push_back(todo_entry { m_incomplete_case_label, nullptr, scope });
+                }
+                default_label = m_incomplete_case_label;
+            }
+            // jump table indexed by constructor tag; the first alternative for a tag wins
+            uint32 off = m_code.m_operands.size();
+            m_code.m_operands.resize(off + num_tags, g_irrelevant);
+            for (size_t i = 0; i < labels.size(); i++) {
+                if (alt_core_tag(alts[i]) == alt_core_kind::Ctor) {
+                    uint32 & entry = m_code.m_operands[off + ctor_info_tag(alt_core_ctor_info(alts[i])).get_small_value()];
+                    if (entry == g_irrelevant)
+                        entry = labels[i];
+                }
+            }
+            for (size_t i = 0; i < num_tags; i++) {
+                if (m_code.m_operands[off + i] == g_irrelevant)
+                    m_code.m_operands[off + i] = default_label;
+            }
+            bc_op op = type_is_scalar(fn_body_case_var_type(b)) ? bc_op::CaseNum : bc_op::CaseObj;
+            emit(op, fn_body_case_var_type(b), reg(fn_body_case_var(b)), off, num_tags, default_label);
+        }
+
+        /** \brief Lower `b` and its continuations; bodies of join points and alternatives are added to `m_todo`. */
+        void lower_body(fn_body const * b, int scope) {
+            while (true) {
+                switch (fn_body_tag(*b)) {
+                    case fn_body_kind::VDecl:
+                        if (is_self_tail_call(*b)) {
+                            // copy the arguments to the parameters and restart; operands are pairs of registers
+                            array_ref<arg> const & args = expr_fap_args(fn_body_vdecl_expr(*b));
+                            array_ref<param> const & params = decl_params(m_decl);
+                            lean_assert(args.size() == params.size());
+                            uint32 off = m_code.m_operands.size();
+                            for (size_t i = 0; i < args.size(); i++) {
+                                m_code.m_operands.push_back(reg(param_var(params[i])));
+                                m_code.m_operands.push_back(arg_reg(args[i]));
+                            }
+                            return emit(bc_op::TailCall, type::Irrelevant, 0, off, args.size());
+                        }
+                        lower_vdecl(*b);
+                        b = &fn_body_vdecl_cont(*b);
+                        break;
+                    case fn_body_kind::JDecl: {
+                        jp_entry jp { fn_body_jdecl_id(*b).get_small_value(), &fn_body_jdecl_params(*b), new_label(), scope };
+                        for (param const & p : fn_body_jdecl_params(*b))
+                            reg(param_var(p));
+                        m_jps.push_back(jp);
+                        scope = m_jps.size() - 1;
+                        m_todo.push_back(todo_entry { jp.m_label, &fn_body_jdecl_body(*b), scope });
+                        b = &fn_body_jdecl_cont(*b);
+                        break;
+                    }
+                    case fn_body_kind::Set:
+                        emit(bc_op::Set, type::Irrelevant, reg(fn_body_set_var(*b)), fn_body_set_idx(*b).get_small_value(),
+                             arg_reg(fn_body_set_arg(*b)));
+                        b = &fn_body_set_cont(*b);
+                        break;
+                    case fn_body_kind::SetTag:
+                        emit(bc_op::SetTag, type::Irrelevant, reg(fn_body_set_tag_var(*b)), fn_body_set_tag_cidx(*b).get_small_value());
+                        b = &fn_body_set_tag_cont(*b);
+                        break;
+                    case fn_body_kind::USet:
+                        emit(bc_op::USet, type::Irrelevant, reg(fn_body_uset_target(*b)), fn_body_uset_idx(*b).get_small_value(),
+                             reg(fn_body_uset_source(*b)));
+                        b = &fn_body_uset_cont(*b);
+                        break;
+                    case fn_body_kind::SSet: {
+                        type t = fn_body_sset_type(*b);
+                        if (!type_is_scalar(t) || t == type::USize)
+                            return emit(bc_op::Invalid);
+                        emit(bc_op::SSet, t, reg(fn_body_sset_target(*b)),
+                             fn_body_sset_idx(*b).get_small_value() * sizeof(void *) + fn_body_sset_offset(*b).get_small_value(),
+                             reg(fn_body_sset_source(*b)));
+                        b = &fn_body_sset_cont(*b);
+                        break;
+                    }
+                    case fn_body_kind::Inc:
+                        emit(bc_op::Inc, type::Irrelevant, reg(fn_body_inc_var(*b)), fn_body_inc_val(*b).get_small_value());
+                        b = &fn_body_inc_cont(*b);
+                        break;
+                    case fn_body_kind::Dec:
+                        emit(bc_op::Dec, type::Irrelevant, reg(fn_body_dec_var(*b)), fn_body_dec_val(*b).get_small_value());
+                        b = &fn_body_dec_cont(*b);
+                        break;
+                    case fn_body_kind::Del:
+                        emit(bc_op::Del, type::Irrelevant, reg(fn_body_del_var(*b)));
+                        b = &fn_body_del_cont(*b);
+                        break;
+                    case fn_body_kind::MData:
+                        b = &fn_body_mdata_cont(*b);
+                        break;
+                    case fn_body_kind::Case:
+                        return lower_case(*b, scope);
+                    case fn_body_kind::Ret:
+                        return emit(bc_op::Ret, type::Irrelevant, 0, arg_reg(fn_body_ret_arg(*b)));
+                    case fn_body_kind::Jmp: {
+                        jp_entry const & jp = find_jp(scope, fn_body_jmp_jp(*b));
+                        array_ref<arg> const & args = fn_body_jmp_args(*b);
+                        lean_assert(jp.m_params->size() == args.size());
+                        // operands are (parameter, argument) register pairs, assigned in order
+                        uint32 off = m_code.m_operands.size();
+                        for (size_t i = 0; i < args.size(); i++) {
+                            m_code.m_operands.push_back(reg(param_var((*jp.m_params)[i])));
+                            m_code.m_operands.push_back(arg_reg(args[i]));
+                        }
+                        return emit(bc_op::Jmp, type::Irrelevant, 0, jp.m_label, off, args.size());
+                    }
+                    case fn_body_kind::Unreachable:
+                        return emit(bc_op::Unreachable);
+                }
+            }
+        }
+
+    public:
+        bc_lowering(decl const & d, bc_code & c): m_decl(d), m_code(c) {}
+
+        void operator()() {
+            m_code.m_decl = m_decl;
+            for (param const & p : decl_params(m_decl))
+                reg(param_var(p));
+            lower_body(&decl_fun_body(m_decl), -1);
+            while (!m_todo.empty()) {
+                todo_entry e = m_todo.back();
+                m_todo.pop_back();
+                m_label_pcs[e.m_label] = m_code.m_instrs.size();
+                if (e.m_body)
+                    lower_body(e.m_body, e.m_scope);
+                else
+                    emit(bc_op::IncompleteCase);
+            }
+            m_code.m_frame_size = m_num_vars + 1;
+            // resolve labels and the register of irrelevant arguments
+            uint32 irrelevant = m_num_vars;
+            for (uint32 & o : m_code.m_operands) {
+                if (o == g_irrelevant)
+                    o = irrelevant;
+            }
+            for (bc_instr & i : m_code.m_instrs) {
+                for (uint32 * f : { &i.m_dst, &i.m_a, &i.m_b, &i.m_c }) {
+                    if (*f == g_irrelevant)
+                        *f = irrelevant;
+                }
+                switch (i.m_op) {
+                    case bc_op::Jmp:
+                        i.m_a = m_label_pcs[i.m_a];
+                        break;
+                    case bc_op::CaseObj:
+                    case bc_op::CaseNum:
+                        for (uint32 j = i.m_a; j < i.m_a + i.m_b; j++)
+                            m_code.m_operands[j] = m_label_pcs[m_code.m_operands[j]];
+                        i.m_c = m_label_pcs[i.m_c];
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    };
+
+    bc_code & get_code(decl const & d) {
+        if (bc_code * const * c = m_code_cache.find(decl_fun_id(d)))
+            return **c;
+        m_codes.emplace_back(new bc_code());
+        bc_code & c = *m_codes.back();
+        bc_lowering(d, c)();
+        m_code_cache.insert(decl_fun_id(d), &c);
+        return c;
+    }
+
+    bc_call_site & resolve(bc_call_site & s) {
+        if (!s.m_resolved) {
+            s.m_sym = lookup_symbol(s.m_fn);
+            s.m_resolved = true;
+        }
+        return s;
+    }
+
+    value bc_call(bc_code & c, bc_call_site & s) {
+        resolve(s);
+        uint32 const * arg_regs = c.m_operands.data() + s.m_args;
+        size_t bp = get_frame().m_arg_bp;
+        if (s.m_sym.m_addr) {
+            value * vals = static_cast<value *>(LEAN_ALLOCA(s.m_num_args * sizeof(value))); // NOLINT
+            for (size_t i = 0; i < s.m_num_args; i++) {
+                vals[i] = m_arg_stack[bp + arg_regs[i]];
+            }
+            return call_native(s.m_sym, s.m_num_args, vals);
+        }
+        if (!s.m_code) {
+            if (decl_tag(s.m_sym.m_decl) == decl_kind::Extern) {
+                throw_missing_extern(s.m_fn);
+            }
+            s.m_code = &get_code(s.m_sym.m_decl);
+        }
+        size_t old_size = m_arg_stack.size();
+        m_arg_stack.resize(old_size + s.m_num_args);
+        for (size_t i = 0; i < s.m_num_args; i++) {
+            m_arg_stack[old_size + i] = m_arg_stack[bp + arg_regs[i]];
+        }
+        push_frame(s.m_sym.m_decl, old_size);
+        value r = run(*s.m_code);
+        pop_frame(r, decl_type(s.m_sym.m_decl));
         return r;
     }
 
+    object * bc_pap(bc_code & c, bc_call_site & s, value const * regs) {
+        symbol_cache_entry const & sym = resolve(s).m_sym;
+        uint32 const * arg_regs = c.m_operands.data() + s.m_args;
+        if (sym.m_addr) {
+            // point closure directly at native symbol
+            object * cls = alloc_closure(sym.m_addr, decl_params(sym.m_decl).size(), s.m_num_args);
+            for (unsigned i = 0; i < s.m_num_args; i++) {
+                closure_set(cls, i, regs[arg_regs[i]].m_obj);
+            }
+            return cls;
+        } else {
+            // point closure at interpreter stub
+            object ** args = static_cast<object **>(LEAN_ALLOCA(s.m_num_args * sizeof(object *))); // NOLINT
+            for (size_t i = 0; i < s.m_num_args; i++) {
+                args[i] = regs[arg_regs[i]].m_obj;
+            }
+            return mk_stub_closure(sym.m_decl, s.m_num_args, args);
+        }
+    }
+
+    object * bc_ap(object * f, size_t n, uint32 const * arg_regs, value const * regs) {
+        object ** args = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+        for (size_t i = 0; i < n; i++) {
+            args[i] = regs[arg_regs[i]].m_obj;
+        }
+        return apply_n(f, n, args);
+    }
+
+    object * bc_reset(object * o, size_t num_objs) {
+        if (is_exclusive(o)) {
+            for (size_t i = 0; i < num_objs; i++) {
+                cnstr_release(o, i);
+            }
+            return o;
+        } else {
+            dec_ref(o);
+            return box(0);
+        }
+    }
+
+    /** \brief Run bytecode `c` in the current frame, whose arguments have already been pushed. */
+    value run(bc_code & c) {
+        check_system();
+#if defined(__GNUC__)
+#define LEAN_IR_BYTECODE_HANDLER(op) &&op_##op,
+        static void * const g_handlers[] = { LEAN_IR_BYTECODE_OPS(LEAN_IR_BYTECODE_HANDLER) };
+#undef LEAN_IR_BYTECODE_HANDLER
+        if (!c.m_threaded) {
+            for (bc_instr & i : c.m_instrs)
+                i.m_handler = g_handlers[static_cast<unsigned>(i.m_op)];
+            c.m_threaded = true;
+        }
+#define LEAN_IR_BYTECODE_CASE(op) op_##op:
+#define LEAN_IR_BYTECODE_NEXT() goto *pc->m_handler
+#else
+#define LEAN_IR_BYTECODE_CASE(op) case bc_op::op:
+#define LEAN_IR_BYTECODE_NEXT() goto dispatch
+#endif
+        size_t bp = get_frame().m_arg_bp;
+        m_arg_stack.resize(bp + c.m_frame_size);
+        // the stack may be reallocated by anything that can run Lean code, after which `regs` must be reloaded
+        value * regs = m_arg_stack.data() + bp;
+        regs[c.m_frame_size - 1] = box(0);
+        bc_instr const * code = c.m_instrs.data();
+        uint32 const * ops = c.m_operands.data();
+        bc_instr const * pc = code;
+#if defined(__GNUC__)
+        LEAN_IR_BYTECODE_NEXT();
+#else
+    dispatch:
+        switch (pc->m_op) {
+#endif
+        LEAN_IR_BYTECODE_CASE(Ctor) {
+            uint32 const * p = ops + pc->m_a;
+            object * o = alloc_cnstr(p[0], p[1], p[2]);
+            for (uint32 i = 0; i < pc->m_b; i++)
+                cnstr_set(o, i, regs[p[4 + i]].m_obj);
+            regs[pc->m_dst] = o;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Reset) {
+            object * o = bc_reset(regs[pc->m_a].m_obj, pc->m_b);
+            regs = m_arg_stack.data() + bp;
+            regs[pc->m_dst] = o;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Reuse) {
+            uint32 const * p = ops + pc->m_b;
+            object * o = regs[pc->m_a].m_obj;
+            if (is_scalar(o)) {
+                // `Reset` did not have a unique reference, fall back to regular allocation
+                o = p[1] == 0 && p[2] == 0 ? box(p[0]) : alloc_cnstr(p[0], p[1], p[2]);
+            } else if (p[3]) {
+                cnstr_set_tag(o, p[0]);
+            }
+            for (uint32 i = 0; i < pc->m_c; i++)
+                cnstr_set(o, i, regs[p[4 + i]].m_obj);
+            regs[pc->m_dst] = o;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Proj) {
+            regs[pc->m_dst] = cnstr_get(regs[pc->m_a].m_obj, pc->m_b);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(UProj) {
+            regs[pc->m_dst] = cnstr_get_usize(regs[pc->m_a].m_obj, pc->m_b);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(SProj) {
+            object * o = regs[pc->m_a].m_obj;
+            value v;
+            switch (pc->m_type) {
+                case type::Float: v = value::from_float(cnstr_get_float(o, pc->m_b)); break;
+                case type::UInt8: v = cnstr_get_uint8(o, pc->m_b); break;
+                case type::UInt16: v = cnstr_get_uint16(o, pc->m_b); break;
+                case type::UInt32: v = cnstr_get_uint32(o, pc->m_b); break;
+                default: v = cnstr_get_uint64(o, pc->m_b); break;
+            }
+            regs[pc->m_dst] = v;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Call) {
+            value r = bc_call(c, c.m_sites[pc->m_a]);
+            regs = m_arg_stack.data() + bp;
+            regs[pc->m_dst] = r;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(TailCall) {
+            // arguments and parameters may overlap, so copy the arguments to the end of the stack first
+            uint32 const * p = ops + pc->m_a;
+            size_t n = pc->m_b;
+            size_t top = m_arg_stack.size();
+            m_arg_stack.resize(top + n);
+            regs = m_arg_stack.data() + bp;
+            for (size_t i = 0; i < n; i++)
+                m_arg_stack[top + i] = regs[p[2 * i + 1]];
+            for (size_t i = 0; i < n; i++)
+                regs[p[2 * i]] = m_arg_stack[top + i];
+            m_arg_stack.resize(top);
+            check_system();
+            pc = code;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Load) {
+            value r = load(c.m_sites[pc->m_a].m_fn, pc->m_type);
+            regs = m_arg_stack.data() + bp;
+            regs[pc->m_dst] = r;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(PAp) {
+            regs[pc->m_dst] = bc_pap(c, c.m_sites[pc->m_a], regs);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Ap) {
+            object * r = bc_ap(regs[pc->m_a].m_obj, pc->m_c, ops + pc->m_b, regs);
+            regs = m_arg_stack.data() + bp;
+            regs[pc->m_dst] = r;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Box) {
+            regs[pc->m_dst] = box_t(regs[pc->m_a], pc->m_type);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Unbox) {
+            regs[pc->m_dst] = unbox_t(regs[pc->m_a].m_obj, pc->m_type);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Lit) {
+            regs[pc->m_dst] = c.m_consts[pc->m_a];
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(LitObj) {
+            object * o = c.m_consts[pc->m_a].m_obj;
+            inc(o);
+            regs[pc->m_dst] = o;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(IsShared) {
+            regs[pc->m_dst] = static_cast<uint64>(!is_exclusive(regs[pc->m_a].m_obj));
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(IsTaggedPtr) {
+            regs[pc->m_dst] = static_cast<uint64>(!is_scalar(regs[pc->m_a].m_obj));
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Set) {
+            lean_assert(is_exclusive(regs[pc->m_dst].m_obj));
+            cnstr_set(regs[pc->m_dst].m_obj, pc->m_a, regs[pc->m_b].m_obj);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(SetTag) {
+            lean_assert(is_exclusive(regs[pc->m_dst].m_obj));
+            cnstr_set_tag(regs[pc->m_dst].m_obj, pc->m_a);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(USet) {
+            lean_assert(is_exclusive(regs[pc->m_dst].m_obj));
+            cnstr_set_usize(regs[pc->m_dst].m_obj, pc->m_a, regs[pc->m_b].m_num);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(SSet) {
+            object * o = regs[pc->m_dst].m_obj;
+            value v = regs[pc->m_b];
+            lean_assert(is_exclusive(o));
+            switch (pc->m_type) {
+                case type::Float: cnstr_set_float(o, pc->m_a, v.m_float); break;
+                case type::UInt8: cnstr_set_uint8(o, pc->m_a, v.m_num); break;
+                case type::UInt16: cnstr_set_uint16(o, pc->m_a, v.m_num); break;
+                case type::UInt32: cnstr_set_uint32(o, pc->m_a, v.m_num); break;
+                default: cnstr_set_uint64(o, pc->m_a, v.m_num); break;
+            }
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Inc) {
+            inc(regs[pc->m_dst].m_obj, pc->m_a);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Dec) {
+            for (uint32 i = 0; i < pc->m_a; i++)
+                dec(m_arg_stack[bp + pc->m_dst].m_obj);
+            regs = m_arg_stack.data() + bp;
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Del) {
+            lean_free_object(regs[pc->m_dst].m_obj);
+            pc++;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(CaseObj) {
+            unsigned tag = lean_obj_tag(regs[pc->m_dst].m_obj);
+            pc = code + (tag < pc->m_b ? ops[pc->m_a + tag] : pc->m_c);
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(CaseNum) {
+            unsigned tag = regs[pc->m_dst].m_num;
+            pc = code + (tag < pc->m_b ? ops[pc->m_a + tag] : pc->m_c);
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Ret) {
+            return regs[pc->m_a];
+        }
+        LEAN_IR_BYTECODE_CASE(Jmp) {
+            uint32 const * p = ops + pc->m_b;
+            for (uint32 i = 0; i < pc->m_c; i++)
+                regs[p[2 * i]] = regs[p[2 * i + 1]];
+            pc = code + pc->m_a;
+            LEAN_IR_BYTECODE_NEXT();
+        }
+        LEAN_IR_BYTECODE_CASE(Invalid) {
+            throw exception("invalid instruction");
+        }
+        LEAN_IR_BYTECODE_CASE(Unreachable) {
+            throw exception("unreachable code");
+        }
+        LEAN_IR_BYTECODE_CASE(IncompleteCase) {
+            throw exception("incomplete case");
+        }
+#if !defined(__GNUC__)
+        }
+        lean_unreachable();
+#endif
+#undef LEAN_IR_BYTECODE_CASE
+#undef LEAN_IR_BYTECODE_NEXT
+    }
+
     // closure stub
     object * stub_m(object ** args) {
         decl d(args[2]);
@@ -889,7 +1667,7 @@ private:
             m_arg_stack.push_back(args[3 + i]);
         }
         push_frame(d, old_size);
-        object * r = eval_body(decl_fun_body(d)).m_obj;
+        object * r = eval_decl(d).m_obj;
         pop_frame(r, type::TObject);
         return r;
     }
@@ -946,6 +1724,7 @@ private:
 public:
     explicit interpreter(environment const & env, options const & opts) : m_env(env), m_opts(opts) {
         m_prefer_native = opts.get_bool(*g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE);
+        m_bytecode = opts.get_bool(*g_interpreter_bytecode, LEAN_DEFAULT_INTERPRETER_BYTECODE);
     }
 
     ~interpreter() {
@@ -1111,8 +1890,10 @@ void initialize_ir_interpreter() {
     ir::g_boxed_mangled_suffix = new string_ref("___boxed");
     mark_persistent(ir::g_boxed_mangled_suffix->raw());
     ir::g_interpreter_prefer_native = new name({"interpreter", "prefer_native"});
-    ir::g_init_globals = new name_map<object *>();
+    ir::g_interpreter_bytecode = new name({"interpreter", "bytecode"});
+    ir::g_init_globals = new name_flat_map<object *>();
     register_bool_option(*ir::g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE, "(interpreter) whether to use precompiled code where available");
+    register_bool_option(*ir::g_interpreter_bytecode, LEAN_DEFAULT_INTERPRETER_BYTECODE, "(interpreter) whether to run code lowered to bytecode instead of walking the IR");
     DEBUG_CODE({
         register_trace_class({"interpreter"});
         register_trace_class({"interpreter", "call"});
@@ -1122,6 +1903,7 @@ void initialize_ir_interpreter() {
 
 void finalize_ir_interpreter() {
     delete ir::g_init_globals;
+    delete ir::g_interpreter_bytecode;
     delete ir::g_interpreter_prefer_native;
     delete ir::g_boxed_mangled_suffix;
     delete ir::g_boxed_suffix;
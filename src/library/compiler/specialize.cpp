@@ -14,6 +14,7 @@ Author: Leonardo de Moura
 #include "library/trace.h"
 #include "library/compiler/util.h"
 #include "library/compiler/csimp.h"
+#include "library/compiler/compile_cache.h"
 
 namespace lean {
 extern "C" uint8 lean_has_specialize_attribute(object* env, object* n);
@@ -104,6 +105,7 @@ extern "C" object* lean_add_specialization_info(object* env, object* fn, object*
 extern "C" object* lean_get_specialization_info(object* env, object* fn);
 
 static environment save_specialization_info(environment const & env, name const & fn, spec_info const & si) {
+    compile_cache_record_spec_info(fn, si);
     return environment(lean_add_specialization_info(env.to_obj_arg(), fn.to_obj_arg(), si.to_obj_arg()));
 }
 
@@ -256,11 +258,14 @@ extern "C" object* lean_cache_specialization(object* env, object* e, object* fn)
 extern "C" object* lean_get_cached_specialization(object* env, object* e);
 
 static environment cache_specialization(environment const & env, expr const & k, name const & fn) {
+    compile_cache_record_specialization(k, fn);
     return environment(lean_cache_specialization(env.to_obj_arg(), k.to_obj_arg(), fn.to_obj_arg()));
 }
 
 static optional<name> get_cached_specialization(environment const & env, expr const & e) {
-    return to_optional<name>(lean_get_cached_specialization(env.to_obj_arg(), e.to_obj_arg()));
+    optional<name> r = to_optional<name>(lean_get_cached_specialization(env.to_obj_arg(), e.to_obj_arg()));
+    if (r) compile_cache_record_specialization_use(e, *r);
+    return r;
 }
 
 class specialize_fn {
@@ -969,6 +974,7 @@ class specialize_fn {
         try {
             expr type = cheap_beta_reduce(type_checker(m_st).infer(code));
             declaration aux_ax = mk_axiom(n, names(), type, true /* meta */);
+            compile_cache_record_add(aux_ax);
             m_st.env() = env().add(aux_ax, false);
         } catch (exception &) {
             /* We may fail to infer the type of code, since it may be recursive
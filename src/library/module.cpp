@@ -13,6 +13,7 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <cstdlib>
 #include <sys/stat.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
@@ -21,6 +22,7 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "runtime/io.h"
 #include "runtime/compact.h"
 #include "runtime/buffer.h"
+#include "runtime/lz.h"
 #include "util/io.h"
 #include "util/name_map.h"
 #include "library/module.h"
@@ -43,14 +45,19 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #endif
 #endif
 
+#define LEAN_OLEAN_VERSION            1
+#define LEAN_OLEAN_COMPRESSED_VERSION 2
+// uncompressed size of the chunks of a compressed .olean file
+#define LEAN_OLEAN_CHUNK_SIZE         (1024*1024)
+
 namespace lean {
 
 /** On-disk format of a .olean file. */
 struct olean_header {
     // 5 bytes: magic number
     char marker[5] = {'o', 'l', 'e', 'a', 'n'};
-    // 1 byte: version, currently always `1`
-    uint8_t version = 1;
+    // 1 byte: version, `LEAN_OLEAN_VERSION`, or `LEAN_OLEAN_COMPRESSED_VERSION` if the payload is a compressed container
+    uint8_t version = LEAN_OLEAN_VERSION;
     // 42 bytes: build githash, padded with `\0` to the right
     char githash[42];
     // address at which the beginning of the file (including header) is attempted to be mmapped
@@ -61,7 +68,34 @@ struct olean_header {
 // make sure we don't have any padding bytes, which also ensures `data` is properly aligned
 static_assert(sizeof(olean_header) == 5 + 1 + 42 + sizeof(size_t), "olean_header must be packed");
 
-extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
+/** Payload of a compressed .olean file. The compacted region is split into chunks of `LEAN_OLEAN_CHUNK_SIZE` bytes
+    that are compressed independently. The region is still compacted for `base_addr + sizeof(olean_header)`. */
+struct olean_compressed_header {
+    // size of the (uncompressed) compacted region
+    size_t data_size;
+    size_t num_chunks;
+    // followed by `num_chunks` compressed chunk sizes of type `size_t`, followed by the compressed chunks
+};
+
+static void write_compressed(std::ofstream & out, char const * data, size_t size) {
+    olean_compressed_header header;
+    header.data_size  = size;
+    header.num_chunks = (size + LEAN_OLEAN_CHUNK_SIZE - 1) / LEAN_OLEAN_CHUNK_SIZE;
+    std::vector<size_t> chunk_sizes(header.num_chunks);
+    std::vector<char> chunks;
+    std::vector<char> chunk(lz_compress_bound(LEAN_OLEAN_CHUNK_SIZE));
+    for (size_t i = 0; i < header.num_chunks; i++) {
+        size_t begin = i * LEAN_OLEAN_CHUNK_SIZE;
+        size_t sz = std::min(size - begin, static_cast<size_t>(LEAN_OLEAN_CHUNK_SIZE));
+        chunk_sizes[i] = lz_compress(data + begin, sz, chunk.data());
+        chunks.insert(chunks.end(), chunk.data(), chunk.data() + chunk_sizes[i]);
+    }
+    out.write(reinterpret_cast<char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<char *>(chunk_sizes.data()), sizeof(size_t) * chunk_sizes.size());
+    out.write(chunks.data(), chunks.size());
+}
+
+static object * save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, bool compress) {
     std::string olean_fn(string_cstr(fname));
     // we first write to a temp file and then move it to the correct path (possibly deleting an older file)
     // so that we neither expose partially-written files nor modify possibly memory-mapped files
@@ -96,9 +130,14 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
         // see/sync with file format description above
         olean_header header = {};
         header.base_addr = base_addr;
+        if (compress)
+            header.version = LEAN_OLEAN_COMPRESSED_VERSION;
         strncpy(header.githash, LEAN_GITHASH, sizeof(header.githash));
         out.write(reinterpret_cast<char *>(&header), sizeof(header));
-        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        if (compress)
+            write_compressed(out, static_cast<char const *>(compactor.data()), compactor.size());
+        else
+            out.write(static_cast<char const *>(compactor.data()), compactor.size());
         out.close();
         while (std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
 #ifdef LEAN_WINDOWS
@@ -126,6 +165,104 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
     }
 }
 
+/* Compressed .olean files can be requested for the whole build by setting `LEAN_OLEAN_COMPRESS=1`. */
+static bool get_lean_olean_compress() {
+    if (char const * compress = std::getenv("LEAN_OLEAN_COMPRESS")) {
+        return atoi(compress) != 0;
+    }
+    return false;
+}
+
+extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
+    return save_module_data(fname, mod, mdata, get_lean_olean_compress());
+}
+
+extern "C" LEAN_EXPORT object * lean_save_module_data_compressed(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
+    return save_module_data(fname, mod, mdata, true);
+}
+
+static object * mk_module_region(compacted_region * region) {
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+    // do not report as leak
+    __lsan_ignore_object(region);
+#endif
+#endif
+    object * mod = region->read();
+    object * mod_region = alloc_cnstr(0, 2, 0);
+    cnstr_set(mod_region, 0, mod);
+    cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
+    return mod_region;
+}
+
+/* Decompress the payload of a compressed .olean file, trying to place it at `base_addr` to avoid relocations. */
+static object * read_compressed_module_data(std::string const & olean_fn, std::ifstream & in, size_t size, char * base_addr) {
+    olean_compressed_header header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.num_chunks > size / sizeof(size_t) ||
+        sizeof(olean_header) + sizeof(header) + sizeof(size_t) * header.num_chunks > size) {
+        return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+    }
+    std::vector<size_t> chunk_sizes(header.num_chunks);
+    std::vector<char> chunks(size - sizeof(olean_header) - sizeof(header) - sizeof(size_t) * header.num_chunks);
+    if (!in.read(reinterpret_cast<char *>(chunk_sizes.data()), sizeof(size_t) * header.num_chunks) ||
+        !in.read(chunks.data(), chunks.size())) {
+        return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+    }
+    in.close();
+    size_t mem_size = sizeof(olean_header) + header.data_size;
+    char * mem = nullptr;
+    bool is_mmap = false;
+    std::function<void()> free_data;
+#if !defined(LEAN_WINDOWS) && defined(LEAN_MMAP)
+    mem = static_cast<char *>(mmap(base_addr, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (mem == MAP_FAILED) {
+        mem = nullptr;
+    } else {
+        is_mmap = true;
+        free_data = [=]() {
+            lean_always_assert(munmap(mem, mem_size) == 0);
+        };
+    }
+#endif
+    if (!mem) {
+        mem = static_cast<char *>(malloc(mem_size));
+        if (!mem) {
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', out of memory").str());
+        }
+        free_data = [=]() {
+            free(mem);
+        };
+    }
+    char * buffer = mem + sizeof(olean_header);
+    size_t offset = 0;
+    char const * chunk = chunks.data();
+    for (size_t i = 0; i < header.num_chunks; i++) {
+        size_t sz = std::min(header.data_size - offset, static_cast<size_t>(LEAN_OLEAN_CHUNK_SIZE));
+        if (chunk_sizes[i] > static_cast<size_t>(chunks.data() + chunks.size() - chunk) ||
+            !lz_decompress(chunk, chunk_sizes[i], buffer + offset, sz)) {
+            free_data();
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', corrupted data").str());
+        }
+        chunk  += chunk_sizes[i];
+        offset += sz;
+    }
+    if (offset != header.data_size) {
+        free_data();
+        return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', corrupted data").str());
+    }
+    compacted_region * region =
+      new compacted_region(header.data_size, buffer, base_addr + sizeof(olean_header), false, free_data);
+    object * mod_region = mk_module_region(region);
+#if !defined(LEAN_WINDOWS) && defined(LEAN_MMAP)
+    if (is_mmap) {
+        // as for uncompressed files, the objects must not be modified after relocation
+        lean_always_assert(mprotect(mem, mem_size, PROT_READ) == 0);
+    }
+#endif
+    return io_result_mk_ok(mod_region);
+}
+
 extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *) {
     std::string olean_fn(string_cstr(fname));
     try {
@@ -144,7 +281,7 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
         if (memcmp(header.marker, default_header.marker, sizeof(header.marker)) != 0
-            || header.version != default_header.version
+            || (header.version != LEAN_OLEAN_VERSION && header.version != LEAN_OLEAN_COMPRESSED_VERSION)
 #ifdef LEAN_CHECK_OLEAN_VERSION
             || strncmp(header.githash, LEAN_GITHASH, sizeof(header.githash)) != 0
 #endif
@@ -152,8 +289,15 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
         char * base_addr = reinterpret_cast<char *>(header.base_addr);
+        if (header.version == LEAN_OLEAN_COMPRESSED_VERSION) {
+            return read_compressed_module_data(olean_fn, in, size, base_addr);
+        }
         char * buffer = nullptr;
         bool is_mmap = false;
+        // If the file could not be mapped at `base_addr`, we map it copy-on-write at some other address
+        // and relocate it in place. Only pages containing pointers are copied, the rest are still shared
+        // with the page cache.
+        bool relocate_in_place = false;
         std::function<void()> free_data;
 #ifdef LEAN_WINDOWS
         // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
@@ -166,9 +310,14 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             return io_result_mk_error((sstream() << "failed to map '" << olean_fn << "': " << GetLastError()).str());
         }
         buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_READ, 0, 0, 0, base_addr));
+        if (!buffer) {
+            buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_COPY, 0, 0, 0, NULL));
+            relocate_in_place = buffer != nullptr;
+        }
+        char * view = buffer;
         free_data = [=]() {
-            if (buffer) {
-                lean_always_assert(UnmapViewOfFile(base_addr));
+            if (view) {
+                lean_always_assert(UnmapViewOfFile(view));
             }
             lean_always_assert(CloseHandle(h_map));
             lean_always_assert(CloseHandle(h_olean_fn));
@@ -180,6 +329,14 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         }
 #ifdef LEAN_MMAP
         buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (buffer != MAP_FAILED && buffer != base_addr) {
+            if (mprotect(buffer, size, PROT_READ | PROT_WRITE) == 0) {
+                relocate_in_place = true;
+            } else {
+                lean_always_assert(munmap(buffer, size) == 0);
+                buffer = static_cast<char *>(MAP_FAILED);
+            }
+        }
 #endif
         close(fd);
         free_data = [=]() {
@@ -188,7 +345,7 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             }
         };
 #endif
-        if (buffer && buffer == base_addr) {
+        if (buffer && (buffer == base_addr || relocate_in_place)) {
             buffer += sizeof(olean_header);
             is_mmap = true;
         } else {
@@ -208,16 +365,13 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
 
         compacted_region * region =
           new compacted_region(size - sizeof(olean_header), buffer, base_addr + sizeof(olean_header), is_mmap, free_data);
-#if defined(__has_feature)
-#if __has_feature(address_sanitizer)
-        // do not report as leak
-        __lsan_ignore_object(region);
-#endif
+        object * mod_region = mk_module_region(region);
+#if !defined(LEAN_WINDOWS) && defined(LEAN_MMAP)
+        if (relocate_in_place) {
+            // relocation is done, make sure the objects are not modified from now on as for other mapped files
+            lean_always_assert(mprotect(buffer - sizeof(olean_header), size, PROT_READ) == 0);
+        }
 #endif
-        object * mod = region->read();
-        object * mod_region = alloc_cnstr(0, 2, 0);
-        cnstr_set(mod_region, 0, mod);
-        cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
         return io_result_mk_ok(mod_region);
     } catch (exception & ex) {
         return io_result_mk_error((sstream() << "failed to read '" << olean_fn << "': " << ex.what()).str());
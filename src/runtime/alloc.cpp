@@ -5,6 +5,13 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <cstdlib>
+#if defined(LEAN_WINDOWS) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#endif
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
@@ -23,7 +30,7 @@ Author: Leonardo de Moura
 #endif
 
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
-#define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
+#define LEAN_SEGMENT_SIZE          (8*1024*1024) // 8 Mb
 #define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
 #define LEAN_MAX_TO_EXPORT_OBJS    1024
 
@@ -44,6 +51,8 @@ static atomic<uint64> g_num_segments(0);
 static atomic<uint64> g_num_pages(0);
 static atomic<uint64> g_num_exports(0);
 static atomic<uint64> g_num_recycled_pages(0);
+static atomic<uint64> g_num_retired_pages(0);
+static atomic<uint64> g_num_freed_segments(0);
 struct alloc_stats {
     ~alloc_stats() {
         std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
@@ -53,6 +62,8 @@ struct alloc_stats {
         std::cerr << "num. segments:       " << g_num_segments << "\n";
         std::cerr << "num. pages:          " << g_num_pages << "\n";
         std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
+        std::cerr << "num. retired pages:  " << g_num_retired_pages << "\n";
+        std::cerr << "num. freed segments: " << g_num_freed_segments << "\n";
         std::cerr << "num. exports:        " << g_num_exports << "\n";
     }
 };
@@ -83,6 +94,7 @@ struct page {
     void set_heap(heap * h) { m_header.m_heap = h; }
     heap * get_heap() { return m_header.m_heap; }
     bool has_many_free() const { return m_header.m_num_free > m_header.m_max_free / 4; }
+    bool is_empty() const { return m_header.m_num_free == m_header.m_max_free; }
     bool in_page_free_list() const { return m_header.m_in_page_free_list; }
     unsigned get_slot_idx() const { return m_header.m_slot_idx; }
     void push_free_obj(void * o);
@@ -92,66 +104,139 @@ inline char * align_ptr(char * p, size_t a) {
     return reinterpret_cast<char*>(lean_align(reinterpret_cast<size_t>(p), a));
 }
 
+/* Segments are `LEAN_SEGMENT_SIZE` aligned blocks obtained directly from the OS.
+   The segment header occupies the first page, the remaining ones are handed out to
+   size classes. We keep track of the number of pages in use so that the segment can
+   be returned to the OS as soon as all its objects have been deallocated. */
 struct segment {
     segment *    m_next{nullptr};
+    segment *    m_prev{nullptr};
     char *       m_next_page_mem;
-    char         m_data[LEAN_SEGMENT_SIZE];
+    unsigned     m_num_used_pages{0};
 
     char * get_first_page_mem() {
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) >= m_data);
-        lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) > reinterpret_cast<char*>(this));
-        return align_ptr(m_data, LEAN_PAGE_SIZE);
+        return reinterpret_cast<char*>(this) + LEAN_PAGE_SIZE;
+    }
+
+    char * get_end() {
+        return reinterpret_cast<char*>(this) + LEAN_SEGMENT_SIZE;
     }
 
     segment() {
         m_next_page_mem = get_first_page_mem();
     }
 
-    bool is_full() const {
-        return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
+    bool is_full() {
+        return m_next_page_mem == get_end();
     }
 };
 
+LEAN_CASSERT(sizeof(segment) <= LEAN_PAGE_SIZE);
+
+/* If true, segments are backed by transparent huge pages when the OS supports them. */
+static bool g_huge_pages = false;
+
+static void * alloc_segment_mem() {
+    void * r;
+#if defined(LEAN_WINDOWS)
+    r = _aligned_malloc(LEAN_SEGMENT_SIZE, LEAN_SEGMENT_SIZE);
+#elif defined(LEAN_EMSCRIPTEN)
+    if (posix_memalign(&r, LEAN_SEGMENT_SIZE, LEAN_SEGMENT_SIZE) != 0)
+        r = nullptr;
+#else
+    r = mmap(nullptr, LEAN_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+        lean_internal_panic_out_of_memory();
+    if (reinterpret_cast<size_t>(r) % LEAN_SEGMENT_SIZE != 0) {
+        /* Over-allocate and trim the unaligned ends. Subsequent mappings are usually
+           placed next to this one and are then aligned on the first try. */
+        munmap(r, LEAN_SEGMENT_SIZE);
+        char * m = static_cast<char *>(mmap(nullptr, 2 * LEAN_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (m == MAP_FAILED)
+            lean_internal_panic_out_of_memory();
+        char * a = align_ptr(m, LEAN_SEGMENT_SIZE);
+        if (a != m)
+            munmap(m, a - m);
+        if (a + LEAN_SEGMENT_SIZE != m + 2 * LEAN_SEGMENT_SIZE)
+            munmap(a + LEAN_SEGMENT_SIZE, (m + 2 * LEAN_SEGMENT_SIZE) - (a + LEAN_SEGMENT_SIZE));
+        r = a;
+    }
+#ifdef MADV_HUGEPAGE
+    if (g_huge_pages)
+        madvise(r, LEAN_SEGMENT_SIZE, MADV_HUGEPAGE);
+#endif
+#endif
+    if (r == nullptr)
+        lean_internal_panic_out_of_memory();
+    return r;
+}
+
+static void free_segment_mem(void * s) {
+#if defined(LEAN_WINDOWS)
+    _aligned_free(s);
+#elif defined(LEAN_EMSCRIPTEN)
+    free(s);
+#else
+    munmap(s, LEAN_SEGMENT_SIZE);
+#endif
+}
+
 struct heap {
+    /* Segment new pages are carved from. */
     segment * m_curr_segment{nullptr};
+    /* All segments owned by this heap. */
+    segment * m_segments{nullptr};
+    /* Pages that are not assigned to any size class. */
+    page *    m_free_pages{nullptr};
     heap *    m_next_orphan{nullptr};
     page *    m_curr_page[LEAN_NUM_SLOTS];
     page *    m_page_free_list[LEAN_NUM_SLOTS];
     /* Objects that must be sent to other heaps. */
     void *    m_to_export_list{nullptr};
     unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
     /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+       by other heaps. Other heaps prepend whole chains using compare-and-swap,
+       and the owner takes the entire list at once. */
+    atomic<void *> m_to_import_list{nullptr};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
     void import_objs();
     void export_objs();
     void alloc_segment();
+    void free_segment(segment * s);
+    void free_page(page * p);
+    size_t trim(bool orphan);
 };
 
 struct heap_manager {
-    /* The mutex protects the list of orphan segments. */
-    mutex             m_mutex;
-    heap *            m_orphans{nullptr};
+    /* Heaps of finished threads. */
+    atomic<heap *>    m_orphans{nullptr};
+
+    void push_orphans(heap * first, heap * last) {
+        heap * head = m_orphans.load();
+        do {
+            last->m_next_orphan = head;
+        } while (!m_orphans.compare_exchange_strong(head, first));
+    }
 
     void push_orphan(heap * h) {
-        /* TODO(Leo): avoid mutex */
-        lock_guard<mutex> lock(m_mutex);
-        h->m_next_orphan = m_orphans;
-        m_orphans = h;
+        push_orphans(h, h);
+    }
+
+    heap * pop_orphans() {
+        return m_orphans.exchange(nullptr);
     }
 
     heap * pop_orphan() {
-        /* TODO(Leo): avoid mutex */
-        lock_guard<mutex> lock(m_mutex);
-        if (m_orphans) {
-            heap * h = m_orphans;
-            m_orphans = h->m_next_orphan;
-            return h;
-        } else {
-            return nullptr;
+        /* We take the whole list and give back the remainder instead of
+           popping a single element, which would be subject to the ABA problem. */
+        heap * h = pop_orphans();
+        if (h && h->m_next_orphan) {
+            heap * last = h->m_next_orphan;
+            while (last->m_next_orphan)
+                last = last->m_next_orphan;
+            push_orphans(h->m_next_orphan, last);
         }
+        return h;
     }
 };
 
@@ -159,6 +244,10 @@ static inline page * get_page_of(void * o) {
     return reinterpret_cast<page*>((reinterpret_cast<size_t>(o)/LEAN_PAGE_SIZE)*LEAN_PAGE_SIZE);
 }
 
+static inline segment * get_segment_of(page * p) {
+    return reinterpret_cast<segment*>((reinterpret_cast<size_t>(p)/LEAN_SEGMENT_SIZE)*LEAN_SEGMENT_SIZE);
+}
+
 LEAN_THREAD_GLOBAL_PTR(page *, g_curr_pages);
 LEAN_THREAD_PTR(heap, g_heap);
 static heap_manager * g_heap_manager = nullptr;
@@ -171,33 +260,36 @@ inline void * get_next_obj(void * obj) {
     return *reinterpret_cast<void**>(obj);
 }
 
+/* The `m_prev` field of the first element of a page list is always `nullptr`. */
 static inline void page_list_insert(page * & head, page * new_head) {
     if (head)
         head->set_prev(new_head);
     new_head->set_next(head);
+    new_head->set_prev(nullptr);
     head = new_head;
 }
 
 static inline void page_list_remove(page * & head, page * to_remove) {
+    page * prev = to_remove->get_prev();
+    page * next = to_remove->get_next();
     if (head == to_remove) {
         /* First element */
-        head = to_remove->get_next();
-    }
-    page * prev = to_remove->get_prev();
-    lean_assert(prev);
-    if (page * next = to_remove->get_next()) {
-        prev->set_next(next);
-        next->set_prev(prev);
+        lean_assert(!prev);
+        head = next;
     } else {
-        /* Last element */
-        prev->set_next(nullptr);
+        lean_assert(prev);
+        prev->set_next(next);
     }
+    if (next)
+        next->set_prev(prev);
 }
 
 static inline page * page_list_pop(page * & head) {
     lean_assert(head);
     page * r = head;
     head = head->get_next();
+    if (head)
+        head->set_prev(nullptr);
     return r;
 }
 
@@ -216,15 +308,16 @@ void page::push_free_obj(void * o) {
             page_list_insert(h->m_page_free_list[slot_idx], this);
         }
     }
+    if (LEAN_UNLIKELY(is_empty()) && in_page_free_list()) {
+        /* Remark: pages in `m_page_free_list` are never the current page of their size class. */
+        get_heap()->free_page(this);
+    }
 }
 
 void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
-    }
+    if (m_to_import_list.load() == nullptr)
+        return;
+    void * to_import = m_to_import_list.exchange(nullptr);
     while (to_import) {
         page * p = get_page_of(to_import);
         void * n = get_next_obj(to_import);
@@ -263,29 +356,111 @@ void heap::export_objs() {
     m_to_export_list      = nullptr;
     m_to_export_list_size = 0;
     for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
+        void * head = e.m_heap->m_to_import_list.load();
+        do {
+            set_next_obj(e.m_tail, head);
+        } while (!e.m_heap->m_to_import_list.compare_exchange_strong(head, e.m_head));
     }
 }
 
 void heap::alloc_segment() {
     LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-    segment * s = new segment();
-    s->m_next   = m_curr_segment;
+    segment * s = new (alloc_segment_mem()) segment();
+    s->m_next = m_segments;
+    if (m_segments)
+        m_segments->m_prev = s;
+    m_segments     = s;
     m_curr_segment = s;
 }
 
+/* Return the unused segment `s` to the OS. */
+void heap::free_segment(segment * s) {
+    lean_assert(s->m_num_used_pages == 0);
+    lean_assert(s != m_curr_segment);
+    LEAN_RUNTIME_STAT_CODE(g_num_freed_segments++);
+    for (char * m = s->get_first_page_mem(); m < s->m_next_page_mem; m += LEAN_PAGE_SIZE)
+        page_list_remove(m_free_pages, reinterpret_cast<page*>(m));
+    if (s->m_prev)
+        s->m_prev->m_next = s->m_next;
+    else
+        m_segments = s->m_next;
+    if (s->m_next)
+        s->m_next->m_prev = s->m_prev;
+    free_segment_mem(s);
+}
+
+/* Detach the empty page `p` from its size class. */
+void heap::free_page(page * p) {
+    lean_assert(p->is_empty());
+    LEAN_RUNTIME_STAT_CODE(g_num_retired_pages++);
+    if (p->in_page_free_list())
+        page_list_remove(m_page_free_list[p->get_slot_idx()], p);
+    else
+        page_list_remove(m_curr_page[p->get_slot_idx()], p);
+    p->m_header.m_in_page_free_list = false;
+    segment * s = get_segment_of(p);
+    lean_assert(s->m_num_used_pages > 0);
+    s->m_num_used_pages--;
+    page_list_insert(m_free_pages, p);
+    if (s->m_num_used_pages == 0 && s != m_curr_segment)
+        free_segment(s);
+}
+
+static unsigned get_num_segments(segment * s) {
+    unsigned r = 0;
+    for (; s != nullptr; s = s->m_next)
+        r++;
+    return r;
+}
+
+/* Return all empty segments of this heap to the OS, and the number of bytes released.
+   If `orphan` is true, no thread is using this heap, and we also release empty pages
+   that are the current page of their size class. */
+size_t heap::trim(bool orphan) {
+    export_objs();
+    import_objs();
+    unsigned num_segments = get_num_segments(m_segments);
+    if (orphan) {
+        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+            page * p = m_curr_page[i];
+            while (p != nullptr) {
+                page * n = p->get_next();
+                if (p->is_empty())
+                    free_page(p);
+                p = n;
+            }
+        }
+    }
+    segment * s = m_segments;
+    while (s != nullptr) {
+        segment * n = s->m_next;
+        if (s->m_num_used_pages == 0) {
+            if (s == m_curr_segment)
+                m_curr_segment = nullptr;
+            free_segment(s);
+        }
+        s = n;
+    }
+    return static_cast<size_t>(num_segments - get_num_segments(m_segments)) * LEAN_SEGMENT_SIZE;
+}
+
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
-    segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
-    page * p    = new (s->m_next_page_mem) page();
-    s->m_next_page_mem += LEAN_PAGE_SIZE;
-    if (s->is_full()) {
-        /* s is full, we need to allocate a new one. */
-        h->alloc_segment();
+    page * p;
+    if (h->m_free_pages) {
+        p = page_list_pop(h->m_free_pages);
+    } else {
+        if (h->m_curr_segment == nullptr || h->m_curr_segment->is_full()) {
+            /* the current segment is full or has been released, we need to allocate a new one. */
+            h->alloc_segment();
+        }
+        segment * s = h->m_curr_segment;
+        LEAN_RUNTIME_STAT_CODE(g_num_pages++);
+        p = reinterpret_cast<page*>(s->m_next_page_mem);
+        s->m_next_page_mem += LEAN_PAGE_SIZE;
     }
+    get_segment_of(p)->m_num_used_pages++;
+    p = new (p) page;
     unsigned slot_idx        = lean_get_slot_idx(obj_size);
     p->m_header.m_heap       = h;
     page_list_insert(h->m_curr_page[slot_idx], p);
@@ -334,22 +509,25 @@ static void init_heap(bool main) {
     if (heap * h = g_heap_manager->pop_orphan()) {
         /* reuse orphan heap */
         g_heap = h;
+        g_heap->m_next_orphan = nullptr;
+        g_heap->import_objs();
     } else {
         g_heap = new heap();
-        g_curr_pages = g_heap->m_curr_page;
         for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
             g_heap->m_curr_page[i] = nullptr;
             g_heap->m_page_free_list[i] = nullptr;
         }
         g_heap->alloc_segment();
-        unsigned obj_size = LEAN_OBJECT_SIZE_DELTA;
-        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
-            if (g_heap->m_curr_page[i] == nullptr) {
-                alloc_page(g_heap, obj_size);
-            }
-            obj_size += LEAN_OBJECT_SIZE_DELTA;
+    }
+    /* Remark: `lean_heap_trim` may have released the current pages of an orphan heap. */
+    unsigned obj_size = LEAN_OBJECT_SIZE_DELTA;
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+        if (g_heap->m_curr_page[i] == nullptr) {
+            alloc_page(g_heap, obj_size);
         }
+        obj_size += LEAN_OBJECT_SIZE_DELTA;
     }
+    g_curr_pages = g_heap->m_curr_page;
     if (!main)
         register_thread_finalizer(finalize_heap, g_heap);
 }
@@ -450,11 +628,35 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
     page * p = get_page_of(o);
     return p->m_header.m_obj_size;
 }
+#endif
 
+extern "C" LEAN_EXPORT size_t lean_heap_trim() {
+    size_t r = 0;
+#ifdef LEAN_SMALL_ALLOCATOR
+    if (g_heap)
+        r += g_heap->trim(false);
+    if (heap * first = g_heap_manager->pop_orphans()) {
+        /* While we hold them, new threads will not reuse these heaps. */
+        heap * last = first;
+        for (heap * h = first; h != nullptr; h = h->m_next_orphan) {
+            r += h->trim(true);
+            last = h;
+        }
+        g_heap_manager->push_orphans(first, last);
+    }
 #endif
+#if defined(__GLIBC__)
+    /* Big objects are allocated using `malloc`. */
+    malloc_trim(0);
+#endif
+    return r;
+}
 
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+    if (char const * huge_pages = std::getenv("LEAN_HUGE_PAGES")) {
+        g_huge_pages = atoi(huge_pages) != 0;
+    }
     g_heap_manager = new heap_manager();
     init_heap(true);
 #endif
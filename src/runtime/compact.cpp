@@ -4,13 +4,13 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <unordered_set>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
 #include <lean/lean.h>
 #include "runtime/hash.h"
+#include "runtime/thread.h"
 #include "runtime/compact.h"
 
 #ifndef LEAN_WINDOWS
@@ -18,46 +18,127 @@ Author: Leonardo de Moura
 #endif
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
-#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
+#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*64
+#define LEAN_OBJ_TABLE_INITIAL_SIZE 1024*64
 
 // uncomment to track the number of each kind of object in an .olean file
 // #define LEAN_TAG_COUNTERS
 
 namespace lean {
 
-struct max_sharing_key {
-    size_t m_offset;
-    size_t m_size;
-    max_sharing_key(size_t offset, size_t sz):m_offset(offset), m_size(sz) {}
-};
+/*
+  Remark: g_null_offset must NOT be a valid Lean scalar value (e.g., static_cast<size_t>(-1)).
+  Recall that Lean scalar are odd size_t values. So, we use (static_cast<size_t>(-1) - 1) which is an even number.
+  In the past we used `static_cast<size_t>(-1)`, and it caused nontermination in the object compactor.
+*/
+object_offset g_null_offset = reinterpret_cast<object_offset>(static_cast<size_t>(-1) - 1);
+
+/* Mapping from objects to their offsets in the compacted region. We use open addressing with linear probing
+   since the table is hit for every field of every object being compacted, and is never shrunk. */
+struct object_compactor::obj_table {
+    struct entry {
+        object *      m_obj;
+        object_offset m_offset;
+    };
+    std::vector<entry> m_entries;
+    size_t             m_size;
+
+    obj_table():m_entries(LEAN_OBJ_TABLE_INITIAL_SIZE, entry{nullptr, nullptr}), m_size(0) {}
 
-struct max_sharing_hash {
-    object_compactor * m;
-    max_sharing_hash(object_compactor * manager):m(manager) {}
-    unsigned operator()(max_sharing_key const & k) const {
-        return hash_str(k.m_size, reinterpret_cast<unsigned char const *>(m->m_begin) + k.m_offset, 17);
+    size_t get_idx(object * o) const {
+        return static_cast<size_t>(hash(17, reinterpret_cast<size_t>(o))) & (m_entries.size() - 1);
     }
-};
 
-struct max_sharing_eq {
-    object_compactor * m;
-    max_sharing_eq(object_compactor * manager):m(manager) {}
-    bool operator()(max_sharing_key const & k1, max_sharing_key const & k2) const {
-        if (k1.m_size != k2.m_size) return false;
-        return memcmp(reinterpret_cast<char*>(m->m_begin) + k1.m_offset, reinterpret_cast<char*>(m->m_begin) + k2.m_offset, k1.m_size) == 0;
+    /* Return `g_null_offset` if `o` has not been compacted yet. */
+    object_offset find(object * o) const {
+        size_t mask = m_entries.size() - 1;
+        for (size_t i = get_idx(o);; i = (i + 1) & mask) {
+            entry const & e = m_entries[i];
+            if (e.m_obj == o)
+                return e.m_offset;
+            if (e.m_obj == nullptr)
+                return g_null_offset;
+        }
+    }
+
+    void insert_core(object * o, object_offset offset) {
+        size_t mask = m_entries.size() - 1;
+        size_t i    = get_idx(o);
+        while (m_entries[i].m_obj != nullptr && m_entries[i].m_obj != o)
+            i = (i + 1) & mask;
+        if (m_entries[i].m_obj == nullptr)
+            m_size++;
+        m_entries[i] = entry{o, offset};
+    }
+
+    void insert(object * o, object_offset offset) {
+        // keep the load factor below 1/2
+        if (2 * (m_size + 1) > m_entries.size()) {
+            std::vector<entry> entries(2 * m_entries.size(), entry{nullptr, nullptr});
+            entries.swap(m_entries);
+            m_size = 0;
+            for (entry const & e : entries) {
+                if (e.m_obj != nullptr)
+                    insert_core(e.m_obj, e.m_offset);
+            }
+        }
+        insert_core(o, offset);
     }
 };
 
+static constexpr size_t g_no_offset = static_cast<size_t>(-1);
 
+/* Table of the objects already in the compacted region, used to share structurally equal objects.
+   Entries store offsets and sizes of objects in the region together with their hash code. */
 struct object_compactor::max_sharing_table {
-    std::unordered_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
-    max_sharing_table(object_compactor * manager):
-        m_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, max_sharing_hash(manager), max_sharing_eq(manager)) {
+    struct entry {
+        size_t m_offset;
+        size_t m_size;
+        uint64 m_hash;
+    };
+    std::vector<entry> m_entries;
+    size_t             m_size;
+
+    max_sharing_table():m_entries(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, entry{g_no_offset, 0, 0}), m_size(0) {}
+
+    void grow() {
+        std::vector<entry> entries(2 * m_entries.size(), entry{g_no_offset, 0, 0});
+        entries.swap(m_entries);
+        size_t mask = m_entries.size() - 1;
+        for (entry const & e : entries) {
+            if (e.m_offset != g_no_offset) {
+                size_t i = static_cast<size_t>(e.m_hash) & mask;
+                while (m_entries[i].m_offset != g_no_offset)
+                    i = (i + 1) & mask;
+                m_entries[i] = e;
+            }
+        }
+    }
+
+    /* Return the offset of an object in `begin` equal to the `sz` bytes at `offset`.
+       If there is none, the object at `offset` is added to the table. */
+    size_t find_or_insert(char const * begin, size_t offset, size_t sz) {
+        // keep the load factor below 1/2
+        if (2 * (m_size + 1) > m_entries.size())
+            grow();
+        uint64 h    = hash_bytes(sz, reinterpret_cast<unsigned char const *>(begin) + offset, 17);
+        size_t mask = m_entries.size() - 1;
+        for (size_t i = static_cast<size_t>(h) & mask;; i = (i + 1) & mask) {
+            entry & e = m_entries[i];
+            if (e.m_offset == g_no_offset) {
+                e = entry{offset, sz, h};
+                m_size++;
+                return offset;
+            }
+            if (e.m_hash == h && e.m_size == sz && memcmp(begin + e.m_offset, begin + offset, sz) == 0)
+                return e.m_offset;
+        }
     }
 };
 
 object_compactor::object_compactor(void * base_addr):
-    m_max_sharing_table(new max_sharing_table(this)),
+    m_obj_table(new obj_table()),
+    m_max_sharing_table(new max_sharing_table()),
     m_base_addr(base_addr),
     m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
     m_end(m_begin),
@@ -68,24 +149,19 @@ object_compactor::~object_compactor() {
     free(m_begin);
 }
 
-/*
-  Remark: g_null_offset must NOT be a valid Lean scalar value (e.g., static_cast<size_t>(-1)).
-  Recall that Lean scalar are odd size_t values. So, we use (static_cast<size_t>(-1) - 1) which is an even number.
-  In the past we used `static_cast<size_t>(-1)`, and it caused nontermination in the object compactor.
-*/
-object_offset g_null_offset = reinterpret_cast<object_offset>(static_cast<size_t>(-1) - 1);
-
 void * object_compactor::alloc(size_t sz) {
     size_t rem = sz % sizeof(void*);
     if (rem != 0)
         sz = sz + sizeof(void*) - rem;
     while (static_cast<char*>(m_end) + sz > m_capacity) {
         size_t new_capacity = capacity()*2;
-        void * new_begin = malloc(new_capacity);
-        memcpy(new_begin, m_begin, size());
-        m_end      = static_cast<char*>(new_begin) + size();
+        size_t curr_size    = size();
+        // `realloc` can usually grow big blocks by remapping pages instead of copying them
+        void * new_begin = realloc(m_begin, new_capacity);
+        if (new_begin == nullptr)
+            lean_internal_panic_out_of_memory();
+        m_end      = static_cast<char*>(new_begin) + curr_size;
         m_capacity = static_cast<char*>(new_begin) + new_capacity;
-        free(m_begin);
         m_begin    = new_begin;
     }
     void * r = m_end;
@@ -97,17 +173,15 @@ void * object_compactor::alloc(size_t sz) {
 
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
-    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr))));
+    m_obj_table->insert(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr)));
 }
 
 void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
-    max_sharing_key k(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin), new_o_sz);
-    auto it = m_max_sharing_table->m_table.find(k);
-    if (it != m_max_sharing_table->m_table.end()) {
+    size_t offset = reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin);
+    size_t shared = m_max_sharing_table->find_or_insert(static_cast<char*>(m_begin), offset, new_o_sz);
+    if (shared != offset) {
         m_end = new_o;
-        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
-    } else {
-        m_max_sharing_table->m_table.insert(k);
+        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + shared);
     }
     save(o, new_o);
 }
@@ -116,13 +190,10 @@ object_offset object_compactor::to_offset(object * o) {
     if (lean_is_scalar(o)) {
         return o;
     } else {
-        auto it = m_obj_table.find(o);
-        if (it == m_obj_table.end()) {
+        object_offset r = m_obj_table->find(o);
+        if (r == g_null_offset)
             m_todo.push_back(o);
-            return g_null_offset;
-        } else {
-            return it->second;
-        }
+        return r;
     }
 }
 
@@ -154,13 +225,18 @@ void object_compactor::insert_sarray(object * o) {
 void object_compactor::insert_string(object * o) {
     size_t sz        = lean_string_size(o);
     size_t len       = lean_string_len(o);
-    size_t obj_sz = sizeof(lean_string_object) + sz;
+    // long strings get a slot for their hash code after their data, aligned to 8 bytes
+    bool cache_hash  = sz >= LEAN_STRING_CACHED_HASH_MIN_SIZE;
+    size_t capacity  = cache_hash ? (sz + 2 * sizeof(uint64) - 1) / sizeof(uint64) * sizeof(uint64) : sz;
+    size_t obj_sz = sizeof(lean_string_object) + capacity;
     lean_string_object * new_o = (lean_string_object*)alloc(obj_sz);
-    lean_set_non_heap_header_for_big((lean_object*)new_o, LeanString, 0);
+    lean_set_non_heap_header_for_big((lean_object*)new_o, LeanString, cache_hash ? LEAN_STRING_CACHED_HASH : 0);
     new_o->m_size     = sz;
-    new_o->m_capacity = sz;
+    new_o->m_capacity = capacity;
     new_o->m_length   = len;
     memcpy(new_o->m_data, lean_to_string(o)->m_data, sz);
+    if (cache_hash)
+        *string_cached_hash_slot((lean_object*)new_o) = lean_string_hash(o);
     save_max_sharing(o, (lean_object*)new_o, obj_sz);
 }
 
@@ -253,7 +329,8 @@ bool object_compactor::insert_task(object * o) {
     if (c == g_null_offset)
         return false;
     object * r = copy_object(o);
-    lean_assert(lean_to_task(r)->m_imp == nullptr);
+    // finished tasks keep their (now unused) `m_imp` until they are freed
+    lean_to_task(r)->m_imp   = nullptr;
     lean_to_task(r)->m_value = c;
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
@@ -332,7 +409,7 @@ void object_compactor::operator()(object * o) {
         m_todo.push_back(o);
         while (!m_todo.empty()) {
             object * curr = m_todo.back();
-            if (m_obj_table.find(curr) != m_obj_table.end()) {
+            if (m_obj_table->find(curr) != g_null_offset) {
                 m_todo.pop_back();
                 continue;
             }
@@ -377,8 +454,27 @@ compacted_region::compacted_region(object_compactor const & c):
     memcpy(m_begin, c.data(), c.size());
 }
 
+static atomic<uint64> g_num_freed_compacted_regions(0);
+
+uint64 get_num_freed_compacted_regions() {
+    return g_num_freed_compacted_regions.load();
+}
+
+static std::vector<std::function<void()>> * g_compacted_region_free_hooks = nullptr;
+
+void register_compacted_region_free_hook(std::function<void()> const & fn) {
+    if (!g_compacted_region_free_hooks)
+        g_compacted_region_free_hooks = new std::vector<std::function<void()>>();
+    g_compacted_region_free_hooks->push_back(fn);
+}
+
 compacted_region::~compacted_region() {
+    if (g_compacted_region_free_hooks) {
+        for (auto const & fn : *g_compacted_region_free_hooks)
+            fn();
+    }
     m_free_data();
+    g_num_freed_compacted_regions++;
 }
 
 inline object * compacted_region::fix_object_ptr(object * o) {
@@ -455,7 +551,6 @@ object * compacted_region::read() {
         m_end = m_next;
         return root;
     }
-    lean_assert(!m_is_mmap);
 
     while (m_next < m_end) {
         object * curr = reinterpret_cast<object*>(m_next);
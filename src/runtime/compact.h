@@ -14,10 +14,9 @@ namespace lean {
 typedef lean_object * object_offset;
 
 class LEAN_EXPORT object_compactor {
+    struct obj_table;
     struct max_sharing_table;
-    friend struct max_sharing_hash;
-    friend struct max_sharing_eq;
-    std::unordered_map<object*, object_offset, std::hash<object*>, std::equal_to<object*>> m_obj_table;
+    std::unique_ptr<obj_table> m_obj_table;
     std::unique_ptr<max_sharing_table> m_max_sharing_table;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
@@ -74,7 +73,8 @@ class LEAN_EXPORT compacted_region {
     void fix_mpz(object * o);
 public:
     /* Creates a compacted object region using the given region in memory.
-       This object takes ownership of the region. */
+       This object takes ownership of the region. If `data` is not located at `base_addr`,
+       `read` relocates the objects in place, even if `is_mmap` is true. */
     compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data);
     /* Creates a compacted object region using the object_compactor current state.
        It creates a copy of the compacted region generated by the object compactor. */
@@ -87,4 +87,12 @@ public:
     object * read();
     bool is_memory_mapped() const { return m_is_mmap; }
 };
+
+/* Return the number of compacted regions freed so far. Caches keyed on addresses of persistent
+   objects use it to detect that these addresses may have been reused. */
+LEAN_EXPORT uint64 get_num_freed_compacted_regions();
+
+/* Register a function to be invoked before a compacted region is freed. Caches that keep references to
+   persistent objects use it to release them while they are still valid. It must be invoked at initialization time. */
+LEAN_EXPORT void register_compacted_region_free_hook(std::function<void()> const & fn);
 }
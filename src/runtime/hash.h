@@ -10,8 +10,14 @@ Author: Leonardo de Moura
 
 namespace lean {
 
+/* MurmurHash64A of the `len` bytes at `str`. Its values must not change: `String.hash` is
+   implemented with it, and `Name` objects stored in .olean files cache hash codes derived from it. */
 uint64 hash_str(size_t len, unsigned char const * str, uint64 init_value);
 
+/* Faster hash for data whose hash codes are not persisted. It agrees with `hash_str` on short
+   inputs and uses a wyhash-style loop on long ones. */
+uint64 hash_bytes(size_t len, unsigned char const * str, uint64 init_value);
+
 inline uint64 hash(uint64 h, uint64 k) {
     uint64 m = 0xc6a4a7935bd1e995;
     uint64 r = 47;
@@ -11,7 +11,9 @@ Author: Leonardo de Moura
 #include "runtime/io.h"
 #include "runtime/stack_overflow.h"
 #include "runtime/process.h"
+#include "runtime/reactor.h"
 #include "runtime/mutex.h"
+#include "runtime/sharecommon.h"
 #include "runtime/init_module.h"
 
 namespace lean {
@@ -22,7 +24,9 @@ extern "C" LEAN_EXPORT void lean_initialize_runtime_module() {
     initialize_io();
     initialize_thread();
     initialize_mutex();
+    initialize_sharecommon();
     initialize_process();
+    initialize_reactor();
     initialize_stack_overflow();
 }
 void initialize_runtime_module() {
@@ -30,7 +34,9 @@ void initialize_runtime_module() {
 }
 void finalize_runtime_module() {
     finalize_stack_overflow();
+    finalize_reactor();
     finalize_process();
+    finalize_sharecommon();
     finalize_mutex();
     finalize_thread();
     finalize_io();
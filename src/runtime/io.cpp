@@ -27,6 +27,8 @@ Authors: Leonardo de Moura, Sebastian Ullrich
 #endif
 #ifndef LEAN_WINDOWS
 #include <csignal>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #endif
 #include <dirent.h>
 #include <fcntl.h>
@@ -38,6 +40,10 @@ Authors: Leonardo de Moura, Sebastian Ullrich
 #include <string>
 #include <cstdlib>
 #include <cctype>
+#include <cstring>
+#include <climits>
+#include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include "util/io.h"
 #include "runtime/alloc.h"
@@ -46,6 +52,7 @@ Authors: Leonardo de Moura, Sebastian Ullrich
 #include "runtime/object.h"
 #include "runtime/thread.h"
 #include "runtime/allocprof.h"
+#include "runtime/reactor.h"
 
 #ifdef _MSC_VER
 #define S_ISDIR(mode) ((mode & _S_IFDIR) != 0)
@@ -88,19 +95,236 @@ static obj_res mk_file_not_found_error(b_obj_arg fname) {
 
 static lean_external_class * g_io_handle_external_class = nullptr;
 
-static void io_handle_finalizer(void * h) {
+#ifdef LEAN_WINDOWS
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+#endif
+
+/* Low-level I/O on file descriptors. Interrupted calls are restarted. */
+static ssize_t fd_read(int fd, void * buf, size_t n) {
+#ifdef LEAN_WINDOWS
+    return _read(fd, buf, static_cast<unsigned>(std::min<size_t>(n, INT_MAX)));
+#else
+    ssize_t r;
+    while ((r = ::read(fd, buf, n)) < 0 && errno == EINTR) {}
+    return r;
+#endif
+}
+
+static ssize_t fd_readv(int fd, iovec const * iov, int cnt) {
+#ifdef LEAN_WINDOWS
+    // short reads are fine for our callers
+    lean_assert(cnt > 0);
+    return fd_read(fd, iov[0].iov_base, iov[0].iov_len);
+#else
+    ssize_t r;
+    while ((r = ::readv(fd, iov, cnt)) < 0 && errno == EINTR) {}
+    return r;
+#endif
+}
+
+static ssize_t fd_writev(int fd, iovec const * iov, int cnt) {
+#ifdef LEAN_WINDOWS
+    while (cnt > 0 && iov[0].iov_len == 0) { iov++; cnt--; }
+    if (cnt == 0)
+        return 0;
+    return _write(fd, iov[0].iov_base, static_cast<unsigned>(std::min<size_t>(iov[0].iov_len, INT_MAX)));
+#else
+    ssize_t r;
+    while ((r = ::writev(fd, iov, cnt)) < 0 && errno == EINTR) {}
+    return r;
+#endif
+}
+
+/* Write all of `iov[0], ..., iov[cnt-1]`. On failure, `iov` describes the data not written yet. */
+static bool fd_write_all(int fd, iovec * iov, int cnt) {
+    while (cnt > 0) {
+        if (iov[0].iov_len == 0) {
+            iov++; cnt--;
+            continue;
+        }
+        ssize_t n = fd_writev(fd, iov, cnt);
+        if (n < 0)
+            return false;
+        for (; cnt > 0 && static_cast<size_t>(n) >= iov[0].iov_len; iov++, cnt--) {
+            n -= iov[0].iov_len;
+            iov[0].iov_len = 0;
+        }
+        if (cnt > 0) {
+            iov[0].iov_base = static_cast<char *>(iov[0].iov_base) + n;
+            iov[0].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static int64 fd_seek(int fd, int64 off, int whence) {
+#ifdef LEAN_WINDOWS
+    return _lseeki64(fd, off, whence);
+#else
+    return lseek(fd, off, whence);
+#endif
+}
+
+static constexpr size_t g_io_buffer_size = 64 * 1024;
+
+/* A handle to a file, pipe, or standard stream. We do not use `FILE` so that we control the buffer: lines are
+   split with `memchr` directly in the buffer, large reads and writes bypass it (using `readv`/`writev` to combine
+   them with the buffer contents), and reads can fill an existing `ByteArray`.
+
+   The buffer contains either input read ahead, `m_buf[m_rpos, m_rend)`, or output not written yet,
+   `m_buf[0, m_wend)`, never both. All fields are protected by `m_mutex`. */
+struct io_handle {
+    mutex  m_mutex;
+    int    m_fd;
+    /* The C stream of a standard stream. Output to stdout and stderr goes through it so that it is not reordered
+       with output of C and C++ code, and stdout is flushed before reading from stdin, as in C. */
+    FILE * m_std;
+    bool   m_eof  = false;
+    char * m_buf  = nullptr; // allocated on first use
+    size_t m_rpos = 0;
+    size_t m_rend = 0;
+    size_t m_wend = 0;
+
+    io_handle(int fd, FILE * std): m_fd(fd), m_std(std) {}
+    ~io_handle() { free(m_buf); }
+
+    char * buffer() {
+        if (!m_buf)
+            m_buf = static_cast<char *>(malloc(g_io_buffer_size));
+        return m_buf;
+    }
+
+    size_t buffered_input() const { return m_rend - m_rpos; }
+
+    bool flush_output() {
+        if (m_std) {
+            // `fflush` is undefined on input streams
+            return m_std == stdin || std::fflush(m_std) == 0;
+        }
+        if (m_wend == 0)
+            return true;
+        iovec iov{m_buf, m_wend};
+        bool ok = fd_write_all(m_fd, &iov, 1);
+        // keep output that could not be written
+        memmove(m_buf, iov.iov_base, iov.iov_len);
+        m_wend = iov.iov_len;
+        return ok;
+    }
+
+    /* Drop input read ahead, moving the file position back to the logical position. Fails silently on pipes, where
+       the input is lost as with `FILE`. */
+    void discard_input() {
+        if (buffered_input() > 0)
+            fd_seek(m_fd, -static_cast<int64>(buffered_input()), SEEK_CUR);
+        m_rpos = m_rend = 0;
+    }
+
+    bool write(char const * data, size_t n) {
+        if (m_std)
+            return std::fwrite(data, 1, n, m_std) == n;
+        discard_input();
+        if (m_wend + n < g_io_buffer_size) {
+            memcpy(buffer() + m_wend, data, n);
+            m_wend += n;
+            return true;
+        }
+        // write the buffer and `data` with a single system call
+        iovec iov[2] = {{m_buf, m_wend}, {const_cast<char *>(data), n}};
+        bool ok = fd_write_all(m_fd, iov, 2);
+        m_wend = 0;
+        if (!ok && iov[0].iov_len > 0) {
+            memmove(m_buf, iov[0].iov_base, iov[0].iov_len);
+            m_wend = iov[0].iov_len;
+        }
+        return ok;
+    }
+
+    /* Refill the empty buffer. Returns the number of bytes read, `0` at the end of the file. */
+    ssize_t fill() {
+        lean_assert(buffered_input() == 0);
+        if (!flush_output())
+            return -1;
+        if (m_std == stdin)
+            std::fflush(stdout);
+        ssize_t n = fd_read(m_fd, buffer(), g_io_buffer_size);
+        if (n > 0) {
+            m_rpos = 0;
+            m_rend = n;
+        }
+        return n;
+    }
+
+    /* Read `n` bytes into `dst`, or fewer at the end of the file. Returns `-1` if no bytes could be read due to an
+       error. */
+    ssize_t read(char * dst, size_t n) {
+        size_t got = std::min(n, buffered_input());
+        if (got > 0) {
+            memcpy(dst, m_buf + m_rpos, got);
+            m_rpos += got;
+        }
+        while (got < n) {
+            if (!flush_output())
+                return got > 0 ? got : -1;
+            if (m_std == stdin)
+                std::fflush(stdout);
+            ssize_t r;
+            if (n - got >= g_io_buffer_size) {
+                // large reads go directly to `dst`
+                r = fd_read(m_fd, dst + got, n - got);
+            } else {
+                // read ahead into the buffer in the same system call
+                iovec iov[2] = {{dst + got, n - got}, {buffer(), g_io_buffer_size}};
+                r = fd_readv(m_fd, iov, 2);
+                if (r > static_cast<ssize_t>(n - got)) {
+                    m_rpos = 0;
+                    m_rend = r - (n - got);
+                    r = n - got;
+                }
+            }
+            if (r < 0)
+                return got > 0 ? got : -1;
+            if (r == 0) {
+                m_eof = got > 0;
+                return got;
+            }
+            got += r;
+        }
+        return got;
+    }
+};
+
+static void io_handle_finalizer(void * p) {
     // There is no sensible way to handle errors here; in particular, we should
     // not panic as finalizing a handle that already is in an invalid state
     // (broken pipe etc.) should work and not terminate the process. The same
     // decision was made for `std::fs::File` in the Rust stdlib.
-    fclose(static_cast<FILE *>(h));
+    io_handle * h = static_cast<io_handle *>(p);
+    h->flush_output();
+#ifdef LEAN_WINDOWS
+    _close(h->m_fd);
+#else
+    close(h->m_fd);
+#endif
+    delete h;
 }
 
 static void io_handle_foreach(void * /* mod */, b_obj_arg /* fn */) {
 }
 
-lean_object * io_wrap_handle(FILE *hfile) {
-    return lean_alloc_external(g_io_handle_external_class, hfile);
+lean_object * io_wrap_fd(int fd) {
+    return lean_alloc_external(g_io_handle_external_class, new io_handle(fd, nullptr));
+}
+
+static lean_object * io_wrap_std_stream(FILE * fp) {
+#ifdef LEAN_WINDOWS
+    int fd = _fileno(fp);
+#else
+    int fd = fileno(fp);
+#endif
+    return lean_alloc_external(g_io_handle_external_class, new io_handle(fd, fp));
 }
 
 extern "C" obj_res lean_stream_of_handle(obj_arg h);
@@ -151,8 +375,8 @@ extern "C" LEAN_EXPORT obj_res lean_get_set_stderr(obj_arg h, obj_arg /* w */) {
     return io_result_mk_ok(r);
 }
 
-static FILE * io_get_handle(lean_object * hfile) {
-    return static_cast<FILE *>(lean_get_external_data(hfile));
+static io_handle * io_get_handle(lean_object * hfile) {
+    return static_cast<io_handle *>(lean_get_external_data(hfile));
 }
 
 extern "C" LEAN_EXPORT obj_res lean_decode_io_error(int errnum, b_obj_arg fname) {
@@ -283,29 +507,16 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_mk(b_obj_arg filename, uint8
     if (fd == -1) {
         return io_result_mk_error(decode_io_error(errno, filename));
     }
-    char const * fp_mode;
-    switch (mode) {
-    case 0: fp_mode = "r"; break;  // read
-    case 1: fp_mode = "w"; break;  // write
-    case 2: fp_mode = "w"; break;  // writeNew
-    case 3: fp_mode = "r+"; break;  // readWrite
-    case 4: fp_mode = "a"; break;  // append
-    }
-    FILE * fp = fdopen(fd, fp_mode);
-    if (!fp) {
-        return io_result_mk_error(decode_io_error(errno, filename));
-    } else {
-        return io_result_mk_ok(io_wrap_handle(fp));
-    }
+    return io_result_mk_ok(io_wrap_fd(fd));
 }
 
 #ifdef LEAN_WINDOWS
 
-static inline HANDLE win_handle(FILE * fp) {
+static inline HANDLE win_handle(io_handle * h) {
 #ifdef q4_WCE
-    return (HANDLE)_fileno(fp);
+    return (HANDLE)h->m_fd;
 #else
-    return (HANDLE)_get_osfhandle(_fileno(fp));
+    return (HANDLE)_get_osfhandle(h->m_fd);
 #endif
 }
 
@@ -357,8 +568,7 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_unlock(b_obj_arg h, obj_arg /
 
 /* Handle.lock : (@& Handle) → (exclusive : Bool) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_lock(b_obj_arg h,  uint8_t x, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (!flock(fileno(fp), x ? LOCK_EX : LOCK_SH)) {
+    if (!flock(io_get_handle(h)->m_fd, x ? LOCK_EX : LOCK_SH)) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
@@ -367,8 +577,7 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_lock(b_obj_arg h,  uint8_t x,
 
 /* Handle.tryLock : (@& Handle) → (exclusive : Bool) → IO Bool */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_try_lock(b_obj_arg h, uint8_t x, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (!flock(fileno(fp), (x ? LOCK_EX : LOCK_SH) | LOCK_NB)) {
+    if (!flock(io_get_handle(h)->m_fd, (x ? LOCK_EX : LOCK_SH) | LOCK_NB)) {
         return io_result_mk_ok(box(1));
     } else {
         if (errno == EWOULDBLOCK) {
@@ -381,8 +590,7 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_try_lock(b_obj_arg h, uint8_t
 
 /* Handle.unlock : (@& Handle) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_unlock(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (!flock(fileno(fp), LOCK_UN)) {
+    if (!flock(io_get_handle(h)->m_fd, LOCK_UN)) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
@@ -393,14 +601,16 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_unlock(b_obj_arg h, obj_arg /
 
 /* Handle.isEof : (@& Handle) → BaseIO Bool */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_is_eof(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    return io_result_mk_ok(box(std::feof(fp) != 0));
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    return io_result_mk_ok(box(hd->m_eof));
 }
 
 /* Handle.flush : (@& Handle) → IO Bool */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_flush(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (!std::fflush(fp)) {
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    if (hd->flush_output()) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
@@ -409,8 +619,11 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_flush(b_obj_arg h, obj_arg /*
 
 /* Handle.rewind : (@& Handle) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_rewind(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (!std::fseek(fp, 0, SEEK_SET)) {
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    hd->m_rpos = hd->m_rend = 0;
+    hd->m_eof  = false;
+    if (hd->flush_output() && fd_seek(hd->m_fd, 0, SEEK_SET) == 0) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
@@ -419,11 +632,16 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_rewind(b_obj_arg h, obj_arg /
 
 /* Handle.truncate : (@& Handle) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_truncate(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    hd->discard_input();
+    if (!hd->flush_output())
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    int64 pos = fd_seek(hd->m_fd, 0, SEEK_CUR);
 #ifdef LEAN_WINDOWS
-    if (!_chsize_s(_fileno(fp), _ftelli64(fp))) {
+    if (pos >= 0 && !_chsize_s(hd->m_fd, pos)) {
 #else
-    if (!ftruncate(fileno(fp), ftello(fp))) {
+    if (pos >= 0 && !ftruncate(hd->m_fd, pos)) {
 #endif
         return io_result_mk_ok(box(0));
     } else {
@@ -433,14 +651,11 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_truncate(b_obj_arg h, obj_arg
 
 /* Handle.read : (@& Handle) → USize → IO ByteArray */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_read(b_obj_arg h, usize nbytes, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
+    io_handle * hd = io_get_handle(h);
     obj_res res = lean_alloc_sarray(1, 0, nbytes);
-    usize n = std::fread(lean_sarray_cptr(res), 1, nbytes, fp);
-    if (n > 0) {
-        lean_sarray_set_size(res, n);
-        return io_result_mk_ok(res);
-    } else if (feof(fp)) {
-        clearerr(fp);
+    unique_lock<mutex> lock(hd->m_mutex);
+    ssize_t n = hd->read(reinterpret_cast<char *>(lean_sarray_cptr(res)), nbytes);
+    if (n >= 0) {
         lean_sarray_set_size(res, n);
         return io_result_mk_ok(res);
     } else {
@@ -449,61 +664,419 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_read(b_obj_arg h, usize nbyte
     }
 }
 
+/* Handle.readInto : (@& Handle) → ByteArray → USize → IO ByteArray */
+extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_read_into(b_obj_arg h, obj_arg buf, usize nbytes, obj_arg /* w */) {
+    io_handle * hd = io_get_handle(h);
+    if (!lean_is_exclusive(buf) || lean_sarray_capacity(buf) < nbytes) {
+        dec(buf);
+        buf = lean_alloc_sarray(1, 0, nbytes);
+    }
+    unique_lock<mutex> lock(hd->m_mutex);
+    ssize_t n = hd->read(reinterpret_cast<char *>(lean_sarray_cptr(buf)), nbytes);
+    if (n >= 0) {
+        lean_sarray_set_size(buf, n);
+        return io_result_mk_ok(buf);
+    } else {
+        dec_ref(buf);
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
 /* Handle.write : (@& Handle) → (@& ByteArray) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_write(b_obj_arg h, b_obj_arg buf, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    usize n = lean_sarray_size(buf);
-    usize m = std::fwrite(lean_sarray_cptr(buf), 1, n, fp);
-    if (m == n) {
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    if (hd->write(reinterpret_cast<char const *>(lean_sarray_cptr(buf)), lean_sarray_size(buf))) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
     }
 }
 
+/* The line is truncated at the first '\0' character. */
+static obj_res mk_line(char const * s, size_t n) {
+    if (char const * z = static_cast<char const *>(memchr(s, 0, n)))
+        n = z - s;
+    return lean_mk_string_from_bytes(s, n);
+}
+
 /*
   Handle.getLine : (@& Handle) → IO Unit
   The line returned by `lean_io_prim_handle_get_line`
   is truncated at the first '\0' character and the
   rest of the line is discarded. */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_get_line(b_obj_arg h, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    const int buf_sz = 64;
-    char buf_str[buf_sz]; // NOLINT
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    // only used for lines crossing the end of the buffer
     std::string result;
-    bool first = true;
     while (true) {
-        char * out = std::fgets(buf_str, buf_sz, fp);
-        if (out != nullptr) {
-            if (strlen(buf_str) < buf_sz-1 || buf_str[buf_sz-2] == '\n') {
-                if (first) {
-                    return io_result_mk_ok(mk_string(out));
-                } else {
-                    result.append(out);
-                    return io_result_mk_ok(mk_string(result));
-                }
+        if (hd->buffered_input() == 0) {
+            ssize_t n = hd->fill();
+            if (n < 0) {
+                return io_result_mk_error(decode_io_error(errno, nullptr));
+            } else if (n == 0) {
+                hd->m_eof = !result.empty();
+                return io_result_mk_ok(mk_line(result.data(), result.size()));
             }
-            result.append(out);
-        } else if (std::feof(fp)) {
-            clearerr(fp);
-            return io_result_mk_ok(mk_string(result));
-        } else {
-            return io_result_mk_error(decode_io_error(errno, nullptr));
         }
-        first = false;
+        char const * s  = hd->m_buf + hd->m_rpos;
+        size_t avail    = hd->buffered_input();
+        char const * nl = static_cast<char const *>(memchr(s, '\n', avail));
+        size_t len      = nl ? nl - s + 1 : avail;
+        hd->m_rpos += len;
+        if (nl) {
+            hd->m_eof = false;
+            if (result.empty())
+                return io_result_mk_ok(mk_line(s, len));
+            result.append(s, len);
+            return io_result_mk_ok(mk_line(result.data(), result.size()));
+        }
+        result.append(s, len);
     }
 }
 
 /* Handle.putStr : (@& Handle) → (@& String) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_put_str(b_obj_arg h, b_obj_arg s, obj_arg /* w */) {
-    FILE * fp = io_get_handle(h);
-    if (std::fputs(lean_string_cstr(s), fp) != EOF) {
+    io_handle * hd = io_get_handle(h);
+    unique_lock<mutex> lock(hd->m_mutex);
+    if (hd->write(lean_string_cstr(s), lean_string_size(s) - 1)) {
         return io_result_mk_ok(box(0));
     } else {
         return io_result_mk_error(decode_io_error(errno, nullptr));
     }
 }
 
+/* (h : Handle) (nbytes : USize) : IO ByteArray */
+static obj_res io_handle_read_fn(obj_arg h, obj_arg nbytes, obj_arg w) {
+    obj_res r = lean_io_prim_handle_read(h, lean_unbox_usize(nbytes), w);
+    dec(h);
+    dec(nbytes);
+    return r;
+}
+
+/* (h : Handle) (buf : ByteArray) : IO Unit */
+static obj_res io_handle_write_fn(obj_arg h, obj_arg buf, obj_arg w) {
+    obj_res r = lean_io_prim_handle_write(h, buf, w);
+    dec(h);
+    dec(buf);
+    return r;
+}
+
+static obj_res io_handle_read_dedicated(b_obj_arg h, usize nbytes) {
+    object * c = alloc_closure(io_handle_read_fn, 2);
+    inc(h);
+    closure_set(c, 0, h);
+    closure_set(c, 1, lean_box_usize(nbytes));
+    return io_dedicated_task(c);
+}
+
+static obj_res io_handle_write_dedicated(b_obj_arg h, obj_arg buf) {
+    object * c = alloc_closure(io_handle_write_fn, 2);
+    inc(h);
+    closure_set(c, 0, h);
+    closure_set(c, 1, buf);
+    return io_dedicated_task(c);
+}
+
+/* Handle.readAsync : (@& Handle) → USize → BaseIO (Task (Except IO.Error ByteArray)) */
+extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_read_async(b_obj_arg h, usize nbytes, obj_arg /* w */) {
+#ifdef LEAN_IO_REACTOR
+    io_handle * hd = io_get_handle(h);
+    {
+        unique_lock<mutex> lock(hd->m_mutex);
+        usize buffered = hd->buffered_input();
+        if (buffered > 0) {
+            // Input already read into the buffer must be consumed first. We return only the buffered part so that
+            // we do not block.
+            object * buf = lean_alloc_sarray(1, 0, std::min(nbytes, buffered));
+            hd->read(reinterpret_cast<char *>(lean_sarray_cptr(buf)), lean_sarray_capacity(buf));
+            lean_sarray_set_size(buf, lean_sarray_capacity(buf));
+            return io_result_mk_ok(lean_task_pure(mk_except_ok(buf)));
+        }
+    }
+    object * promise = promise_new();
+    object * buf     = lean_alloc_sarray(1, 0, nbytes);
+    inc(promise);
+    int err = reactor_watch(hd->m_fd, EPOLLIN, [=](int fd) {
+        ssize_t n = ::read(fd, lean_sarray_cptr(buf), nbytes);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return false;
+        if (n < 0) {
+            dec(buf);
+            promise_resolve(promise, mk_except_error(decode_io_error(errno, nullptr)));
+        } else {
+            lean_sarray_set_size(buf, n);
+            promise_resolve(promise, mk_except_ok(buf));
+        }
+        return true;
+    });
+    if (err == EPERM) {
+        // regular files cannot be watched, but reading from them does not wait for other processes either
+        dec(buf);
+        promise_resolve(promise, io_result_to_except(lean_io_prim_handle_read(h, nbytes, io_mk_world())));
+    } else if (err != 0) {
+        // e.g. a blocking socket, which cannot be made non-blocking without affecting other users
+        dec(buf);
+        dec(promise);
+        dec(promise);
+        return io_result_mk_ok(io_handle_read_dedicated(h, nbytes));
+    }
+    return io_result_mk_ok(promise);
+#else
+    return io_result_mk_ok(io_handle_read_dedicated(h, nbytes));
+#endif
+}
+
+/* Handle.writeAsync : (@& Handle) → ByteArray → BaseIO (Task (Except IO.Error Unit)) */
+extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_write_async(b_obj_arg h, obj_arg buf, obj_arg /* w */) {
+#ifdef LEAN_IO_REACTOR
+    io_handle * hd = io_get_handle(h);
+    {
+        unique_lock<mutex> lock(hd->m_mutex);
+        hd->discard_input();
+        if (!hd->flush_output()) {
+            dec(buf);
+            return io_result_mk_ok(lean_task_pure(mk_except_error(decode_io_error(errno, nullptr))));
+        }
+    }
+    usize size = lean_sarray_size(buf);
+    if (size == 0) {
+        dec(buf);
+        return io_result_mk_ok(lean_task_pure(mk_except_ok(box(0))));
+    }
+    object * promise = promise_new();
+    inc(promise);
+    // `buf` is released on the reactor thread
+    lean_mark_mt(buf);
+    usize pos = 0;
+    int err = reactor_watch(hd->m_fd, EPOLLOUT, [=](int fd) mutable {
+        ssize_t n = ::write(fd, lean_sarray_cptr(buf) + pos, size - pos);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return false;
+        if (n < 0) {
+            dec(buf);
+            promise_resolve(promise, mk_except_error(decode_io_error(errno, nullptr)));
+            return true;
+        }
+        pos += n;
+        if (pos < size)
+            return false;
+        dec(buf);
+        promise_resolve(promise, mk_except_ok(box(0)));
+        return true;
+    });
+    if (err == EPERM) {
+        object * r = lean_io_prim_handle_write(h, buf, io_mk_world());
+        dec(buf);
+        promise_resolve(promise, io_result_to_except(r));
+    } else if (err != 0) {
+        // e.g. a blocking socket, which cannot be made non-blocking without affecting other users
+        dec(promise);
+        dec(promise);
+        return io_result_mk_ok(io_handle_write_dedicated(h, buf));
+    }
+    return io_result_mk_ok(promise);
+#else
+    return io_result_mk_ok(io_handle_write_dedicated(h, buf));
+#endif
+}
+
+/* `IO.FS.mmap` uses `mmap` if it is enabled by the `MMAP` build option and available. */
+#if defined(LEAN_MMAP) && !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#define LEAN_MAPPED_FILE_MMAP
+#endif
+
+/* A file mapped read-only into memory. Its contents are exposed as a `ByteArray` and a `String` whose data is the
+   mapping itself, so that large inputs are not copied. Like the objects of a compacted region, the views are
+   persistent objects (`m_rc == 0`), so that reference counting does not touch them; they are only valid as long as
+   the `mapped_file` is alive.
+
+   As the headers of `ByteArray` and `String` objects differ, each view is a separate mapping of the file, with the
+   object header at the end of the page before it. Where `mmap` is not available, the views are copies of the file. */
+struct mapped_file {
+    struct region {
+        char * m_base;
+        size_t m_size;
+    };
+    mutex               m_mutex;
+    int                 m_fd;
+    size_t              m_size;
+    object *            m_bytes  = nullptr;
+    bool                m_string_done = false;
+    object *            m_string = nullptr; // `nullptr` if the file is not valid UTF-8
+    std::vector<region> m_regions;
+
+    mapped_file(int fd, size_t size): m_fd(fd), m_size(size) {}
+
+    ~mapped_file() {
+        for (region const & r : m_regions) {
+#ifdef LEAN_MAPPED_FILE_MMAP
+            munmap(r.m_base, r.m_size);
+#else
+            free(r.m_base);
+#endif
+        }
+#ifdef LEAN_WINDOWS
+        _close(m_fd);
+#else
+        close(m_fd);
+#endif
+    }
+
+    /* Map the file so that it is preceded by `header_size` writable bytes and followed by a zero byte. Returns a
+       pointer to the contents, or `nullptr` on failure. */
+    char * map_view(size_t header_size) {
+#ifdef LEAN_MAPPED_FILE_MMAP
+        size_t page = sysconf(_SC_PAGESIZE);
+        lean_assert(header_size <= page);
+        // the part of the last page after the end of the file is filled with zeros; we reserve an extra page in
+        // case the size of the file is a multiple of the page size
+        size_t total = page + (m_size / page + 1) * page;
+        void * base  = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        char * data = static_cast<char *>(base) + page;
+        if (m_size > 0 && mmap(data, m_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, m_fd, 0) == MAP_FAILED) {
+            munmap(base, total);
+            return nullptr;
+        }
+        m_regions.push_back(region{static_cast<char *>(base), total});
+        return data;
+#else
+        char * base = static_cast<char *>(malloc(header_size + m_size + 1));
+        if (!base)
+            return nullptr;
+        m_regions.push_back(region{base, header_size + m_size + 1});
+        char * data = base + header_size;
+        size_t pos  = 0;
+        fd_seek(m_fd, 0, SEEK_SET);
+        while (pos < m_size) {
+            ssize_t n = fd_read(m_fd, data + pos, m_size - pos);
+            if (n <= 0)
+                return nullptr;
+            pos += n;
+        }
+        data[m_size] = 0;
+        return data;
+#endif
+    }
+
+    /* Make the header written in front of `data` read-only as well. */
+    void seal(char * data) {
+#ifdef LEAN_MAPPED_FILE_MMAP
+        size_t page = sysconf(_SC_PAGESIZE);
+        mprotect(data - page, page, PROT_READ);
+#else
+        (void)data;
+#endif
+    }
+};
+
+static lean_external_class * g_mapped_file_external_class = nullptr;
+
+static void mapped_file_finalizer(void * m) {
+    delete static_cast<mapped_file *>(m);
+}
+
+static void mapped_file_foreach(void * /* mod */, b_obj_arg /* fn */) {
+}
+
+static mapped_file * to_mapped_file(b_obj_arg m) {
+    return static_cast<mapped_file *>(lean_get_external_data(m));
+}
+
+/* mmap : (@& FilePath) → IO MappedFile */
+extern "C" LEAN_EXPORT obj_res lean_io_mmap(b_obj_arg fname, obj_arg /* w */) {
+#ifdef LEAN_WINDOWS
+    int fd = open(string_cstr(fname), O_RDONLY | O_BINARY | O_NOINHERIT);
+#else
+    int fd = open(string_cstr(fname), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd == -1)
+        return io_result_mk_error(decode_io_error(errno, fname));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+#ifdef LEAN_WINDOWS
+        _close(fd);
+#else
+        close(fd);
+#endif
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    mapped_file * m = new mapped_file(fd, st.st_size);
+    object * r = lean_alloc_external(g_mapped_file_external_class, m);
+    char * data = m->map_view(sizeof(lean_sarray_object));
+    if (!data) {
+        int err = errno;
+        dec_ref(r);
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    lean_sarray_object * o = reinterpret_cast<lean_sarray_object *>(data - sizeof(lean_sarray_object));
+    lean_set_non_heap_header_for_big(reinterpret_cast<object *>(o), LeanScalarArray, 1);
+    o->m_size     = m->m_size;
+    o->m_capacity = m->m_size;
+    m->seal(data);
+    m->m_bytes = reinterpret_cast<object *>(o);
+    return io_result_mk_ok(r);
+}
+
+/* MappedFile.bytes : (@& MappedFile) → ByteArray */
+extern "C" LEAN_EXPORT obj_res lean_io_mapped_file_bytes(b_obj_arg m) {
+    return to_mapped_file(m)->m_bytes;
+}
+
+/* MappedFile.toString? : (@& MappedFile) → Option String */
+extern "C" LEAN_EXPORT obj_res lean_io_mapped_file_to_string(b_obj_arg m) {
+    mapped_file * mf = to_mapped_file(m);
+    unique_lock<mutex> lock(mf->m_mutex);
+    if (!mf->m_string_done) {
+        mf->m_string_done = true;
+        size_t len;
+        if (!validate_utf8(reinterpret_cast<char const *>(lean_sarray_cptr(mf->m_bytes)), mf->m_size, len))
+            return box(0);
+        char * data = mf->map_view(sizeof(lean_string_object));
+        if (!data)
+            lean_internal_panic_out_of_memory();
+        lean_string_object * o = reinterpret_cast<lean_string_object *>(data - sizeof(lean_string_object));
+        lean_set_non_heap_header_for_big(reinterpret_cast<object *>(o), LeanString, 0);
+        o->m_size     = mf->m_size + 1;
+        o->m_capacity = mf->m_size + 1;
+        o->m_length   = len;
+        mf->seal(data);
+        mf->m_string = reinterpret_cast<object *>(o);
+    }
+    if (!mf->m_string)
+        return box(0);
+    return mk_option_some(mf->m_string);
+}
+
+#ifndef LEAN_IO_REACTOR
+/* (ms : UInt32) (promise : Promise Unit) : BaseIO Unit */
+static obj_res io_sleep_fn(obj_arg ms, obj_arg promise, obj_arg) {
+    this_thread::sleep_for(chrono::milliseconds(unbox_uint32(ms)));
+    promise_resolve(promise, box(0));
+    return io_result_mk_ok(box(0));
+}
+#endif
+
+/* sleepAsync : UInt32 → BaseIO (Task Unit) */
+extern "C" LEAN_EXPORT obj_res lean_io_sleep_async(uint32 ms, obj_arg /* w */) {
+    object * promise = promise_new();
+    inc(promise);
+#ifdef LEAN_IO_REACTOR
+    reactor_add_timer(ms, [=]() { promise_resolve(promise, box(0)); });
+#else
+    object * c = alloc_closure(io_sleep_fn, 2);
+    closure_set(c, 0, box_uint32(ms));
+    closure_set(c, 1, promise);
+    // the task is kept alive until it has run
+    dec(io_dedicated_task(c));
+#endif
+    return io_result_mk_ok(promise);
+}
+
 /* monoMsNow : BaseIO Nat */
 extern "C" LEAN_EXPORT obj_res lean_io_mono_ms_now(obj_arg /* w */) {
     static_assert(sizeof(std::chrono::milliseconds::rep) <= sizeof(uint64), "size of std::chrono::nanoseconds::rep may not exceed 64");
@@ -615,6 +1188,11 @@ extern "C" LEAN_EXPORT obj_res lean_io_get_num_heartbeats(obj_arg /* w */) {
     return io_result_mk_ok(lean_uint64_to_nat(get_num_heartbeats()));
 }
 
+/* trimHeap : BaseIO Nat */
+extern "C" LEAN_EXPORT obj_res lean_io_trim_heap(obj_arg /* w */) {
+    return io_result_mk_ok(lean_usize_to_nat(lean_heap_trim()));
+}
+
 extern "C" LEAN_EXPORT obj_res lean_io_getenv(b_obj_arg env_var, obj_arg) {
 #if defined(LEAN_EMSCRIPTEN)
     // HACK(WN): getenv doesn't seem to work in Emscripten even though it should
@@ -1061,16 +1639,17 @@ void initialize_io() {
     g_io_error_nullptr_read = lean_mk_io_user_error(mk_string("null reference read"));
     mark_persistent(g_io_error_nullptr_read);
     g_io_handle_external_class = lean_register_external_class(io_handle_finalizer, io_handle_foreach);
+    g_mapped_file_external_class = lean_register_external_class(mapped_file_finalizer, mapped_file_foreach);
 #if defined(LEAN_WINDOWS)
     _setmode(_fileno(stdout), _O_BINARY);
     _setmode(_fileno(stderr), _O_BINARY);
     _setmode(_fileno(stdin), _O_BINARY);
 #endif
-    g_stream_stdout = lean_stream_of_handle(io_wrap_handle(stdout));
+    g_stream_stdout = lean_stream_of_handle(io_wrap_std_stream(stdout));
     mark_persistent(g_stream_stdout);
-    g_stream_stderr = lean_stream_of_handle(io_wrap_handle(stderr));
+    g_stream_stderr = lean_stream_of_handle(io_wrap_std_stream(stderr));
     mark_persistent(g_stream_stderr);
-    g_stream_stdin  = lean_stream_of_handle(io_wrap_handle(stdin));
+    g_stream_stdin  = lean_stream_of_handle(io_wrap_std_stream(stdin));
     mark_persistent(g_stream_stdin);
 #if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
     // We want to handle SIGPIPE ourselves
@@ -15,7 +15,8 @@ inline lean_obj_res io_result_mk_error(lean_obj_arg e) { return lean_io_result_m
 LEAN_EXPORT lean_obj_res io_result_mk_error(char const * msg);
 LEAN_EXPORT lean_obj_res io_result_mk_error(std::string const & msg);
 inline lean_obj_res decode_io_error(int errnum, b_lean_obj_arg fname) { return lean_decode_io_error(errnum, fname); }
-LEAN_EXPORT lean_obj_res io_wrap_handle(FILE * hfile);
+/* Create a `IO.FS.Handle` owning the file descriptor `fd`. */
+LEAN_EXPORT lean_obj_res io_wrap_fd(int fd);
 void initialize_io();
 void finalize_io();
 }
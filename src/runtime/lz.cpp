@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <vector>
+#include <cstring>
+#include "runtime/lz.h"
+#include "runtime/object.h"
+
+/*
+  The compressed data is a sequence of
+  - a token byte whose high/low nibble is the number of literals / the match length minus `LEAN_LZ_MIN_MATCH`,
+    where `15` means that further bytes follow, each adding up to 255 until a byte smaller than 255,
+  - the literals,
+  - a 2 byte little endian offset of the match, followed by the further match length bytes.
+  The last sequence consists of literals only.
+*/
+#define LEAN_LZ_MIN_MATCH  4
+#define LEAN_LZ_MAX_OFFSET 65535
+#define LEAN_LZ_HASH_BITS  16
+/* number of bytes at the end of the input that are always emitted as literals */
+#define LEAN_LZ_LAST_LITERALS 8
+
+namespace lean {
+static inline uint32_t lz_read32(char const * p) {
+    uint32_t r;
+    memcpy(&r, p, sizeof(r));
+    return r;
+}
+
+static inline unsigned lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LEAN_LZ_HASH_BITS);
+}
+
+static inline char * lz_write_len(char * op, size_t len) {
+    while (len >= 255) {
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+}
+
+static char * lz_write_seq(char * op, char const * lit, size_t num_lits, size_t offset, size_t match_len) {
+    unsigned char * token = reinterpret_cast<unsigned char *>(op++);
+    *token = static_cast<unsigned char>((num_lits >= 15 ? 15 : num_lits) << 4);
+    if (num_lits >= 15)
+        op = lz_write_len(op, num_lits - 15);
+    memcpy(op, lit, num_lits);
+    op += num_lits;
+    if (match_len == 0)
+        return op;
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    size_t len = match_len - LEAN_LZ_MIN_MATCH;
+    *token |= len >= 15 ? 15 : len;
+    if (len >= 15)
+        op = lz_write_len(op, len - 15);
+    return op;
+}
+
+size_t lz_compress_bound(size_t sz) {
+    return sz + sz / 255 + 16;
+}
+
+size_t lz_compress(char const * src, size_t sz, char * dst) {
+    char * op     = dst;
+    size_t anchor = 0;
+    if (sz > LEAN_LZ_MIN_MATCH + LEAN_LZ_LAST_LITERALS) {
+        std::vector<uint32_t> table(1u << LEAN_LZ_HASH_BITS, 0);
+        size_t limit = sz - LEAN_LZ_LAST_LITERALS;
+        size_t ip    = 0;
+        while (ip + LEAN_LZ_MIN_MATCH <= limit) {
+            uint32_t v   = lz_read32(src + ip);
+            unsigned h   = lz_hash(v);
+            // positions are stored modulo 2^32, which is enough to find the previous position at a small distance
+            size_t dist  = static_cast<uint32_t>(static_cast<uint32_t>(ip) - table[h]);
+            table[h]     = static_cast<uint32_t>(ip);
+            size_t ref   = ip - dist;
+            if (dist != 0 && dist <= ip && dist <= LEAN_LZ_MAX_OFFSET && lz_read32(src + ref) == v) {
+                size_t len = LEAN_LZ_MIN_MATCH;
+                while (ip + len < limit && src[ref + len] == src[ip + len])
+                    len++;
+                op     = lz_write_seq(op, src + anchor, ip - anchor, ip - ref, len);
+                ip    += len;
+                anchor = ip;
+            } else {
+                // skip faster over incompressible data
+                ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+    }
+    op = lz_write_seq(op, src + anchor, sz - anchor, 0, 0);
+    return op - dst;
+}
+
+static inline bool lz_read_len(unsigned char const * & ip, unsigned char const * end, size_t & len) {
+    unsigned char b;
+    do {
+        if (ip == end)
+            return false;
+        b    = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(char const * src, size_t sz, char * dst, size_t dst_sz) {
+    unsigned char const * ip  = reinterpret_cast<unsigned char const *>(src);
+    unsigned char const * end = ip + sz;
+    char * op                 = dst;
+    char * op_end             = dst + dst_sz;
+    while (ip < end) {
+        unsigned token  = *ip++;
+        size_t num_lits = token >> 4;
+        if (num_lits == 15 && !lz_read_len(ip, end, num_lits))
+            return false;
+        if (static_cast<size_t>(end - ip) < num_lits || static_cast<size_t>(op_end - op) < num_lits)
+            return false;
+        memcpy(op, ip, num_lits);
+        ip += num_lits;
+        op += num_lits;
+        if (ip == end)
+            break; /* last sequence */
+        if (end - ip < 2)
+            return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !lz_read_len(ip, end, len))
+            return false;
+        len += LEAN_LZ_MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) || static_cast<size_t>(op_end - op) < len)
+            return false;
+        char const * ref = op - offset;
+        if (offset >= len) {
+            memcpy(op, ref, len);
+            op += len;
+        } else {
+            // overlapping match
+            for (size_t i = 0; i < len; i++)
+                *op++ = *ref++;
+        }
+    }
+    return op == op_end;
+}
+
+/* lzCompress (data : @& ByteArray) : ByteArray */
+extern "C" LEAN_EXPORT obj_res lean_lz_compress(b_obj_arg data) {
+    size_t sz = sarray_size(data);
+    object * r = alloc_sarray(1, 0, lz_compress_bound(sz));
+    lean_to_sarray(r)->m_size = lz_compress(reinterpret_cast<char const *>(sarray_cptr(data)), sz,
+                                            reinterpret_cast<char *>(sarray_cptr(r)));
+    return r;
+}
+
+/* lzDecompress? (data : @& ByteArray) (size : @& Nat) : Option ByteArray */
+extern "C" LEAN_EXPORT obj_res lean_lz_decompress(b_obj_arg data, b_obj_arg size) {
+    // every input byte produces at most 255 output bytes, so do not allocate for larger sizes
+    if (!is_scalar(size) || unbox(size) > (sarray_size(data) + 1) * 255)
+        return box(0);
+    size_t sz = unbox(size);
+    object * r = alloc_sarray(1, sz, sz);
+    if (!lz_decompress(reinterpret_cast<char const *>(sarray_cptr(data)), sarray_size(data),
+                       reinterpret_cast<char *>(sarray_cptr(r)), sz)) {
+        dec(r);
+        return box(0);
+    }
+    return mk_option_some(r);
+}
+}
@@ -0,0 +1,20 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <stddef.h>
+#include "lean/lean.h"
+
+namespace lean {
+/* Simple LZ77 codec using the LZ4 block format. It favors decompression speed over compression ratio. */
+
+/* Maximum size of the compressed representation of `sz` bytes. */
+LEAN_EXPORT size_t lz_compress_bound(size_t sz);
+/* Compress the `sz` bytes at `src` into `dst`, which must have room for `lz_compress_bound(sz)` bytes.
+   Return the size of the compressed data. */
+LEAN_EXPORT size_t lz_compress(char const * src, size_t sz, char * dst);
+/* Decompress the `sz` bytes at `src` into the `dst_sz` bytes at `dst`.
+   Return `false` if the input is malformed or does not decompress to exactly `dst_sz` bytes. */
+LEAN_EXPORT bool lz_decompress(char const * src, size_t sz, char * dst, size_t dst_sz);
+}
@@ -17,6 +17,7 @@ Revision History:
 
 --*/
 #include <stdint.h>
+#include <vector>
 #include "runtime/mpn.h"
 #include "runtime/debug.h"
 #include "runtime/buffer.h"
@@ -32,18 +33,16 @@ static const mpn_digit zero = 0;
 
 int mpn_compare(mpn_digit const * a, size_t const lnga,
                 mpn_digit const * b, size_t const lngb) {
-    int res = 0;
-
-    size_t j = max(lnga, lngb) - 1;
-    for (; j != (size_t)-1 && res == 0; j--) {
-        mpn_digit const & u_j = (j < lnga) ? a[j] : zero;
-        mpn_digit const & v_j = (j < lngb) ? b[j] : zero;
-        if (u_j > v_j)
-            res = 1;
-        else if (u_j < v_j)
-            res = -1;
-    }
-    return res;
+    // Digits beyond the length of the shorter operand decide unless they are zero,
+    // afterwards the first differing digit from the top does.
+    size_t j = max(lnga, lngb);
+    for (; j > lngb; j--)
+        if (a[j-1] != 0) return 1;
+    for (; j > lnga; j--)
+        if (b[j-1] != 0) return -1;
+    for (; j > 0; j--)
+        if (a[j-1] != b[j-1]) return a[j-1] > b[j-1] ? 1 : -1;
+    return 0;
 }
 
 void  mpn_add(mpn_digit const * a, size_t const lnga,
@@ -86,17 +85,125 @@ void mpn_sub(mpn_digit const * a, size_t const lnga,
     }
 }
 
-void mpn_mul(mpn_digit const * a, size_t const lnga,
-             mpn_digit const * b, size_t const lngb,
-             mpn_digit * c) {
+#define DIGIT_BITS (sizeof(mpn_digit)*8)
+#define HALF_BITS (sizeof(mpn_digit)*4)
+#define MASK_FIRST (~((mpn_digit)(-1) >> 1))
+#define FIRST_BITS(N, X) ((X) >> (DIGIT_BITS-(N)))
+#define LAST_BITS(N, X) (((X) << (DIGIT_BITS-(N))) >> (DIGIT_BITS-(N)))
+#define BASE ((mpn_double_digit)0x01 << DIGIT_BITS)
+
+/*
+   Crossover points (in digits) between the schoolbook algorithms and the
+   subquadratic ones. They were measured on x86-64 against the schoolbook
+   versions; the divide-and-conquer algorithms need them to be at least 4.
+*/
+#ifndef LEAN_MPN_KARATSUBA_THRESHOLD
+#define LEAN_MPN_KARATSUBA_THRESHOLD 24
+#endif
+#ifndef LEAN_MPN_TOOM3_THRESHOLD
+#define LEAN_MPN_TOOM3_THRESHOLD 256
+#endif
+#ifndef LEAN_MPN_DC_DIV_THRESHOLD
+#define LEAN_MPN_DC_DIV_THRESHOLD 48
+#endif
+#ifndef LEAN_MPN_DC_TO_STRING_THRESHOLD
+#define LEAN_MPN_DC_TO_STRING_THRESHOLD 32
+#endif
+
+class  mpn_buffer : public buffer<mpn_digit> {
+public:
+    mpn_buffer() : buffer<mpn_digit>() {}
+
+    mpn_buffer(size_t nsz, const mpn_digit & elem = 0):buffer<mpn_digit>() {
+        for (size_t i = 0; i < nsz; i++) push_back(elem);
+    }
+
+    void resize(size_t nsz, const mpn_digit & elem = 0) {
+        buffer<mpn_digit>::resize(static_cast<unsigned>(nsz), elem);
+    }
+
+    mpn_digit & operator[](size_t idx) {
+        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+    }
+
+    const mpn_digit & operator[](size_t idx) const {
+        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+    }
+};
+
+/* r[0..n) := a[0..n) + b[0..n), return the carry. `r` may alias `a` or `b`. */
+static mpn_digit add_n(mpn_digit * r, mpn_digit const * a, mpn_digit const * b, size_t n) {
+    mpn_double_digit t = 0;
+    for (size_t i = 0; i < n; i++) {
+        t += (mpn_double_digit)a[i] + (mpn_double_digit)b[i];
+        r[i] = (mpn_digit)t;
+        t >>= DIGIT_BITS;
+    }
+    return (mpn_digit)t;
+}
+
+/* r[0..n) := a[0..n) - b[0..n), return the borrow. `r` may alias `a` or `b`. */
+static mpn_digit sub_n(mpn_digit * r, mpn_digit const * a, mpn_digit const * b, size_t n) {
+    mpn_digit k = 0;
+    for (size_t i = 0; i < n; i++) {
+        mpn_double_digit t = (mpn_double_digit)a[i] - (mpn_double_digit)b[i] - (mpn_double_digit)k;
+        r[i] = (mpn_digit)t;
+        k = (t >> DIGIT_BITS) != 0;
+    }
+    return k;
+}
+
+/* r[0..n) += c, return the carry. */
+static mpn_digit add_1(mpn_digit * r, size_t n, mpn_digit c) {
+    for (size_t i = 0; i < n && c != 0; i++) {
+        r[i] += c;
+        c = r[i] < c;
+    }
+    return c;
+}
+
+/* r[0..n) -= c, return the borrow. */
+static mpn_digit sub_1(mpn_digit * r, size_t n, mpn_digit c) {
+    for (size_t i = 0; i < n && c != 0; i++) {
+        mpn_digit v = r[i];
+        r[i] = v - c;
+        c = v < c;
+    }
+    return c;
+}
+
+/* r[0..rn) += a[0..an) where an <= rn, return the carry. */
+static mpn_digit add_into(mpn_digit * r, size_t rn, mpn_digit const * a, size_t an) {
+    lean_assert(an <= rn);
+    return add_1(r + an, rn - an, add_n(r, r, a, an));
+}
+
+/* r[0..rn) -= a[0..an) where an <= rn, return the borrow. */
+static mpn_digit sub_into(mpn_digit * r, size_t rn, mpn_digit const * a, size_t an) {
+    lean_assert(an <= rn);
+    return sub_1(r + an, rn - an, sub_n(r, r, a, an));
+}
+
+/* r[0..n) -= a[0..n) * q, return the digit borrowed from r[n]. */
+static mpn_digit submul_1(mpn_digit * r, mpn_digit const * a, size_t n, mpn_digit q) {
+    mpn_digit k = 0;
+    for (size_t i = 0; i < n; i++) {
+        mpn_double_digit p = (mpn_double_digit)a[i] * (mpn_double_digit)q + (mpn_double_digit)k;
+        mpn_digit lo = (mpn_digit)p;
+        mpn_digit v  = r[i];
+        r[i] = v - lo;
+        k = (mpn_digit)(p >> DIGIT_BITS) + (v < lo);
+    }
+    return k;
+}
+
+static void mul_basecase(mpn_digit const * a, size_t const lnga,
+                         mpn_digit const * b, size_t const lngb,
+                         mpn_digit * c) {
     // Essentially Knuth's Algorithm M.
-    // Perhaps implement a more efficient version, see e.g., Knuth, Section 4.3.3.
     size_t i;
     mpn_digit k;
 
-#define DIGIT_BITS (sizeof(mpn_digit)*8)
-#define HALF_BITS (sizeof(mpn_digit)*4)
-
     for (unsigned i = 0; i < lnga; i++)
         c[i] = 0;
 
@@ -122,31 +229,235 @@ void mpn_mul(mpn_digit const * a, size_t const lnga,
     }
 }
 
-#define MASK_FIRST (~((mpn_digit)(-1) >> 1))
-#define FIRST_BITS(N, X) ((X) >> (DIGIT_BITS-(N)))
-#define LAST_BITS(N, X) (((X) << (DIGIT_BITS-(N))) >> (DIGIT_BITS-(N)))
-#define BASE ((mpn_double_digit)0x01 << DIGIT_BITS)
+static void mul(mpn_digit const * a, size_t lnga, mpn_digit const * b, size_t lngb, mpn_digit * c);
+
+/* r[0..xn) := |x[0..xn) - y[0..yn)| where yn <= xn, return true iff x < y. */
+static bool abs_diff(mpn_digit const * x, size_t xn, mpn_digit const * y, size_t yn, mpn_digit * r) {
+    lean_assert(yn <= xn);
+    if (mpn_compare(x, xn, y, yn) >= 0) {
+        for (size_t i = 0; i < xn; i++) r[i] = x[i];
+        sub_into(r, xn, y, yn);
+        return false;
+    } else {
+        for (size_t i = 0; i < xn; i++) r[i] = i < yn ? y[i] : 0;
+        sub_into(r, xn, x, xn);
+        return true;
+    }
+}
 
-class  mpn_buffer : public buffer<mpn_digit> {
-public:
-    mpn_buffer() : buffer<mpn_digit>() {}
+/*
+   Karatsuba multiplication of a[0..n) and b[0..n) into c[0..2n). With B = base^m,
+   a = a1*B + a0 and b = b1*B + b0:
+
+      a*b = a1*b1*B^2 + (a0*b0 + a1*b1 - (a0 - a1)*(b0 - b1))*B + a0*b0
+*/
+static void mul_karatsuba(mpn_digit const * a, mpn_digit const * b, size_t n, mpn_digit * c) {
+    size_t m = n - n/2;
+    size_t h = n/2;
+    mpn_buffer t(6*m + 1);
+    mpn_digit * da  = t.data();
+    mpn_digit * db  = da + m;
+    mpn_digit * dd  = db + m;
+    mpn_digit * mid = dd + 2*m;
+    bool neg = abs_diff(a, m, a + m, h, da) != abs_diff(b, m, b + m, h, db);
+    mul(a, m, b, m, c);
+    mul(a + m, h, b + m, h, c + 2*m);
+    mul(da, m, db, m, dd);
+    for (size_t i = 0; i < 2*m; i++) mid[i] = c[i];
+    mid[2*m] = 0;
+    add_into(mid, 2*m + 1, c + 2*m, 2*h);
+    if (neg)
+        add_into(mid, 2*m + 1, dd, 2*m);
+    else
+        sub_into(mid, 2*m + 1, dd, 2*m);
+    size_t mid_sz = 2*m + 1;
+    while (mid_sz > 0 && mid[mid_sz-1] == 0) mid_sz--;
+    add_into(c + m, 2*n - m, mid, mid_sz);
+}
 
-    mpn_buffer(size_t nsz, const mpn_digit & elem = 0):buffer<mpn_digit>() {
-        for (size_t i = 0; i < nsz; i++) push_back(elem);
+/* Signed value in sign-magnitude form used by the Toom-3 interpolation. The magnitude has no leading zeros. */
+struct mpn_signed {
+    bool       m_neg = false;
+    mpn_buffer m_digits;
+
+    void normalize() {
+        while (!m_digits.empty() && m_digits.back() == 0)
+            m_digits.pop_back();
+        if (m_digits.empty())
+            m_neg = false;
     }
 
-    void resize(size_t nsz, const mpn_digit & elem = 0) {
-        buffer<mpn_digit>::resize(static_cast<unsigned>(nsz), elem);
+    void set(mpn_digit const * a, size_t lng) {
+        m_neg = false;
+        m_digits.clear();
+        m_digits.append(lng, a);
+        normalize();
     }
+};
 
-    mpn_digit & operator[](size_t idx) {
-        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+/* r := x + y, or x - y if `sub` is true. `r` must not alias `x` or `y`. */
+static void signed_add(mpn_signed & r, mpn_signed const & x, mpn_signed const & y, bool sub = false) {
+    bool y_neg = y.m_neg != sub;
+    mpn_buffer const & xd = x.m_digits;
+    mpn_buffer const & yd = y.m_digits;
+    if (x.m_neg == y_neg) {
+        bool x_longer = xd.size() >= yd.size();
+        mpn_buffer const & l = x_longer ? xd : yd;
+        mpn_buffer const & s = x_longer ? yd : xd;
+        r.m_digits.clear();
+        r.m_digits.append(l);
+        r.m_digits.push_back(0);
+        add_into(r.m_digits.data(), r.m_digits.size(), s.data(), s.size());
+        r.m_neg = x.m_neg;
+    } else if (mpn_compare(xd.data(), xd.size(), yd.data(), yd.size()) >= 0) {
+        r.m_digits.clear();
+        r.m_digits.append(xd);
+        sub_into(r.m_digits.data(), r.m_digits.size(), yd.data(), yd.size());
+        r.m_neg = x.m_neg;
+    } else {
+        r.m_digits.clear();
+        r.m_digits.append(yd);
+        sub_into(r.m_digits.data(), r.m_digits.size(), xd.data(), xd.size());
+        r.m_neg = y_neg;
     }
+    r.normalize();
+}
 
-    const mpn_digit & operator[](size_t idx) const {
-        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+/* x := x * 2 */
+static void signed_shl1(mpn_signed & x) {
+    x.m_digits.push_back(0);
+    mpn_digit k = 0;
+    for (size_t i = 0; i < x.m_digits.size(); i++) {
+        mpn_digit v = x.m_digits[i];
+        x.m_digits[i] = (v << 1) | k;
+        k = v >> (DIGIT_BITS - 1);
     }
-};
+    x.normalize();
+}
+
+/* x := x / d where d divides x exactly. */
+static void signed_divexact(mpn_signed & x, mpn_digit d) {
+    mpn_double_digit r = 0;
+    for (size_t i = x.m_digits.size(); i-- > 0;) {
+        r = (r << DIGIT_BITS) | x.m_digits[i];
+        x.m_digits[i] = (mpn_digit)(r / d);
+        r %= d;
+    }
+    lean_assert(r == 0);
+    x.normalize();
+}
+
+/* r := x * y. `r` must not alias `x` or `y`. */
+static void signed_mul(mpn_signed & r, mpn_signed const & x, mpn_signed const & y) {
+    r.m_digits.clear();
+    if (x.m_digits.empty() || y.m_digits.empty()) {
+        r.m_neg = false;
+        return;
+    }
+    r.m_digits.resize(x.m_digits.size() + y.m_digits.size());
+    mul(x.m_digits.data(), x.m_digits.size(), y.m_digits.data(), y.m_digits.size(), r.m_digits.data());
+    r.m_neg = x.m_neg != y.m_neg;
+    r.normalize();
+}
+
+/* Evaluate a0 + a1*x + a2*x^2 at 0, 1, -1, -2 and infinity. */
+static void toom3_eval(mpn_digit const * a, size_t k, size_t n, mpn_signed * v) {
+    mpn_signed a0, a1, a2, t;
+    a0.set(a, k);
+    a1.set(a + k, k);
+    a2.set(a + 2*k, n - 2*k);
+    signed_add(t, a0, a2);
+    signed_add(v[1], t, a1);
+    signed_add(v[2], t, a1, true);
+    signed_add(t, v[2], a2);
+    signed_shl1(t);
+    signed_add(v[3], t, a0, true);
+    v[0] = a0;
+    v[4] = a2;
+}
+
+/*
+   Toom-3 multiplication of a[0..n) and b[0..n) into c[0..2n). Both operands are split
+   in three pieces, the product polynomial is evaluated at 0, 1, -1, -2 and infinity,
+   and interpolated using Bodrato's sequence.
+*/
+static void mul_toom3(mpn_digit const * a, mpn_digit const * b, size_t n, mpn_digit * c) {
+    size_t k = (n + 2) / 3;
+    lean_assert(n > 2*k);
+    mpn_signed pa[5], pb[5], r0, r1, rm1, rm2, rinf, t;
+    toom3_eval(a, k, n, pa);
+    toom3_eval(b, k, n, pb);
+    signed_mul(r0,   pa[0], pb[0]);
+    signed_mul(r1,   pa[1], pb[1]);
+    signed_mul(rm1,  pa[2], pb[2]);
+    signed_mul(rm2,  pa[3], pb[3]);
+    signed_mul(rinf, pa[4], pb[4]);
+    // r3 := (r(-2) - r(1)) / 3
+    mpn_signed r3;
+    signed_add(r3, rm2, r1, true);
+    signed_divexact(r3, 3);
+    // r1 := (r(1) - r(-1)) / 2
+    signed_add(t, r1, rm1, true);
+    signed_divexact(t, 2);
+    r1 = t;
+    // r2 := r(-1) - r(0)
+    mpn_signed r2;
+    signed_add(r2, rm1, r0, true);
+    // r3 := (r2 - r3) / 2 + 2*r(inf)
+    signed_add(t, r2, r3, true);
+    signed_divexact(t, 2);
+    mpn_signed rinf2 = rinf;
+    signed_shl1(rinf2);
+    signed_add(r3, t, rinf2);
+    // r2 := r2 + r1 - r(inf)
+    signed_add(t, r2, r1);
+    signed_add(r2, t, rinf, true);
+    // r1 := r1 - r3
+    signed_add(t, r1, r3, true);
+    r1 = t;
+    mpn_signed const * coeffs[5] = { &r0, &r1, &r2, &r3, &rinf };
+    for (size_t i = 0; i < 2*n; i++)
+        c[i] = 0;
+    for (size_t i = 0; i < 5; i++) {
+        mpn_buffer const & d = coeffs[i]->m_digits;
+        lean_assert(!coeffs[i]->m_neg);
+        lean_assert(i*k + d.size() <= 2*n);
+        add_into(c + i*k, 2*n - i*k, d.data(), d.size());
+    }
+}
+
+/* c[0..lnga+lngb) := a[0..lnga) * b[0..lngb). `c` must not alias `a` or `b`. */
+static void mul(mpn_digit const * a, size_t lnga, mpn_digit const * b, size_t lngb, mpn_digit * c) {
+    if (lnga < lngb) {
+        std::swap(a, b);
+        std::swap(lnga, lngb);
+    }
+    if (lngb < LEAN_MPN_KARATSUBA_THRESHOLD) {
+        mul_basecase(a, lnga, b, lngb, c);
+    } else if (lnga == lngb) {
+        // Toom-3 needs three non-empty pieces
+        if (lnga < LEAN_MPN_TOOM3_THRESHOLD || lnga < 5)
+            mul_karatsuba(a, b, lnga, c);
+        else
+            mul_toom3(a, b, lnga, c);
+    } else {
+        // Split the longer operand into pieces of the size of the shorter one.
+        for (size_t i = 0; i < lnga + lngb; i++)
+            c[i] = 0;
+        mpn_buffer t(2*lngb);
+        for (size_t i = 0; i < lnga; i += lngb) {
+            size_t len = lnga - i < lngb ? lnga - i : lngb;
+            mul(a + i, len, b, lngb, t.data());
+            add_into(c + i, lnga + lngb - i, t.data(), len + lngb);
+        }
+    }
+}
+
+void mpn_mul(mpn_digit const * a, size_t const lnga,
+             mpn_digit const * b, size_t const lngb,
+             mpn_digit * c) {
+    mul(a, lnga, b, lngb, c);
+}
 
 static size_t div_normalize(mpn_digit const * numer, size_t const lnum,
                             mpn_digit const * denom, size_t const lden,
@@ -220,49 +531,109 @@ static void div_1(mpn_buffer & numer, mpn_digit const denom,
     }
 }
 
-static void div_n(mpn_buffer & numer, mpn_buffer const & denom,
-                  mpn_digit * quot, mpn_digit * rem,
-                  mpn_buffer & ms, mpn_buffer & ab) {
-    lean_assert(denom.size() > 1);
-
-    // This is essentially Knuth's Algorithm D.
-    size_t m = numer.size() - denom.size();
-    size_t n = denom.size();
-
-    lean_assert(numer.size() == m+n);
-
-    ms.resize(n+1);
+/*
+   Schoolbook division (Knuth's Algorithm D) of np[0..nn) by the normalized dp[0..dn), dn >= 2.
+   Stores the low nn-dn quotient digits in q and the remainder in np[0..dn), and returns the
+   top quotient digit, which is 0 or 1.
+*/
+static mpn_digit div_qr_basecase(mpn_digit * q, mpn_digit * np, size_t nn, mpn_digit const * dp, size_t dn) {
+    lean_assert(dn >= 2 && nn >= dn && (dp[dn-1] & MASK_FIRST) != 0);
+    size_t qn = nn - dn;
+    mpn_digit qh = mpn_compare(np + qn, dn, dp, dn) >= 0;
+    if (qh)
+        sub_n(np + qn, np + qn, dp, dn);
+    mpn_double_digit d1 = dp[dn-1];
+    mpn_double_digit d0 = dp[dn-2];
+    for (size_t j = qn; j-- > 0;) {
+        mpn_double_digit temp  = ((mpn_double_digit)np[j+dn] << DIGIT_BITS) | np[j+dn-1];
+        mpn_double_digit q_hat = temp / d1;
+        mpn_double_digit r_hat = temp % d1;
+        while (q_hat >= BASE || q_hat * d0 > ((r_hat << DIGIT_BITS) | np[j+dn-2])) {
+            q_hat--;
+            r_hat += d1;
+            if (r_hat >= BASE) break;
+        }
+        mpn_digit top    = np[j+dn];
+        mpn_digit borrow = submul_1(np + j, dp, dn, (mpn_digit)q_hat);
+        np[j+dn] = top - borrow;
+        if (top < borrow) {
+            q_hat--;
+            np[j+dn] += add_n(np + j, np + j, dp, dn);
+        }
+        q[j] = (mpn_digit)q_hat;
+    }
+    return qh;
+}
 
-    mpn_double_digit q_hat, temp, r_hat;
-    mpn_digit borrow;
+/*
+   Divide-and-conquer division of np[0..2n) by the normalized dp[0..n) (Burnikel-Ziegler,
+   in the formulation used by GMP). Same conventions as `div_qr_basecase`.
+*/
+static mpn_digit div_qr_dc_n(mpn_digit * q, mpn_digit * np, mpn_digit const * dp, size_t n) {
+    if (n < LEAN_MPN_DC_DIV_THRESHOLD)
+        return div_qr_basecase(q, np, 2*n, dp, n);
+    size_t lo = n / 2;
+    size_t hi = n - lo;
+    mpn_buffer t(n);
+    // High half of the quotient from the top 2*hi digits, then fix the remainder using the low digits of dp.
+    mpn_digit qh = div_qr_dc_n(q + lo, np + 2*lo, dp + lo, hi);
+    mul(q + lo, hi, dp, lo, t.data());
+    mpn_digit cy = sub_n(np + lo, np + lo, t.data(), n);
+    if (qh != 0)
+        cy += sub_n(np + n, np + n, dp, lo);
+    while (cy != 0) {
+        qh -= sub_1(q + lo, hi, 1);
+        cy -= add_n(np + lo, np + lo, dp, n);
+    }
+    // Low half of the quotient.
+    mpn_digit ql = div_qr_dc_n(q, np + hi, dp + hi, lo);
+    mul(dp, hi, q, lo, t.data());
+    cy = sub_n(np, np, t.data(), n);
+    if (ql != 0)
+        cy += sub_n(np + lo, np + lo, dp, hi);
+    while (cy != 0) {
+        sub_1(q, lo, 1);
+        cy -= add_n(np, np, dp, n);
+    }
+    return qh;
+}
 
-    for (size_t j = m-1; j != (size_t)-1; j--) {
-        temp = (((mpn_double_digit)numer[j+n]) << DIGIT_BITS) | ((mpn_double_digit)numer[j+n-1]);
-        q_hat = temp / (mpn_double_digit) denom[n-1];
-        r_hat = temp % (mpn_double_digit) denom[n-1];
-        recheck:
-        if (q_hat >= BASE ||
-            ((q_hat * denom[n-2]) > ((r_hat << DIGIT_BITS) + numer[j+n-2]))) {
-                q_hat--;
-                r_hat += denom[n-1];
-                if (r_hat < BASE) goto recheck;
-        }
-        lean_assert(q_hat < BASE);
-        // Replace numer[j+n]...numer[j] with
-        // numer[j+n]...numer[j] - q * (denom[n-1]...denom[0])
-        mpn_digit q_hat_small = (mpn_digit)q_hat;
-        mpn_mul(&q_hat_small, 1, denom.data(), n, ms.data());
-        mpn_sub(&numer[j], n+1, ms.data(), n+1, &numer[j], &borrow);
-        quot[j] = q_hat_small;
-        if (borrow) {
-            quot[j]--;
-            ab.resize(n+2);
-            size_t real_size;
-            mpn_add(denom.data(), n, &numer[j], n+1, ab.data(), n+2, &real_size);
-            for (size_t i = 0; i < n+1; i++)
-                numer[j+i] = ab[i];
+/* Division of np[0..nn) by the normalized dp[0..dn). Same conventions as `div_qr_basecase`. */
+static mpn_digit div_qr(mpn_digit * q, mpn_digit * np, size_t nn, mpn_digit const * dp, size_t dn) {
+    size_t qn = nn - dn;
+    if (dn < LEAN_MPN_DC_DIV_THRESHOLD || qn < LEAN_MPN_DC_DIV_THRESHOLD)
+        return div_qr_basecase(q, np, nn, dp, dn);
+    if (qn < dn) {
+        // Estimate the quotient by dividing the top 2*qn digits of np by the top qn digits of dp.
+        // The estimate is at most 2 too large, which is corrected using the remaining digits of dp.
+        size_t t = dn - qn;
+        mpn_digit qh = div_qr_dc_n(q, np + t, dp + t, qn);
+        mpn_buffer tmp(dn);
+        mul(q, qn, dp, t, tmp.data());
+        mpn_digit cy = sub_n(np, np, tmp.data(), dn);
+        if (qh != 0)
+            cy += sub_n(np + qn, np + qn, dp, t);
+        while (cy != 0) {
+            qh -= sub_1(q, qn, 1);
+            cy -= add_n(np, np, dp, dn);
         }
+        return qh;
+    }
+    mpn_digit qh = mpn_compare(np + qn, dn, dp, dn) >= 0;
+    if (qh)
+        sub_n(np + qn, np + qn, dp, dn);
+    // Compute the quotient in blocks of dn digits from the top, starting with the partial block.
+    size_t j = qn - qn % dn;
+    if (j < qn) {
+        mpn_digit h = div_qr(q + j, np + j, nn - j, dp, dn);
+        lean_assert(h == 0); (void)h;
+    }
+    while (j > 0) {
+        j -= dn;
+        mpn_digit h = div_qr_dc_n(q + j, np + j, dp, dn);
+        lean_assert(h == 0); (void)h;
     }
+    return qh;
 }
 
 void mpn_div(mpn_digit const * numer, size_t const lnum,
@@ -296,12 +667,14 @@ void mpn_div(mpn_digit const * numer, size_t const lnum,
             rem[i] = (i < lnum) ? numer[i] : 0;
     }
     else  {
-        mpn_buffer u, v, t_ms, t_ab;
+        mpn_buffer u, v;
         size_t d = div_normalize(numer, lnum, denom, lden, u, v);
-        if (lden == 1)
+        if (lden == 1) {
             div_1(u, v[0], quot);
-        else
-            div_n(u, v, quot, rem, t_ms, t_ab);
+        } else {
+            mpn_digit qh = div_qr(quot, u.data(), u.size(), v.data(), lden);
+            lean_assert(qh == 0); (void)qh;
+        }
         div_unnormalize(u, v, d, rem);
     }
 
@@ -318,6 +691,59 @@ void mpn_div(mpn_digit const * numer, size_t const lnum,
 #endif
 }
 
+/*
+   Write the decimal representation of a[0..lng) to `out` and return the position after it.
+   If `pad` is not zero, the output is padded with leading zeros to exactly `pad` characters.
+*/
+static char * to_string_basecase(mpn_digit const * a, size_t lng, size_t pad, char * out) {
+    mpn_buffer t;
+    t.append(lng, a);
+    buffer<char, 256> rev;
+    while (lng > 0 && t[lng-1] == 0) lng--;
+    while (lng > 0) {
+        // Extract 9 digits at a time.
+        mpn_double_digit r = 0;
+        for (size_t i = lng; i-- > 0;) {
+            r = (r << DIGIT_BITS) | t[i];
+            t[i] = (mpn_digit)(r / 1000000000);
+            r %= 1000000000;
+        }
+        while (lng > 0 && t[lng-1] == 0) lng--;
+        for (unsigned k = 0; k < 9; k++) {
+            rev.push_back('0' + r % 10);
+            r /= 10;
+        }
+    }
+    size_t n = rev.size();
+    while (n > 0 && rev[n-1] == '0') n--;
+    lean_assert(pad == 0 || n <= pad);
+    if (pad > 0) {
+        for (size_t i = n; i < pad; i++) *out++ = '0';
+    } else if (n == 0) {
+        *out++ = '0';
+    }
+    while (n > 0) *out++ = rev[--n];
+    return out;
+}
+
+/*
+   Divide-and-conquer conversion: split a[0..lng) by the largest suitable 10^(9*2^i) in `pows[0..k)`
+   and convert the quotient and the (padded) remainder recursively.
+*/
+static char * to_string_dc(mpn_digit const * a, size_t lng, size_t pad, mpn_buffer const * pows, size_t k, char * out) {
+    while (lng > 0 && a[lng-1] == 0) lng--;
+    while (k > 0 && 2*pows[k-1].size() > lng + 1) k--;
+    if (lng < LEAN_MPN_DC_TO_STRING_THRESHOLD || k == 0)
+        return to_string_basecase(a, lng, pad, out);
+    mpn_buffer const & p = pows[k-1];
+    size_t pn = p.size();
+    mpn_buffer q(lng - pn + 1), r(pn);
+    mpn_div(a, lng, p.data(), pn, q.data(), r.data());
+    size_t low_digits = static_cast<size_t>(9) << (k-1);
+    out = to_string_dc(q.data(), q.size(), pad > 0 ? pad - low_digits : 0, pows, k-1, out);
+    return to_string_dc(r.data(), r.size(), low_digits, pows, k-1, out);
+}
+
 char * mpn_to_string(mpn_digit const * a, size_t const lng, char * buf, size_t const lbuf) {
     lean_assert(buf && lbuf > 0);
 
@@ -329,27 +755,24 @@ char * mpn_to_string(mpn_digit const * a, size_t const lng, char * buf, size_t c
 #endif
     }
     else {
-        mpn_buffer temp(lng, 0), t_numer(lng+1, 0), t_denom(1, 0);
-        for (unsigned i = 0; i < lng; i++)
-            temp[i] = a[i];
-
-        size_t j = 0;
-        mpn_digit rem;
-        mpn_digit ten = 10;
-        while (!temp.empty() && (temp.size() > 1 || temp[0] != 0)) {
-            size_t d = div_normalize(&temp[0], temp.size(), &ten, 1, t_numer, t_denom);
-            div_1(t_numer, t_denom[0], &temp[0]);
-            div_unnormalize(t_numer, t_denom, d, &rem);
-            buf[j++] = '0' + rem;
-            while (!temp.empty() && temp.back() == 0)
-                temp.pop_back();
+        // pows[i] = 10^(9*2^i), as long as it is useful for splitting `a`.
+        std::vector<mpn_buffer> pows;
+        if (lng >= LEAN_MPN_DC_TO_STRING_THRESHOLD) {
+            pows.push_back(mpn_buffer(1, 1000000000));
+            while (true) {
+                mpn_buffer const & p = pows.back();
+                if (4*p.size() > lng + 2)
+                    break;
+                mpn_buffer sq(2*p.size());
+                mpn_mul(p.data(), p.size(), p.data(), p.size(), sq.data());
+                while (sq.back() == 0)
+                    sq.pop_back();
+                pows.push_back(sq);
+            }
         }
-        buf[j] = 0;
-
-        j--;
-        size_t mid = (j/2) + ((j % 2) ? 1 : 0);
-        for (size_t i = 0; i < mid; i++)
-            std::swap(buf[i], buf[j-i]);
+        char * end = to_string_dc(a, lng, 0, pows.data(), pows.size(), buf);
+        lean_assert(static_cast<size_t>(end - buf) < lbuf);
+        *end = 0;
     }
     return buf;
 }
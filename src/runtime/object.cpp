@@ -8,6 +8,8 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <atomic>
+#include <memory>
 #include <cmath>
 #include <lean/lean.h>
 #include "runtime/object.h"
@@ -552,7 +554,7 @@ extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
 
 LEAN_THREAD_PTR(lean_task_object, g_current_task_object);
 
-static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive) {
+static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive, uint8 released = 0) {
     lean_task_imp * imp = (lean_task_imp*)lean_alloc_small_object(sizeof(lean_task_imp));
     imp->m_closure     = c;
     imp->m_head_dep    = nullptr;
@@ -560,7 +562,7 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
     imp->m_prio        = prio;
     imp->m_canceled    = false;
     imp->m_keep_alive  = keep_alive;
-    imp->m_deleted     = false;
+    imp->m_released    = released;
     return imp;
 }
 
@@ -573,21 +575,149 @@ static void free_task(lean_task_object * t) {
     lean_free_small_object((lean_object*)t);
 }
 
+/* Record that `flag` (`LEAN_TASK_DROPPED` or `LEAN_TASK_UNSCHEDULED`) does not reference `t` anymore, and free `t`
+   if the other one already did so. Whichever of the two comes first releases the closure and dependent tasks
+   instead. The latter can only be deactivated tasks still waiting for `t`, which we release on behalf of the task
+   manager as well. */
+static void release_task(lean_task_object * t, uint8 flag) {
+    buffer<lean_task_object *> todo;
+    while (true) {
+        lean_task_imp * imp = t->m_imp;
+        object * c = imp->m_closure.exchange(nullptr);
+        lean_task_object * it = imp->m_head_dep.exchange(LEAN_TASK_DEPS_CLOSED);
+        if (imp->m_released.fetch_or(flag) != 0) {
+            object * v = t->m_value;
+            free_task(t);
+            if (v) lean_dec(v);
+        }
+        if (c) lean_dec_ref(c);
+        for (; it && it != LEAN_TASK_DEPS_CLOSED; it = it->m_imp->m_next_dep)
+            todo.push_back(it);
+        if (todo.empty())
+            return;
+        t    = todo.back();
+        flag = LEAN_TASK_UNSCHEDULED;
+        todo.pop_back();
+    }
+}
+
 struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Chase-Lev work-stealing deque, using the memory orderings from
+   "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al., PPoPP 2013).
+   Only the owning worker may `push` and `pop` (LIFO end), while any thread may `steal` (FIFO end).
+   Buffers replaced when growing are kept alive until the deque is destroyed since concurrent
+   thieves may still be reading from them. */
+class task_deque {
+    struct buffer {
+        size_t                                               m_mask;
+        std::unique_ptr<std::atomic<lean_task_object *>[]>   m_data;
+        explicit buffer(size_t capacity):m_mask(capacity - 1), m_data(new std::atomic<lean_task_object *>[capacity]) {}
+        size_t capacity() const { return m_mask + 1; }
+        lean_task_object * get(int64_t i) const { return m_data[i & m_mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, lean_task_object * t) { m_data[i & m_mask].store(t, std::memory_order_relaxed); }
+    };
+    std::atomic<int64_t>                 m_top{0};
+    std::atomic<int64_t>                 m_bottom{0};
+    std::atomic<buffer *>                m_buffer;
+    std::vector<std::unique_ptr<buffer>> m_buffers; // accessed by the owner only
+
+    buffer * grow(buffer * b, int64_t top, int64_t bottom) {
+        m_buffers.emplace_back(new buffer(2 * b->capacity()));
+        buffer * new_b = m_buffers.back().get();
+        for (int64_t i = top; i < bottom; i++)
+            new_b->put(i, b->get(i));
+        m_buffer.store(new_b, std::memory_order_release);
+        return new_b;
+    }
+
+public:
+    task_deque() {
+        m_buffers.emplace_back(new buffer(256));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    void push(lean_task_object * t) {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top    = m_top.load(std::memory_order_acquire);
+        buffer * b     = m_buffer.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(b->m_mask))
+            b = grow(b, top, bottom);
+        b->put(bottom, t);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    lean_task_object * pop() {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        buffer * b     = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top    = m_top.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        lean_task_object * t = b->get(bottom);
+        if (top == bottom) {
+            // last element, race against thieves
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                t = nullptr;
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    /* Return `nullptr` only if the deque was observed to be empty; a lost race against another thief or the owner is retried. */
+    lean_task_object * steal() {
+        while (true) {
+            int64_t top    = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = m_bottom.load(std::memory_order_acquire);
+            if (top >= bottom)
+                return nullptr;
+            lean_task_object * t = m_buffer.load(std::memory_order_acquire)->get(top);
+            if (m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return t;
+        }
+    }
+};
+
+/* Local deque of the current standard worker thread if work stealing is enabled. */
+LEAN_THREAD_PTR(task_deque, g_worker_deque);
+LEAN_THREAD_VALUE(unsigned, g_worker_steal_seed, 0);
+
+/* Threads blocked on a task park on one of these slots, selected by the address of the task, so that finishing a
+   task only wakes up threads waiting for tasks of the same slot. */
+struct task_waiters {
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    std::atomic<unsigned> m_num_waiters{0};
+};
+
+#define LEAN_NUM_TASK_WAITER_SLOTS 64
+
 class task_manager {
     mutex                                         m_mutex;
     std::vector<std::unique_ptr<lthread>>         m_std_workers;
-    unsigned                                      m_idle_std_workers{0};
+    std::atomic<unsigned>                         m_num_std_workers{0};
+    std::atomic<unsigned>                         m_idle_std_workers{0};
     unsigned                                      m_max_std_workers{0};
-    unsigned                                      m_num_dedicated_workers{0};
+    std::atomic<unsigned>                         m_num_dedicated_workers{0};
     std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
+    std::atomic<unsigned>                         m_queues_size{0};
     unsigned                                      m_max_prio{0};
+    /* If work stealing is enabled, every standard worker owns one of these deques. Tasks of default priority
+       enqueued by a worker go into its own deque without taking `m_mutex`; idle workers steal from the others.
+       Tasks of higher priority and tasks enqueued by other threads still go through `m_queues`, which workers
+       always check first. */
+    bool                                          m_work_stealing;
+    std::vector<std::unique_ptr<task_deque>>      m_deques;
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
+    task_waiters                                  m_waiters[LEAN_NUM_TASK_WAITER_SLOTS];
+    /* `IO.waitAny` cannot park on a single slot, so it is woken up by every finished task instead. */
+    task_waiters                                  m_any_waiters;
     bool                                          m_shutting_down{false};
 
     lean_task_object * dequeue() {
@@ -618,54 +748,91 @@ class task_manager {
             m_max_prio = prio;
         m_queues[prio].push_back(t);
         m_queues_size++;
+        wake_worker_core();
+    }
+
+    void wake_worker_core() {
         if (!m_idle_std_workers && m_std_workers.size() < m_max_std_workers)
             spawn_worker();
         else
             m_queue_cv.notify_one();
     }
 
-    void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
-        object * c              = t->m_imp->m_closure;
-        lean_task_object * it   = t->m_imp->m_head_dep;
-        t->m_imp->m_closure     = nullptr;
-        t->m_imp->m_head_dep    = nullptr;
-        t->m_imp->m_canceled    = true;
-        t->m_imp->m_deleted     = true;
-        lock.unlock();
-        while (it) {
-            lean_assert(it->m_imp->m_deleted);
-            lean_task_object * next_it = it->m_imp->m_next_dep;
-            free_task(it);
-            it = next_it;
+    /* Push `t` into the local deque of the current worker without holding `m_mutex`, if possible. */
+    bool enqueue_local(lean_task_object * t) {
+        lean_assert(t->m_imp);
+        if (t->m_imp->m_prio != 0 || !g_worker_deque)
+            return false;
+        g_worker_deque->push(t);
+        /* Pairs with the increment of `m_idle_std_workers` in `spawn_worker`: either an idle worker
+           sees the new task while searching for work, or we see the idle worker and wake it up. */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle_std_workers || m_num_std_workers < m_max_std_workers) {
+            unique_lock<mutex> lock(m_mutex);
+            wake_worker_core();
         }
-        if (c) dec_ref(c);
-        lock.lock();
+        return true;
+    }
+
+    lean_task_object * steal() {
+        unsigned n = m_deques.size();
+        unsigned start = g_worker_steal_seed = g_worker_steal_seed * 1103515245u + 12345u;
+        for (unsigned i = 0; i < n; i++) {
+            task_deque * d = m_deques[(start + i) % n].get();
+            if (d == g_worker_deque)
+                continue;
+            if (lean_task_object * t = d->steal())
+                return t;
+        }
+        return nullptr;
+    }
+
+    /* Take a task from the local deque of the current worker or steal one. Does not need `m_mutex`. */
+    lean_task_object * next_local_task() {
+        if (g_worker_deque) {
+            if (lean_task_object * t = g_worker_deque->pop())
+                return t;
+            return steal();
+        }
+        return nullptr;
+    }
+
+    /* Find the next task to be executed by the current worker, or `nullptr` if there is none.
+       `m_mutex` must be held. */
+    lean_task_object * next_task() {
+        if (m_queues_size != 0)
+            return dequeue();
+        return next_local_task();
     }
 
     void spawn_worker() {
         if (m_shutting_down)
             return;
 
-        m_std_workers.emplace_back(new lthread([this]() {
+        unsigned idx = m_std_workers.size();
+        m_num_std_workers++;
+        m_std_workers.emplace_back(new lthread([this, idx]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            m_idle_std_workers++;
+            if (m_work_stealing) {
+                g_worker_deque      = m_deques[idx].get();
+                g_worker_steal_seed = idx;
+            }
             while (true) {
-                if (m_queues_size == 0) {
-                    if (m_shutting_down) {
+                // fast path: local and stolen tasks do not need `m_mutex`
+                lean_task_object * t = m_queues_size == 0 ? next_local_task() : nullptr;
+                if (t == nullptr) {
+                    unique_lock<mutex> lock(m_mutex);
+                    m_idle_std_workers++;
+                    while ((t = next_task()) == nullptr && !m_shutting_down)
+                        m_queue_cv.wait(lock);
+                    m_idle_std_workers--;
+                    if (t == nullptr)
                         break;
-                    }
-                    m_queue_cv.wait(lock);
-                    continue;
                 }
-
-                lean_task_object * t = dequeue();
-                m_idle_std_workers--;
-                run_task(lock, t);
-                m_idle_std_workers++;
+                run_task(t);
                 reset_heartbeat();
             }
-            m_idle_std_workers--;
+            g_worker_deque = nullptr;
         }));
     }
 
@@ -673,80 +840,95 @@ class task_manager {
         m_num_dedicated_workers++;
         lthread([this, t]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            run_task(lock, t);
+            run_task(t);
             m_num_dedicated_workers--;
         });
         // `lthread` will be implicitly freed, which frees up its control resources but does not terminate the thread
     }
 
-    void run_task(unique_lock<mutex> & lock, lean_task_object * t) {
-        lean_assert(t->m_imp);
-        if (t->m_imp->m_deleted) {
-            free_task(t);
+    void run_task(lean_task_object * t) {
+        lean_task_imp * imp = t->m_imp;
+        lean_assert(imp);
+        object * c = imp->m_closure.exchange(nullptr);
+        if (c == nullptr) {
+            // deactivated while queued
+            release_task(t, LEAN_TASK_UNSCHEDULED);
             return;
         }
         reset_heartbeat();
         object * v = nullptr;
         {
             scoped_current_task_object scope_cur_task(t);
-            object * c = t->m_imp->m_closure;
-            t->m_imp->m_closure = nullptr;
-            lock.unlock();
             v = lean_apply_1(c, box(0));
             // If deactivation was delayed by `m_keep_alive`, deactivate after the final execution (`v != nulltpr`)
-            if (v != nullptr && t->m_imp->m_keep_alive) {
+            if (v != nullptr && imp->m_keep_alive) {
                 lean_dec_ref((lean_object*)t);
             }
-            lock.lock();
         }
-        lean_assert(t->m_imp);
-        if (t->m_imp->m_deleted) {
-            lock.unlock();
-            if (v) lean_dec(v);
-            free_task(t);
-            lock.lock();
-        } else if (v != nullptr) {
-            lean_assert(t->m_imp->m_closure == nullptr);
-            resolve_core(t, v);
-        } else {
+        if (v == nullptr) {
             // `bind` task has not finished yet, re-add as dependency of nested task
-            // NOTE: closure MUST be extracted before unlocking the mutex as otherwise
-            // another thread could deactivate the task and empty `m_clousure` in
-            // between.
-            object * c = t->m_imp->m_closure;
-            lock.unlock();
-            add_dep(lean_to_task(closure_arg_cptr(c)[0]), t);
-            lock.lock();
+            // NOTE: we must own the closure while extracting the nested task as otherwise another thread
+            // could deactivate the task and release the closure, and with it the nested task, in between.
+            c = imp->m_closure.exchange(nullptr);
+            if (c == nullptr) {
+                release_task(t, LEAN_TASK_UNSCHEDULED);
+                return;
+            }
+            object * nested = closure_arg_cptr(c)[0];
+            lean_inc_ref(nested);
+            imp->m_closure = c;
+            add_dep(lean_to_task(nested), t);
+            lean_dec_ref(nested);
+            return;
+        }
+        lean_assert(imp->m_closure == nullptr);
+        resolve_core(t, v);
+        release_task(t, LEAN_TASK_UNSCHEDULED);
+    }
+
+    task_waiters & get_waiters(lean_task_object * t) {
+        return m_waiters[(reinterpret_cast<uintptr_t>(t) >> 4) % LEAN_NUM_TASK_WAITER_SLOTS];
+    }
+
+    static void notify(task_waiters & w) {
+        // Pairs with the increment of `m_num_waiters` before checking for `m_value` in `wait`.
+        if (w.m_num_waiters) {
+            unique_lock<mutex> lock(w.m_mutex);
+            w.m_cv.notify_all();
         }
     }
 
-    void resolve_core(lean_task_object * t, object * v) {
-        handle_finished(t);
+    template<typename P> static void wait(task_waiters & w, P && pred) {
+        unique_lock<mutex> lock(w.m_mutex);
+        w.m_num_waiters++;
+        w.m_cv.wait(lock, pred);
+        w.m_num_waiters--;
+    }
+
+    /* Store the result `v` of `t` and schedule its dependent tasks. Return `false` if `t` has already been resolved. */
+    bool resolve_core(lean_task_object * t, object * v) {
         mark_mt(v);
-        t->m_value = v;
-        /* After the task has been finished and we propagated
-           dependencies, we can release `m_imp` and keep just the value */
-        free_task_imp(t->m_imp);
-        t->m_imp   = nullptr;
-        m_task_finished_cv.notify_all();
-    }
-
-    void handle_finished(lean_task_object * t) {
-        lean_task_object * it = t->m_imp->m_head_dep;
-        t->m_imp->m_head_dep = nullptr;
-        while (it) {
-            if (t->m_imp->m_canceled)
-                it->m_imp->m_canceled = true;
+        object * expected = nullptr;
+        if (!t->m_value.compare_exchange_strong(expected, v))
+            return false;
+        // New dependencies will see `m_value` from now on, and not touch the list anymore after it is closed.
+        lean_task_imp * imp   = t->m_imp;
+        bool canceled         = imp->m_canceled;
+        lean_task_object * it = imp->m_head_dep.exchange(LEAN_TASK_DEPS_CLOSED);
+        while (it && it != LEAN_TASK_DEPS_CLOSED) {
             lean_task_object * next_it = it->m_imp->m_next_dep;
             it->m_imp->m_next_dep = nullptr;
-            if (it->m_imp->m_deleted) {
-                free_task(it);
-            } else {
-                enqueue_core(it);
-            }
+            if (canceled)
+                it->m_imp->m_canceled = true;
+            if (it->m_imp->m_released & LEAN_TASK_DROPPED)
+                release_task(it, LEAN_TASK_UNSCHEDULED);
+            else
+                enqueue(it);
             it = next_it;
         }
+        notify(get_waiters(t));
+        notify(m_any_waiters);
+        return true;
     }
 
     object * wait_any_check(object * task_list) {
@@ -761,8 +943,12 @@ class task_manager {
     }
 
 public:
-    task_manager(unsigned max_std_workers):
-        m_max_std_workers(max_std_workers) {
+    task_manager(unsigned max_std_workers, bool work_stealing):
+        m_max_std_workers(max_std_workers), m_work_stealing(work_stealing) {
+        if (m_work_stealing) {
+            for (unsigned i = 0; i < m_max_std_workers; i++)
+                m_deques.emplace_back(new task_deque());
+        }
     }
 
     ~task_manager() {
@@ -781,17 +967,15 @@ public:
     }
 
     void enqueue(lean_task_object * t) {
+        if (enqueue_local(t))
+            return;
         unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
 
     void resolve(lean_task_object * t, object * v) {
-        unique_lock<mutex> lock(m_mutex);
-        if (t->m_value) {
+        if (!resolve_core(t, v))
             dec(v);
-            return;
-        }
-        resolve_core(t, v);
     }
 
     void add_dep(lean_task_object * t1, lean_task_object * t2) {
@@ -800,52 +984,34 @@ public:
             enqueue(t2);
             return;
         }
-        unique_lock<mutex> lock(m_mutex);
-        lean_assert(t2->m_value == nullptr);
-        if (t1->m_value) {
-            enqueue_core(t2);
-            return;
-        }
-        t2->m_imp->m_next_dep = t1->m_imp->m_head_dep;
-        t1->m_imp->m_head_dep = t2;
+        // `t1` cannot be freed since `t2` holds a reference to it
+        lean_task_imp * imp    = t1->m_imp;
+        lean_task_object * head = imp->m_head_dep;
+        do {
+            if (head == LEAN_TASK_DEPS_CLOSED) {
+                // `t1` has been resolved in the meantime
+                enqueue(t2);
+                return;
+            }
+            t2->m_imp->m_next_dep = head;
+        } while (!imp->m_head_dep.compare_exchange_weak(head, t2));
     }
 
     void wait_for(lean_task_object * t) {
         if (t->m_value)
             return;
-        unique_lock<mutex> lock(m_mutex);
-        if (t->m_value)
-            return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        wait(get_waiters(t), [&]() { return t->m_value != nullptr; });
     }
 
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
-        unique_lock<mutex> lock(m_mutex);
-        while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
-        }
-    }
-
-    void deactivate_task(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
-        if (object * v = t->m_value) {
-            lean_assert(t->m_imp == nullptr);
-            lock.unlock();
-            lean_dec(v);
-            free_task(t);
-            return;
-        } else {
-            lean_assert(t->m_imp);
-            deactivate_task_core(lock, t);
-        }
+        object * t = nullptr;
+        wait(m_any_waiters, [&]() { return (t = wait_any_check(task_list)) != nullptr; });
+        return t;
     }
 
     void cancel(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
         if (t->m_imp)
             t->m_imp->m_canceled = true;
     }
@@ -857,15 +1023,6 @@ public:
 
 static task_manager * g_task_manager = nullptr;
 
-extern "C" LEAN_EXPORT void lean_init_task_manager_using(unsigned num_workers) {
-    lean_assert(g_task_manager == nullptr);
-#if defined(LEAN_MULTI_THREAD)
-    if (num_workers > 0) {
-        g_task_manager = new task_manager(num_workers);
-    }
-#endif
-}
-
 static unsigned get_lean_num_threads() {
 #ifndef LEAN_EMSCRIPTEN
     if (char const * num_threads = std::getenv("LEAN_NUM_THREADS")) {
@@ -875,6 +1032,27 @@ static unsigned get_lean_num_threads() {
     return hardware_concurrency();
 }
 
+/* Work stealing can be disabled by setting `LEAN_WORK_STEALING=0`, in which case all tasks go through the
+   shared priority queues of the task manager. */
+static bool get_lean_work_stealing() {
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * work_stealing = std::getenv("LEAN_WORK_STEALING")) {
+        return atoi(work_stealing) != 0;
+    }
+#endif
+    return true;
+}
+
+extern "C" LEAN_EXPORT void lean_init_task_manager_using(unsigned num_workers) {
+    lean_assert(g_task_manager == nullptr);
+#if defined(LEAN_MULTI_THREAD)
+    if (num_workers > 0) {
+        g_task_manager = new task_manager(num_workers, get_lean_work_stealing());
+    }
+#endif
+}
+
+
 extern "C" LEAN_EXPORT void lean_init_task_manager() {
     lean_init_task_manager_using(get_lean_num_threads());
 }
@@ -890,7 +1068,7 @@ scoped_task_manager::scoped_task_manager(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
 #if defined(LEAN_MULTI_THREAD)
     if (num_workers > 0) {
-        g_task_manager = new task_manager(num_workers);
+        g_task_manager = new task_manager(num_workers, get_lean_work_stealing());
     }
 #endif
 }
@@ -903,9 +1081,11 @@ scoped_task_manager::~scoped_task_manager() {
 }
 
 void deactivate_task(lean_task_object * t) {
-    if (g_task_manager) {
-        g_task_manager->deactivate_task(t);
+    if (t->m_imp) {
+        t->m_imp->m_canceled = true;
+        release_task(t, LEAN_TASK_DROPPED);
     } else {
+        // `Task.pure`
         lean_assert(t->m_value != nullptr);
         lean_dec(t->m_value);
         free_task(t);
@@ -1047,7 +1227,8 @@ extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg) {
     lean_task_object * o = (lean_task_object*)lean_alloc_small_object(sizeof(lean_task_object));
     lean_set_task_header((lean_object*)o);
     o->m_value = nullptr;
-    o->m_imp   = alloc_task_imp(closure, prio, keep_alive);
+    // the task manager never references promises
+    o->m_imp   = alloc_task_imp(closure, prio, keep_alive, LEAN_TASK_UNSCHEDULED);
     return io_result_mk_ok((lean_object *) o);
 }
 
@@ -1617,6 +1798,22 @@ extern "C" LEAN_EXPORT obj_res lean_string_from_utf8_unchecked(b_obj_arg a) {
     return lean_mk_string_from_bytes(reinterpret_cast<char *>(lean_sarray_cptr(a)), lean_sarray_size(a));
 }
 
+extern "C" LEAN_EXPORT uint8 lean_string_validate_utf8(b_obj_arg a) {
+    size_t len;
+    return validate_utf8(reinterpret_cast<char *>(lean_sarray_cptr(a)), lean_sarray_size(a), len);
+}
+
+extern "C" LEAN_EXPORT obj_res lean_string_from_utf8(b_obj_arg a) {
+    char const * s = reinterpret_cast<char *>(lean_sarray_cptr(a));
+    size_t sz = lean_sarray_size(a);
+    size_t len;
+    if (!validate_utf8(s, sz, len))
+        return lean_box(0);
+    obj_res r = lean_alloc_ctor(1, 1, 0);
+    lean_ctor_set(r, 0, lean_mk_string_core(s, sz, len));
+    return r;
+}
+
 extern "C" LEAN_EXPORT obj_res lean_string_to_utf8(b_obj_arg s) {
     size_t sz = lean_string_size(s) - 1;
     obj_res r = lean_alloc_sarray(1, sz, sz);
@@ -1993,6 +2190,8 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uin
 }
 
 extern "C" LEAN_EXPORT uint64 lean_string_hash(b_obj_arg s) {
+    if (lean_ptr_other(s) == LEAN_STRING_CACHED_HASH)
+        return *string_cached_hash_slot(s);
     usize sz = lean_string_size(s) - 1;
     char const * str = lean_string_cstr(s);
     return hash_str(sz, (unsigned char const *) str, 11);
@@ -2104,7 +2303,7 @@ extern "C" LEAN_EXPORT obj_res lean_byte_array_push(obj_arg a, uint8 b) {
 }
 
 extern "C" LEAN_EXPORT uint64_t lean_byte_array_hash(b_obj_arg a) {
-    return hash_str(lean_sarray_size(a), lean_sarray_cptr(a), 11);
+    return hash_bytes(lean_sarray_size(a), lean_sarray_cptr(a), 11);
 }
 
 extern "C" LEAN_EXPORT obj_res lean_copy_float_array(obj_arg a) {
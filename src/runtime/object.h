@@ -263,6 +263,17 @@ inline uint8 string_dec_eq(b_obj_arg s1, b_obj_arg s2) { return string_eq(s1, s2
 inline uint8 string_dec_lt(b_obj_arg s1, b_obj_arg s2) { return string_lt(s1, s2); }
 inline uint64 string_hash(b_obj_arg s) { return lean_string_hash(s); }
 
+/* Strings of at least `LEAN_STRING_CACHED_HASH_MIN_SIZE` bytes stored in compact regions keep their
+   `lean_string_hash` in the last eight bytes of their capacity, and have `m_other` set to
+   `LEAN_STRING_CACHED_HASH`. Other strings have `m_other == 0`. */
+#define LEAN_STRING_CACHED_HASH 1
+#ifndef LEAN_STRING_CACHED_HASH_MIN_SIZE
+#define LEAN_STRING_CACHED_HASH_MIN_SIZE 64
+#endif
+inline uint64 * string_cached_hash_slot(b_obj_arg s) {
+    return reinterpret_cast<uint64 *>(lean_to_string(s)->m_data + lean_string_capacity(s) - sizeof(uint64));
+}
+
 // =======================================
 // Thunks
 
@@ -320,6 +331,7 @@ inline obj_res usize_to_nat(usize n) { return lean_usize_to_nat(n); }
 inline obj_res mk_nat_obj(unsigned n) { return lean_unsigned_to_nat(n); }
 inline obj_res uint64_to_nat(uint64 n) { return lean_uint64_to_nat(n); }
 inline obj_res nat_succ(b_obj_arg a) { return lean_nat_succ(a); }
+inline obj_res nat_log2(b_obj_arg a) { return lean_nat_log2(a); }
 inline obj_res nat_add(b_obj_arg a1, b_obj_arg a2) { return lean_nat_add(a1, a2); }
 inline obj_res nat_sub(b_obj_arg a1, b_obj_arg a2) { return lean_nat_sub(a1, a2); }
 inline obj_res nat_mul(b_obj_arg a1, b_obj_arg a2) { return lean_nat_mul(a1, a2); }
@@ -23,7 +23,18 @@ Author: Jared Roesch
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <signal.h>
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+// `posix_spawn_file_actions_addchdir_np` is available since glibc 2.29
+#define LEAN_USE_POSIX_SPAWN
+#include <spawn.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+extern char ** environ;
+#endif
 #endif
 
 #include "runtime/object.h"
@@ -33,6 +44,7 @@ Author: Jared Roesch
 #include "runtime/option_ref.h"
 #include "runtime/pair_ref.h"
 #include "runtime/buffer.h"
+#include "runtime/reactor.h"
 
 namespace lean {
 
@@ -81,9 +93,8 @@ extern "C" LEAN_EXPORT obj_res lean_io_process_child_kill(b_obj_arg, b_obj_arg c
     return lean_io_result_mk_ok(box(0));
 }
 
-static FILE * from_win_handle(HANDLE handle, char const * mode) {
-    int fd = _open_osfhandle(reinterpret_cast<intptr_t>(handle), _O_APPEND);
-    return fdopen(fd, mode);
+static int from_win_handle(HANDLE handle) {
+    return _open_osfhandle(reinterpret_cast<intptr_t>(handle), _O_APPEND);
 }
 
 static void setup_stdio(SECURITY_ATTRIBUTES * saAttr, HANDLE * theirs, object ** ours, bool in, stdio cfg) {
@@ -99,7 +110,7 @@ static void setup_stdio(SECURITY_ATTRIBUTES * saAttr, HANDLE * theirs, object **
         HANDLE writeh;
         if (!CreatePipe(&readh, &writeh, saAttr, 0))
             throw std::system_error(GetLastError(), std::system_category());
-        *ours = io_wrap_handle(in ? from_win_handle(writeh, "w") : from_win_handle(readh, "r"));
+        *ours = io_wrap_fd(from_win_handle(in ? writeh : readh));
         *theirs = in ? readh : writeh;
         // Ensure the write handle to the pipe for STDIN is not inherited.
         lean_always_assert(SetHandleInformation(in ? writeh : readh, HANDLE_FLAG_INHERIT, 0));
@@ -257,6 +268,16 @@ extern "C" LEAN_EXPORT obj_res lean_io_process_get_pid(obj_arg) {
     return lean_io_result_mk_ok(box_uint32(getpid()));
 }
 
+static unsigned exit_code_of_status(int status) {
+    if (WIFEXITED(status)) {
+        return static_cast<unsigned>(WEXITSTATUS(status));
+    } else {
+        lean_assert(WIFSIGNALED(status));
+        // use bash's convention
+        return 128 + static_cast<unsigned>(WTERMSIG(status));
+    }
+}
+
 extern "C" LEAN_EXPORT obj_res lean_io_process_child_wait(b_obj_arg, b_obj_arg child, obj_arg) {
     static_assert(sizeof(pid_t) == sizeof(uint32), "pid_t is expected to be a 32-bit type"); // NOLINT
     pid_t pid = cnstr_get_uint32(child, 3 * sizeof(object *));
@@ -264,15 +285,10 @@ extern "C" LEAN_EXPORT obj_res lean_io_process_child_wait(b_obj_arg, b_obj_arg c
     if (waitpid(pid, &status, 0) == -1) {
         return io_result_mk_error(decode_io_error(errno, nullptr));
     }
-    if (WIFEXITED(status)) {
-        return lean_io_result_mk_ok(box_uint32(static_cast<unsigned>(WEXITSTATUS(status))));
-    } else {
-        lean_assert(WIFSIGNALED(status));
-        // use bash's convention
-        return lean_io_result_mk_ok(box_uint32(128 + static_cast<unsigned>(WTERMSIG(status))));
-    }
+    return lean_io_result_mk_ok(box_uint32(exit_code_of_status(status)));
 }
 
+
 extern "C" LEAN_EXPORT obj_res lean_io_process_child_kill(b_obj_arg, b_obj_arg child, obj_arg) {
     static_assert(sizeof(pid_t) == sizeof(uint32), "pid_t is expected to be a 32-bit type"); // NOLINT
     pid_t pid = cnstr_get_uint32(child, 3 * sizeof(object *));
@@ -309,6 +325,138 @@ static optional<pipe> setup_stdio(stdio cfg) {
     lean_unreachable();
 }
 
+#ifdef LEAN_USE_POSIX_SPAWN
+/* Environment of the child process: the current environment with the variables of `env` set or removed. */
+static std::vector<std::string> mk_child_env(array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env) {
+    std::vector<std::string> r;
+    for (char ** e = environ; *e; e++)
+        r.push_back(*e);
+    for (auto & entry : env) {
+        std::string prefix = std::string(entry.fst().data()) + "=";
+        r.erase(std::remove_if(r.begin(), r.end(), [&](std::string const & e) { return e.compare(0, prefix.size(), prefix) == 0; }), r.end());
+        if (entry.snd())
+            r.push_back(prefix + entry.snd().get()->data());
+    }
+    return r;
+}
+
+/* Search `path` for an executable named `prog`, as `execvp` would in the child. `posix_spawnp` searches the `PATH`
+   of the parent, so we have to do this ourselves when the child gets a different `PATH`. Relative entries, including
+   the empty entry meaning the current directory, are relative to the working directory `cwd` of the child if it is
+   given. The result is an absolute path, since the child may change its directory before executing it. */
+static optional<std::string> find_program(std::string const & prog, std::string const & path, option_ref<string_ref> const & cwd) {
+    std::string parent_cwd;
+    if (char * d = getcwd(nullptr, 0)) {
+        parent_cwd = d;
+        free(d);
+    }
+    size_t i = 0;
+    while (true) {
+        size_t j = path.find(':', i);
+        std::string dir = path.substr(i, j == std::string::npos ? std::string::npos : j - i);
+        if (dir.empty())
+            dir = ".";
+        if (dir[0] != '/' && cwd)
+            dir = std::string(cwd.get()->data()) + "/" + dir;
+        if (dir[0] != '/')
+            dir = parent_cwd + "/" + dir;
+        std::string cand = dir + "/" + prog;
+        struct stat st;
+        if (::stat(cand.c_str(), &st) == 0 && S_ISREG(st.st_mode) && ::access(cand.c_str(), X_OK) == 0)
+            return optional<std::string>(cand);
+        if (j == std::string::npos)
+            return optional<std::string>();
+        i = j + 1;
+    }
+}
+
+struct spawn_file_actions {
+    posix_spawn_file_actions_t m_val;
+    spawn_file_actions() { if (int err = posix_spawn_file_actions_init(&m_val)) throw err; }
+    ~spawn_file_actions() { posix_spawn_file_actions_destroy(&m_val); }
+    void check(int err) { if (err) throw err; }
+    void setup_stdio(int fd, stdio mode, optional<pipe> const & p, bool is_input) {
+        // the other end of the pipe is closed on `exec` as it has `O_CLOEXEC` set
+        if (p)
+            check(posix_spawn_file_actions_adddup2(&m_val, is_input ? p->m_read_fd : p->m_write_fd, fd));
+        else if (mode == stdio::NUL)
+            check(posix_spawn_file_actions_addopen(&m_val, fd, "/dev/null", is_input ? O_RDONLY : O_WRONLY, 0));
+    }
+};
+
+struct spawn_attr {
+    posix_spawnattr_t m_val;
+    spawn_attr() { if (int err = posix_spawnattr_init(&m_val)) throw err; }
+    ~spawn_attr() { posix_spawnattr_destroy(&m_val); }
+};
+
+/* Start the child process using `posix_spawn`, which does not copy the page tables of the parent (glibc uses
+   `clone(CLONE_VM | CLONE_VFORK)`) and thus stays cheap for parents with a large heap. Unlike with `fork`, we
+   cannot run arbitrary code in the child, so the environment is passed explicitly and redirections, the working
+   directory and `setsid` are expressed as file actions and attributes. Failures to execute the program or to
+   change the directory are reported to the caller. */
+static pid_t spawn_child(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode,
+  optional<pipe> const & stdin_pipe, stdio stdout_mode, optional<pipe> const & stdout_pipe, stdio stderr_mode,
+  optional<pipe> const & stderr_pipe, option_ref<string_ref> const & cwd,
+  array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env, bool do_setsid) {
+    spawn_file_actions actions;
+    actions.setup_stdio(STDIN_FILENO, stdin_mode, stdin_pipe, true);
+    actions.setup_stdio(STDOUT_FILENO, stdout_mode, stdout_pipe, false);
+    actions.setup_stdio(STDERR_FILENO, stderr_mode, stderr_pipe, false);
+    if (cwd)
+        actions.check(posix_spawn_file_actions_addchdir_np(&actions.m_val, cwd.get()->data()));
+
+    spawn_attr attr;
+    if (do_setsid) {
+        if (int err = posix_spawnattr_setflags(&attr.m_val, POSIX_SPAWN_SETSID)) throw err;
+    }
+
+    std::vector<std::string> child_env = mk_child_env(env);
+    std::vector<char *> envp;
+    for (std::string & e : child_env)
+        envp.push_back(const_cast<char *>(e.c_str()));
+    envp.push_back(nullptr);
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(proc_name.data()));
+    for (auto & arg : args)
+        argv.push_back(const_cast<char *>(arg.data()));
+    argv.push_back(nullptr);
+
+    std::string prog = proc_name.data();
+    bool search = prog.find('/') == std::string::npos;
+    if (search) {
+        for (auto & entry : env) {
+            if (strcmp(entry.fst().data(), "PATH") == 0) {
+                // resolve against the `PATH` of the child; an unset `PATH` makes `execvp` fall back to a default
+                char const * path = entry.snd() ? entry.snd().get()->data() : "/bin:/usr/bin";
+                if (auto p = find_program(prog, path, cwd)) {
+                    prog   = *p;
+                    search = false;
+                } else {
+                    throw ENOENT;
+                }
+            }
+        }
+    }
+
+    pid_t pid;
+    int err = search ?
+        posix_spawnp(&pid, prog.c_str(), &actions.m_val, &attr.m_val, argv.data(), envp.data()) :
+        posix_spawn(&pid, prog.c_str(), &actions.m_val, &attr.m_val, argv.data(), envp.data());
+    if (err)
+        throw err;
+    return pid;
+}
+
+static void close_pipe(optional<pipe> const & p) {
+    if (p) {
+        close(p->m_read_fd);
+        close(p->m_write_fd);
+    }
+}
+#endif
+
 static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode, stdio stdout_mode,
   stdio stderr_mode, option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env,
   bool do_setsid) {
@@ -317,6 +465,18 @@ static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const &
     auto stdout_pipe = setup_stdio(stdout_mode);
     auto stderr_pipe = setup_stdio(stderr_mode);
 
+#ifdef LEAN_USE_POSIX_SPAWN
+    pid_t pid;
+    try {
+        pid = spawn_child(proc_name, args, stdin_mode, stdin_pipe, stdout_mode, stdout_pipe, stderr_mode, stderr_pipe,
+                          cwd, env, do_setsid);
+    } catch (int) {
+        close_pipe(stdin_pipe);
+        close_pipe(stdout_pipe);
+        close_pipe(stderr_pipe);
+        throw;
+    }
+#else
     int pid = fork();
 
     if (pid == 0) {
@@ -376,23 +536,24 @@ static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const &
     } else if (pid == -1) {
         throw errno;
     }
+#endif
 
     object * parent_stdin  = box(0);
     object * parent_stdout = box(0);
     object * parent_stderr = box(0);
     if (stdin_pipe) {
         close(stdin_pipe->m_read_fd);
-        parent_stdin = io_wrap_handle(fdopen(stdin_pipe->m_write_fd, "w"));
+        parent_stdin = io_wrap_fd(stdin_pipe->m_write_fd);
     }
 
     if (stdout_pipe) {
         close(stdout_pipe->m_write_fd);
-        parent_stdout = io_wrap_handle(fdopen(stdout_pipe->m_read_fd, "r"));
+        parent_stdout = io_wrap_fd(stdout_pipe->m_read_fd);
     }
 
     if (stderr_pipe) {
         close(stderr_pipe->m_write_fd);
-        parent_stderr = io_wrap_handle(fdopen(stderr_pipe->m_read_fd, "r"));
+        parent_stderr = io_wrap_fd(stderr_pipe->m_read_fd);
     }
 
     object_ref r = mk_cnstr(0, parent_stdin, parent_stdout, parent_stderr, sizeof(pid_t) + sizeof(uint8_t));
@@ -426,6 +587,17 @@ extern "C" LEAN_EXPORT obj_res lean_io_process_spawn(obj_arg args_, obj_arg) {
     if (stdin_mode == stdio::INHERIT) {
         std::cout.flush();
     }
+#ifdef LEAN_USE_POSIX_SPAWN
+    // report a missing working directory with its name rather than as a missing program
+    if (!is_scalar(cnstr_get(args.raw(), 3))) {
+        object * cwd = cnstr_get(cnstr_get(args.raw(), 3), 0);
+        struct stat st;
+        if (::stat(string_cstr(cwd), &st) != 0)
+            return lean_io_result_mk_error(decode_io_error(errno, cwd));
+        if (!S_ISDIR(st.st_mode))
+            return lean_io_result_mk_error(decode_io_error(ENOTDIR, cwd));
+    }
+#endif
     try {
         return spawn(
                 cnstr_get_ref_t<string_ref>(args, 1),
@@ -437,11 +609,66 @@ extern "C" LEAN_EXPORT obj_res lean_io_process_spawn(obj_arg args_, obj_arg) {
                 cnstr_get_ref_t<array_ref<pair_ref<string_ref, option_ref<string_ref>>>>(args, 4),
                 cnstr_get_uint8(args.raw(), 5 * sizeof(object *)));
     } catch (int err) {
-        return lean_io_result_mk_error(decode_io_error(err, nullptr));
+        // report errors such as a missing executable with the program name
+        return lean_io_result_mk_error(decode_io_error(err, cnstr_get(args.raw(), 1)));
     } catch (std::system_error const & err) {
         // TODO: decode
         return lean_io_result_mk_error(lean_mk_io_error_other_error(err.code().value(), mk_string(err.code().message())));
     }
 }
 
+/* (cfg : StdioConfig) (child : Child cfg) : IO UInt32 */
+static obj_res io_child_wait_fn(obj_arg cfg, obj_arg child, obj_arg w) {
+    obj_res r = lean_io_process_child_wait(cfg, child, w);
+    dec(cfg);
+    dec(child);
+    return r;
+}
+
+/* Wait for the child on a dedicated thread. */
+static obj_res lean_io_process_child_wait_async_fallback(b_obj_arg cfg, b_obj_arg child, obj_arg) {
+    object * c = alloc_closure(io_child_wait_fn, 2);
+    inc(cfg);
+    inc(child);
+    closure_set(c, 0, cfg);
+    closure_set(c, 1, child);
+    return io_result_mk_ok(io_dedicated_task(c));
+}
+
+#ifdef LEAN_IO_REACTOR
+/* Child.waitAsync {cfg : @& StdioConfig} : @& Child cfg → BaseIO (Task (Except IO.Error UInt32)) */
+extern "C" LEAN_EXPORT obj_res lean_io_process_child_wait_async(b_obj_arg cfg, b_obj_arg child, obj_arg w) {
+    pid_t pid = cnstr_get_uint32(child, 3 * sizeof(object *));
+    // A pidfd becomes readable when the process terminates. It is available since Linux 5.3.
+#ifdef SYS_pidfd_open
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    int pidfd = -1;
+#endif
+    if (pidfd < 0)
+        return lean_io_process_child_wait_async_fallback(cfg, child, w);
+    object * promise = promise_new();
+    inc(promise);
+    int err = reactor_watch(pidfd, EPOLLIN, [=](int) {
+        int status;
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == 0 || (r < 0 && errno == EINTR))
+            return false;
+        if (r < 0)
+            promise_resolve(promise, mk_except_error(decode_io_error(errno, nullptr)));
+        else
+            promise_resolve(promise, mk_except_ok(box_uint32(exit_code_of_status(status))));
+        return true;
+    });
+    close(pidfd);
+    if (err != 0)
+        promise_resolve(promise, mk_except_error(decode_io_error(err, nullptr)));
+    return io_result_mk_ok(promise);
+}
+#else
+extern "C" LEAN_EXPORT obj_res lean_io_process_child_wait_async(b_obj_arg cfg, b_obj_arg child, obj_arg w) {
+    return lean_io_process_child_wait_async_fallback(cfg, child, w);
+}
+#endif
+
 }
@@ -0,0 +1,268 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "runtime/reactor.h"
+#include "runtime/object.h"
+#include "runtime/io.h"
+#include "runtime/thread.h"
+#include "runtime/exception.h"
+
+#ifdef LEAN_IO_REACTOR
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace lean {
+obj_res mk_except_ok(obj_arg v) {
+    object * r = alloc_cnstr(1, 1, 0);
+    cnstr_set(r, 0, v);
+    return r;
+}
+
+obj_res mk_except_error(obj_arg e) {
+    object * r = alloc_cnstr(0, 1, 0);
+    cnstr_set(r, 0, e);
+    return r;
+}
+
+obj_res io_result_to_except(obj_arg r) {
+    object * e;
+    if (io_result_is_ok(r)) {
+        inc(io_result_get_value(r));
+        e = mk_except_ok(io_result_get_value(r));
+    } else {
+        inc(io_result_get_error(r));
+        e = mk_except_error(io_result_get_error(r));
+    }
+    dec(r);
+    return e;
+}
+
+/* (act : IO α) (_ : IO.RealWorld) : BaseIO (Except IO.Error α) */
+static obj_res io_to_except_fn(obj_arg act, obj_arg w) {
+    return io_result_mk_ok(io_result_to_except(apply_1(act, w)));
+}
+
+extern "C" LEAN_EXPORT obj_res lean_io_as_task(obj_arg act, obj_arg prio, obj_arg);
+extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg);
+extern "C" LEAN_EXPORT obj_res lean_io_promise_resolve(obj_arg value, b_obj_arg promise, obj_arg);
+
+obj_res io_dedicated_task(obj_arg act) {
+    object * c = alloc_closure(io_to_except_fn, 1);
+    closure_set(c, 0, act);
+    // `Task.Priority.dedicated`
+    object * r = lean_io_as_task(c, box(9), io_mk_world());
+    object * t = io_result_get_value(r);
+    inc(t);
+    dec(r);
+    return t;
+}
+
+obj_res promise_new() {
+    object * r = lean_io_promise_new(io_mk_world());
+    object * p = io_result_get_value(r);
+    inc(p);
+    dec(r);
+    return p;
+}
+
+void promise_resolve(obj_arg promise, obj_arg v) {
+    dec(lean_io_promise_resolve(v, promise, io_mk_world()));
+    dec(promise);
+}
+
+#ifdef LEAN_IO_REACTOR
+struct reactor_watch_entry {
+    int                       m_fd;
+    uint32_t                  m_events;
+    std::function<bool(int)>  m_fn;
+};
+
+struct reactor_timer {
+    std::chrono::steady_clock::time_point m_deadline;
+    std::function<void()>                 m_fn;
+};
+
+static bool operator<(reactor_timer const & a, reactor_timer const & b) {
+    // `std::push_heap` builds a max-heap, we want the earliest deadline on top
+    return a.m_deadline > b.m_deadline;
+}
+
+class io_reactor {
+    int                         m_epoll_fd;
+    int                         m_wake_fd;
+    mutex                       m_mutex;
+    std::vector<reactor_timer>  m_timers; // protected by `m_mutex`
+    atomic<bool>                m_stop{false};
+    std::unique_ptr<lthread>    m_thread;
+
+    void wake() {
+        uint64_t one = 1;
+        while (::write(m_wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+
+    int next_timeout() {
+        unique_lock<mutex> lock(m_mutex);
+        if (m_timers.empty())
+            return -1;
+        auto d = m_timers.front().m_deadline - std::chrono::steady_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+        // round up so that we do not wake up right before the deadline
+        return ms < 0 ? 0 : static_cast<int>(std::min<decltype(ms)>(ms + 1, 60 * 1000));
+    }
+
+    void run_timers() {
+        std::vector<std::function<void()>> fns;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            auto now = std::chrono::steady_clock::now();
+            while (!m_timers.empty() && m_timers.front().m_deadline <= now) {
+                std::pop_heap(m_timers.begin(), m_timers.end());
+                fns.push_back(std::move(m_timers.back().m_fn));
+                m_timers.pop_back();
+            }
+        }
+        for (auto & fn : fns)
+            fn();
+    }
+
+    void ready(reactor_watch_entry * w) {
+        if (w->m_fn(w->m_fd)) {
+            // the duplicate shares the open file description with the original descriptor, so closing it does not
+            // remove it from the interest list
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, w->m_fd, nullptr);
+            close(w->m_fd);
+            delete w;
+        } else {
+            epoll_event ev;
+            ev.events   = w->m_events | EPOLLONESHOT;
+            ev.data.ptr = w;
+            lean_always_assert(epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, w->m_fd, &ev) == 0);
+        }
+    }
+
+    void loop() {
+        epoll_event evs[64];
+        while (!m_stop) {
+            int n = epoll_wait(m_epoll_fd, evs, 64, next_timeout());
+            if (n < 0) {
+                lean_always_assert(errno == EINTR);
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                if (evs[i].data.ptr == nullptr) {
+                    uint64_t cnt;
+                    while (::read(m_wake_fd, &cnt, sizeof(cnt)) < 0 && errno == EINTR) {}
+                } else {
+                    ready(static_cast<reactor_watch_entry *>(evs[i].data.ptr));
+                }
+            }
+            run_timers();
+        }
+    }
+
+public:
+    io_reactor() {
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll_fd < 0)
+            throw exception("failed to create I/O reactor");
+        m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_wake_fd < 0)
+            throw exception("failed to create I/O reactor");
+        epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = nullptr;
+        lean_always_assert(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) == 0);
+        m_thread.reset(new lthread([this]() { loop(); }));
+    }
+
+    ~io_reactor() {
+        m_stop = true;
+        wake();
+        m_thread->join();
+        // Pending operations are dropped; like unresolved promises, the tasks waiting for them are leaked.
+        close(m_wake_fd);
+        close(m_epoll_fd);
+    }
+
+    int watch(int fd, uint32_t events, std::function<bool(int)> const & fn) {
+        /* Watch a non-blocking descriptor, so that when several operations are pending on the same file, the ones
+           losing the race for the available data do not block the reactor thread, and so that closing the original
+           does not affect them. A duplicate shares the open file description, and thus its blocking mode, with the
+           original, so unless the file is already non-blocking we reopen it, which is possible for pipes and
+           terminals, but not for sockets. */
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0)
+            return errno;
+        int dup_fd;
+        if (flags & O_NONBLOCK) {
+            dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        } else {
+            std::string path = "/proc/self/fd/" + std::to_string(fd);
+            dup_fd = open(path.c_str(), (flags & O_ACCMODE) | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+        }
+        if (dup_fd < 0)
+            return errno;
+        reactor_watch_entry * w = new reactor_watch_entry{dup_fd, events, fn};
+        epoll_event ev;
+        ev.events   = events | EPOLLONESHOT;
+        ev.data.ptr = w;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, dup_fd, &ev) != 0) {
+            int err = errno;
+            close(dup_fd);
+            delete w;
+            return err;
+        }
+        return 0;
+    }
+
+    void add_timer(unsigned ms, std::function<void()> const & fn) {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_timers.push_back(reactor_timer{std::chrono::steady_clock::now() + std::chrono::milliseconds(ms), fn});
+            std::push_heap(m_timers.begin(), m_timers.end());
+        }
+        wake();
+    }
+};
+
+static mutex *      g_reactor_mutex = nullptr;
+static io_reactor * g_reactor       = nullptr;
+
+/* The reactor thread is only started on first use. */
+static io_reactor & get_reactor() {
+    unique_lock<mutex> lock(*g_reactor_mutex);
+    if (!g_reactor)
+        g_reactor = new io_reactor();
+    return *g_reactor;
+}
+
+int reactor_watch(int fd, uint32_t events, std::function<bool(int)> const & fn) {
+    return get_reactor().watch(fd, events, fn);
+}
+
+void reactor_add_timer(unsigned ms, std::function<void()> const & fn) {
+    get_reactor().add_timer(ms, fn);
+}
+
+void initialize_reactor() {
+    g_reactor_mutex = new mutex();
+}
+
+void finalize_reactor() {
+    delete g_reactor;
+    g_reactor = nullptr;
+    delete g_reactor_mutex;
+}
+#else
+void initialize_reactor() {}
+void finalize_reactor() {}
+#endif
+}
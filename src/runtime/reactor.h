@@ -0,0 +1,46 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <functional>
+#include <lean/lean.h>
+
+#if defined(LEAN_MULTI_THREAD) && defined(__linux__) && defined(__GLIBC__)
+#define LEAN_IO_REACTOR
+#include <sys/epoll.h>
+#endif
+
+namespace lean {
+/* `Except.ok v` and `Except.error e` */
+lean_obj_res mk_except_ok(lean_obj_arg v);
+lean_obj_res mk_except_error(lean_obj_arg e);
+/* `Except IO.Error α` value of the `IO α` result `r`. */
+lean_obj_res io_result_to_except(lean_obj_arg r);
+
+/* Run the `IO α` action `act` on a dedicated thread. Returns a `Task (Except IO.Error α)`. This is how asynchronous
+   operations are implemented where the reactor is not available. */
+lean_obj_res io_dedicated_task(lean_obj_arg act);
+
+/* Create a promise, i.e. an unresolved task that is resolved by `promise_resolve`. */
+lean_obj_res promise_new();
+/* Resolve `promise` with `v`, consuming both. */
+void promise_resolve(lean_obj_arg promise, lean_obj_arg v);
+
+#ifdef LEAN_IO_REACTOR
+/* The reactor is a single thread waiting for file descriptors to become ready (using `epoll`) and for timers to
+   expire, so that tasks waiting for I/O do not block a thread each. Callbacks run on the reactor thread and must
+   not block. */
+
+/* Call `fn` on a non-blocking duplicate of `fd` each time one of `events` (e.g. `EPOLLIN`) is ready, until it
+   returns `true`. The duplicate is closed afterwards. Returns an error code if `fd` cannot be watched (e.g. `EPERM`
+   for regular files, which are always ready, or `ENXIO` for blocking sockets), in which case `fn` is never called. */
+int reactor_watch(int fd, uint32_t events, std::function<bool(int)> const & fn);
+
+/* Call `fn` on the reactor thread after `ms` milliseconds. */
+void reactor_add_timer(unsigned ms, std::function<void()> const & fn);
+#endif
+
+void initialize_reactor();
+void finalize_reactor();
+}
@@ -6,8 +6,13 @@ Author: Leonardo de Moura
 */
 #include <vector>
 #include <cstring>
+#include <utility>
+#include <algorithm>
+#include <unordered_set>
 #include "runtime/object.h"
 #include "runtime/hash.h"
+#include "runtime/thread.h"
+#include "runtime/sharecommon.h"
 
 namespace lean {
 
@@ -33,7 +38,7 @@ extern "C" LEAN_EXPORT uint64_t lean_sharecommon_hash(b_obj_arg o) {
     // hash relevant parts of the header
     unsigned init = hash(lean_ptr_tag(o), lean_ptr_other(o));
     // hash body
-    return hash_str(sz - header_sz, reinterpret_cast<unsigned char const *>(o) + header_sz, init);
+    return hash_bytes(sz - header_sz, reinterpret_cast<unsigned char const *>(o) + header_sz, init);
 }
 
 static obj_res mk_pair(obj_arg a, obj_arg b) {
@@ -76,9 +81,16 @@ public:
         return r;
     }
 
-    obj_res map_find(b_obj_arg k) {
+    /* Return the maximally shared representative of `k` (a borrowed reference), or `nullptr`. */
+    b_obj_res map_find(b_obj_arg k) {
         lean_inc(m_map_find); lean_inc(m_map); lean_inc(k);
-        return lean_apply_2(m_map_find, m_map, k);
+        obj_res o = lean_apply_2(m_map_find, m_map, k);
+        if (o == lean_box(0))
+            return nullptr;
+        b_obj_res r = lean_ctor_get(o, 0);
+        lean_dec(o);
+        // The map still has a reference to `r`
+        return r;
     }
 
     void map_insert(obj_arg k, obj_arg v) {
@@ -86,9 +98,15 @@ public:
         m_map = lean_apply_3(m_map_insert, m_map, k, v);
     }
 
-    obj_res set_find(b_obj_arg o) {
+    /* Return the object in the set that is structurally equal to `o` (a borrowed reference), or `nullptr`. */
+    b_obj_res set_find(b_obj_arg o) {
         lean_inc(m_set_find); lean_inc(m_set); lean_inc(o);
-        return lean_apply_2(m_set_find, m_set, o);
+        obj_res r = lean_apply_2(m_set_find, m_set, o);
+        if (r == lean_box(0))
+            return nullptr;
+        b_obj_res v = lean_ctor_get(r, 0);
+        lean_dec(r);
+        return v;
     }
 
     void set_insert(obj_arg o) {
@@ -97,8 +115,190 @@ public:
     }
 };
 
+/*
+Native hash-consing table. It is used by `ShareCommon.StateFactory.native`, and it is stored in
+a `ShareCommon.State` as an external object. Both the map (from objects to their maximally shared
+representatives, keyed by pointer) and the set (of maximally shared objects, keyed by
+`lean_sharecommon_hash`/`lean_sharecommon_eq`) are open-addressing tables with linear probing.
+The table owns a reference to each object it contains.
+*/
+#define LEAN_SHARECOMMON_TABLE_INITIAL_SIZE 1024
+
+class sharecommon_table {
+    struct map_entry {
+        lean_object * m_key;
+        lean_object * m_value;
+    };
+    struct set_entry {
+        lean_object * m_obj;
+        uint64        m_hash;
+    };
+    std::vector<map_entry> m_map;
+    size_t                 m_map_size = 0;
+    std::vector<set_entry> m_set;
+    size_t                 m_set_size = 0;
+
+    static size_t hash_ptr(lean_object * o) {
+        return static_cast<size_t>(hash(11, reinterpret_cast<size_t>(o)));
+    }
+
+    static size_t map_index(std::vector<map_entry> const & m, lean_object * k) {
+        size_t mask = m.size() - 1;
+        size_t i    = hash_ptr(k) & mask;
+        while (m[i].m_key != nullptr && m[i].m_key != k)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    static size_t set_index(std::vector<set_entry> const & s, lean_object * o, uint64 h) {
+        size_t mask = s.size() - 1;
+        size_t i    = static_cast<size_t>(h) & mask;
+        while (s[i].m_obj != nullptr && (s[i].m_hash != h || !lean_sharecommon_eq(s[i].m_obj, o)))
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void grow_map() {
+        std::vector<map_entry> new_map(m_map.size() * 2, map_entry{nullptr, nullptr});
+        for (map_entry const & e : m_map) {
+            if (e.m_key != nullptr)
+                new_map[map_index(new_map, e.m_key)] = e;
+        }
+        m_map.swap(new_map);
+    }
+
+    void grow_set() {
+        std::vector<set_entry> new_set(m_set.size() * 2, set_entry{nullptr, 0});
+        for (set_entry const & e : m_set) {
+            if (e.m_obj != nullptr)
+                new_set[set_index(new_set, e.m_obj, e.m_hash)] = e;
+        }
+        m_set.swap(new_set);
+    }
+
+public:
+    sharecommon_table():
+        m_map(LEAN_SHARECOMMON_TABLE_INITIAL_SIZE, map_entry{nullptr, nullptr}),
+        m_set(LEAN_SHARECOMMON_TABLE_INITIAL_SIZE, set_entry{nullptr, 0}) {}
+
+    sharecommon_table(sharecommon_table const & t):
+        m_map(t.m_map), m_map_size(t.m_map_size), m_set(t.m_set), m_set_size(t.m_set_size) {
+        for_each([](lean_object * o) { lean_inc(o); });
+    }
+
+    ~sharecommon_table() {
+        for_each([](lean_object * o) { lean_dec(o); });
+    }
+
+    template<typename F> void for_each(F && f) const {
+        for (map_entry const & e : m_map) {
+            if (e.m_key != nullptr) {
+                f(e.m_key);
+                f(e.m_value);
+            }
+        }
+        for (set_entry const & e : m_set) {
+            if (e.m_obj != nullptr)
+                f(e.m_obj);
+        }
+    }
+
+    b_obj_res map_find(b_obj_arg k) const {
+        return m_map[map_index(m_map, k)].m_value;
+    }
+
+    void map_insert(obj_arg k, obj_arg v) {
+        map_entry & e = m_map[map_index(m_map, k)];
+        if (e.m_key != nullptr) {
+            lean_dec(k);
+            lean_dec(e.m_value);
+            e.m_value = v;
+            return;
+        }
+        e.m_key   = k;
+        e.m_value = v;
+        m_map_size++;
+        if (2 * m_map_size > m_map.size())
+            grow_map();
+    }
+
+    b_obj_res set_find(b_obj_arg o) const {
+        return m_set[set_index(m_set, o, lean_sharecommon_hash(o))].m_obj;
+    }
+
+    void set_insert(obj_arg o) {
+        uint64 h = lean_sharecommon_hash(o);
+        set_entry & e = m_set[set_index(m_set, o, h)];
+        if (e.m_obj != nullptr) {
+            lean_dec(o);
+            return;
+        }
+        e.m_obj  = o;
+        e.m_hash = h;
+        m_set_size++;
+        if (2 * m_set_size > m_set.size())
+            grow_set();
+    }
+};
+
+static lean_external_class * g_sharecommon_table_external_class = nullptr;
+
+static void sharecommon_table_finalizer(void * t) {
+    delete static_cast<sharecommon_table *>(t);
+}
+
+static void sharecommon_table_foreach(void * t, b_obj_arg fn) {
+    static_cast<sharecommon_table *>(t)->for_each([&](lean_object * o) {
+            lean_inc(fn); lean_inc(o);
+            lean_dec(lean_apply_1(fn, o));
+        });
+}
+
+static obj_res mk_sharecommon_table(sharecommon_table * t) {
+    return lean_alloc_external(g_sharecommon_table_external_class, t);
+}
+
+/* def ShareCommon.mkNativeState (u : Unit) : NonScalar */
+extern "C" LEAN_EXPORT obj_res lean_sharecommon_mk_native_state(obj_arg) {
+    return mk_sharecommon_table(new sharecommon_table());
+}
+
+/* State for `sharecommon_fn` backed by a `sharecommon_table`. The table is updated in place
+   when the state is not shared, and copied otherwise. */
+class sharecommon_native_state {
+    object *            m_obj;
+    sharecommon_table * m_table;
+public:
+    sharecommon_native_state(obj_arg s) {
+        if (lean_is_exclusive(s)) {
+            m_obj = s;
+        } else {
+            m_obj = mk_sharecommon_table(new sharecommon_table(*static_cast<sharecommon_table *>(lean_get_external_data(s))));
+            lean_dec(s);
+        }
+        m_table = static_cast<sharecommon_table *>(lean_get_external_data(m_obj));
+    }
+
+    ~sharecommon_native_state() {
+        if (m_obj)
+            lean_dec(m_obj);
+    }
+
+    obj_res pack(obj_arg a) {
+        obj_res r = mk_pair(a, m_obj);
+        m_obj = nullptr;
+        return r;
+    }
+
+    b_obj_res map_find(b_obj_arg k) { return m_table->map_find(k); }
+    void map_insert(obj_arg k, obj_arg v) { m_table->map_insert(k, v); }
+    b_obj_res set_find(b_obj_arg o) { return m_table->set_find(o); }
+    void set_insert(obj_arg o) { m_table->set_insert(o); }
+};
+
+template<typename State>
 class sharecommon_fn {
-    sharecommon_state         m_state;
+    State                     m_state;
     std::vector<lean_object*> m_children;
     std::vector<lean_object*> m_todo;
 
@@ -125,11 +325,7 @@ class sharecommon_fn {
         }
 
         // Check whether we have already maximized sharing for `a`
-        obj_res o = m_state.map_find(a);
-        if (o != lean_box(0)) {
-            obj_res r = lean_ctor_get(o, 0);
-            lean_dec(o);
-            // The map still has a reference to `r`
+        if (b_obj_res r = m_state.map_find(a)) {
             m_children.push_back(r);
             // std::cout << "cached maximized " << r << "\n";
             return true;
@@ -143,12 +339,10 @@ class sharecommon_fn {
         lean_assert(m_todo.size() > 0);
         lean_assert(m_todo.back() == a);
         m_todo.pop_back();
-        obj_res opt_new_r = m_state.set_find(new_a);
-        if (opt_new_r != lean_box(0)) {
+        if (b_obj_res new_r = m_state.set_find(new_a)) {
             lean_dec(new_a); // we already have a maximally shared term equivalent to `new_a`
-            new_a = lean_ctor_get(opt_new_r, 0);
+            new_a = new_r;
             lean_inc(new_a);
-            lean_dec(opt_new_r);
             lean_inc(a);
             m_state.map_insert(a, new_a);
             // std::cout << "already maximized " << new_a << "\n";
@@ -230,7 +424,7 @@ class sharecommon_fn {
     }
 
 public:
-    sharecommon_fn(b_obj_arg tc, obj_arg s):m_state(tc, s) {}
+    template<typename... Args> sharecommon_fn(Args &&... args):m_state(std::forward<Args>(args)...) {}
 
     obj_res operator()(obj_arg a) {
         if (push_child(a)) {
@@ -254,11 +448,9 @@ public:
             }
         }
 
-        obj_res o = m_state.map_find(a);
-        lean_assert(o != lean_box(0));
-        obj_res r = lean_ctor_get(o, 0);
+        obj_res r = m_state.map_find(a);
+        lean_assert(r != nullptr);
         lean_inc(r);
-        lean_dec(o);
         lean_dec(a);
         return m_state.pack(r);
     }
@@ -266,6 +458,97 @@ public:
 
 // def State.shareCommon {α} {σ : @& StateFactory} (s : State σ) (a : α) : α × State σ
 extern "C" LEAN_EXPORT obj_res lean_state_sharecommon(b_obj_arg tc, obj_arg s, obj_arg a) {
-    return sharecommon_fn(tc, s)(a);
+    if (lean_is_external(s)) {
+        // `s` was created by `StateFactory.native`
+        return sharecommon_fn<sharecommon_native_state>(s)(a);
+    } else {
+        return sharecommon_fn<sharecommon_state>(tc, s)(a);
+    }
+}
+
+/* Global intern table, see `intern_object`. It is split into shards, each one protected by a mutex. */
+#define LEAN_INTERN_TABLE_NUM_SHARDS 64
+#define LEAN_INTERN_TABLE_MIN_SWEEP  1024
+
+class intern_table {
+    struct hash_fn { size_t operator()(object * o) const { return lean_sharecommon_hash(o); } };
+    struct eq_fn { bool operator()(object * o1, object * o2) const { return lean_sharecommon_eq(o1, o2); } };
+    struct shard {
+        mutex                                        m_mutex;
+        std::unordered_set<object *, hash_fn, eq_fn> m_objs;
+        size_t                                       m_sweep_at = LEAN_INTERN_TABLE_MIN_SWEEP;
+    };
+    shard m_shards[LEAN_INTERN_TABLE_NUM_SHARDS];
+
+    static bool only_in_table(object * o) {
+        if (lean_is_st(o))
+            return o->m_rc == 1;
+        else
+            return lean_is_mt(o) && std::atomic_load(lean_get_rc_mt_addr(o)) == -1;
+    }
+
+    /* Remove the objects that are only referenced by the table. No other thread can obtain a new reference
+       to them since the shard is locked. They are stored in `dead`, and released after the shard is unlocked. */
+    static void sweep(shard & s, std::vector<object *> & dead) {
+        for (auto it = s.m_objs.begin(); it != s.m_objs.end();) {
+            if (only_in_table(*it)) {
+                dead.push_back(*it);
+                it = s.m_objs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        s.m_sweep_at = std::max(static_cast<size_t>(LEAN_INTERN_TABLE_MIN_SWEEP), 2 * s.m_objs.size());
+    }
+
+public:
+    ~intern_table() {
+        for (shard & s : m_shards) {
+            for (object * o : s.m_objs)
+                lean_dec(o);
+        }
+    }
+
+    object * intern(object * o) {
+        shard & s = m_shards[lean_sharecommon_hash(o) % LEAN_INTERN_TABLE_NUM_SHARDS];
+        std::vector<object *> dead;
+        object * r = o;
+        {
+            lock_guard<mutex> _(s.m_mutex);
+            auto it = s.m_objs.find(o);
+            if (it != s.m_objs.end()) {
+                r = *it;
+                lean_inc(r);
+            } else {
+                lean_mark_mt(o);
+                lean_inc(o); // reference owned by the table
+                s.m_objs.insert(o);
+                if (s.m_objs.size() > s.m_sweep_at)
+                    sweep(s, dead);
+            }
+        }
+        if (r != o)
+            lean_dec(o);
+        for (object * d : dead)
+            lean_dec(d);
+        return r;
+    }
+};
+
+static intern_table * g_intern_table = nullptr;
+
+object * intern_object(object * o) {
+    if (lean_is_scalar(o))
+        return o;
+    return g_intern_table->intern(o);
+}
+
+void initialize_sharecommon() {
+    g_intern_table = new intern_table();
+    g_sharecommon_table_external_class = lean_register_external_class(sharecommon_table_finalizer, sharecommon_table_foreach);
+}
+
+void finalize_sharecommon() {
+    delete g_intern_table;
 }
 };
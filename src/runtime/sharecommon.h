@@ -0,0 +1,19 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include "runtime/object.h"
+
+namespace lean {
+/* Return the object in the global intern table that is equal to `o` according to `lean_sharecommon_eq`,
+   inserting `o` if there is none. It takes ownership of `o`.
+   The comparison is shallow: objects are equal if their fields are pointer-equal, so structurally equal
+   terms are physically shared if their subterms were interned too. Interned objects are marked as
+   multi-threaded. The table behaves like a weak table: objects only referenced by the table are removed
+   when it grows. */
+LEAN_EXPORT object * intern_object(object * o);
+
+void initialize_sharecommon();
+void finalize_sharecommon();
+}
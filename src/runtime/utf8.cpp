@@ -5,11 +5,18 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <algorithm>
 #include "runtime/debug.h"
 #include "runtime/optional.h"
 #include "runtime/utf8.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LEAN_UTF8_X86_SIMD
+#include <immintrin.h>
+#endif
+
 namespace lean {
 bool is_utf8_next(unsigned char c) { return (c & 0xC0) == 0x80; }
 
@@ -32,14 +39,188 @@ unsigned get_utf8_size(unsigned char c) {
         return 1; /* invalid */
 }
 
-extern "C" LEAN_EXPORT size_t lean_utf8_strlen(char const * str) {
+/* Return the length of an ASCII prefix of `str[0, sz)`. It is found a block at a time,
+   so it may be shorter than the longest one. */
+static inline size_t ascii_prefix(char const * str, size_t sz) {
+    size_t i = 0;
+#ifdef LEAN_UTF8_X86_SIMD
+    while (i + 16 <= sz) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + i));
+        if (_mm_movemask_epi8(v) != 0)
+            return i;
+        i += 16;
+    }
+#endif
+    while (i + 8 <= sz) {
+        uint64_t w;
+        memcpy(&w, str + i, sizeof(w));
+        if ((w & 0x8080808080808080ull) != 0)
+            return i;
+        i += 8;
+    }
+    return i;
+}
+
+#ifdef LEAN_UTF8_X86_SIMD
+static bool has_avx2() {
+    static bool r = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return r;
+}
+
+/* `_mm256_shuffle_epi8` table with the same 16 entries in both lanes. */
+__attribute__((target("avx2")))
+static inline __m256i mk_lookup(uint8_t const (&tbl)[16]) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(tbl)));
+}
+
+/* Bytes `input[-n, 32-n)`, where the first `n` ones come from the previous block. */
+template<int n> __attribute__((target("avx2")))
+static inline __m256i prev_bytes(__m256i input, __m256i prev_input) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - n);
+}
+
+/*
+   UTF-8 validation using the lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less
+   Than One Instruction Per Byte". Each byte is classified together with its predecessor
+   by three table lookups on their nibbles; sequences longer than two bytes are checked
+   using the third and fourth predecessors. Non-continuation bytes are counted on the way,
+   which is the number of unicode scalar values when the input is valid.
+*/
+class utf8_avx2_validator {
+    static constexpr uint8_t TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2, TOO_LARGE = 1 << 3,
+        SURROGATE = 1 << 4, OVERLONG_2 = 1 << 5, TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6,
+        TWO_CONTS = 1 << 7, CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+    __m256i m_tbl_1_high;
+    __m256i m_tbl_1_low;
+    __m256i m_tbl_2_high;
+    __m256i m_error;
+    __m256i m_prev_input;
+    size_t  m_count = 0;
+public:
+    __attribute__((target("avx2"))) utf8_avx2_validator() {
+        static uint8_t const byte_1_high[16] = {
+            /* 0_______ */ TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            /* 10______ */ TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            /* 1100____ */ TOO_SHORT | OVERLONG_2,
+            /* 1101____ */ TOO_SHORT,
+            /* 1110____ */ TOO_SHORT | OVERLONG_3 | SURROGATE,
+            /* 1111____ */ TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4 };
+        static uint8_t const byte_1_low[16] = {
+            /* ____0000 */ CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            /* ____0001 */ CARRY | OVERLONG_2,
+            /* ____001_ */ CARRY, CARRY,
+            /* ____0100 */ CARRY | TOO_LARGE,
+            /* ____0101 */ CARRY | TOO_LARGE | TOO_LARGE_1000,
+            /* ____011_ */ CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            /* ____1___ */ CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                           CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                           CARRY | TOO_LARGE | TOO_LARGE_1000,
+            /* ____1101 */ CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            /* ____111_ */ CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 };
+        static uint8_t const byte_2_high[16] = {
+            /* 0_______ */ TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            /* 1000____ */ TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            /* 1001____ */ TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            /* 101_____ */ TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                           TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            /* 11______ */ TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT };
+        m_tbl_1_high = mk_lookup(byte_1_high);
+        m_tbl_1_low  = mk_lookup(byte_1_low);
+        m_tbl_2_high = mk_lookup(byte_2_high);
+        m_error      = _mm256_setzero_si256();
+        m_prev_input = _mm256_setzero_si256();
+    }
+
+    /* Process the next 32 bytes, counting only the non-continuation bytes selected by `mask`. */
+    __attribute__((target("avx2"))) void step(__m256i input, uint32_t mask) {
+        __m256i const low_nibble = _mm256_set1_epi8(0x0F);
+        __m256i prev1 = prev_bytes<1>(input, m_prev_input);
+        __m256i sc = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(m_tbl_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+                _mm256_shuffle_epi8(m_tbl_1_low, _mm256_and_si256(prev1, low_nibble))),
+            _mm256_shuffle_epi8(m_tbl_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble)));
+        /* The continuation bytes that must follow 3 and 4 byte leads. */
+        __m256i is_third  = _mm256_subs_epu8(prev_bytes<2>(input, m_prev_input), _mm256_set1_epi8(0xE0 - 0x80));
+        __m256i is_fourth = _mm256_subs_epu8(prev_bytes<3>(input, m_prev_input), _mm256_set1_epi8(0xF0 - 0x80));
+        __m256i must23    = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+        m_error = _mm256_or_si256(m_error, _mm256_xor_si256(must23, sc));
+        __m256i leads = _mm256_cmpgt_epi8(input, _mm256_set1_epi8(static_cast<char>(0xBF)));
+        m_count += __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(leads)) & mask);
+        m_prev_input = input;
+    }
+
+    __attribute__((target("avx2"))) bool ok() const { return _mm256_testz_si256(m_error, m_error); }
+    size_t count() const { return m_count; }
+};
+
+__attribute__((target("avx2")))
+static bool validate_utf8_avx2(char const * str, size_t sz, size_t & len) {
+    utf8_avx2_validator v;
+    size_t i = 0;
+    for (; i + 32 <= sz; i += 32)
+        v.step(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + i)), 0xFFFFFFFFu);
+    /* The remaining bytes are padded with zeros, which also detects sequences cut off by the end. */
+    char tail[32] = {0};
+    memcpy(tail, str + i, sz - i);
+    v.step(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(tail)), (1u << (sz - i)) - 1);
+    len = v.count();
+    return v.ok();
+}
+#endif
+
+static bool validate_utf8_scalar(char const * str, size_t sz, size_t & len) {
+    unsigned char const * s = reinterpret_cast<unsigned char const *>(str);
     size_t r = 0;
-    while (*str != 0) {
-        unsigned sz = get_utf8_size(*str);
+    size_t i = 0;
+    while (i < sz) {
+        size_t n = ascii_prefix(str + i, sz - i);
+        r += n;
+        i += n;
+        if (i >= sz)
+            break;
+        unsigned c = s[i];
+        if (c < 0x80) {
+            r++;
+            i++;
+            continue;
+        }
+        /* Table 3-7 of the Unicode Standard: well-formed byte sequences. */
+        size_t k;
+        unsigned lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            k = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            k = 2;
+            if (c == 0xE0) lo = 0xA0; else if (c == 0xED) hi = 0x9F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            k = 3;
+            if (c == 0xF0) lo = 0x90; else if (c == 0xF4) hi = 0x8F;
+        } else {
+            return false;
+        }
+        if (sz - i <= k || s[i+1] < lo || s[i+1] > hi)
+            return false;
+        for (size_t j = 2; j <= k; j++)
+            if (!is_utf8_next(s[i+j]))
+                return false;
         r++;
-        str += sz;
+        i += k + 1;
     }
-    return r;
+    len = r;
+    return true;
+}
+
+bool validate_utf8(char const * str, size_t sz, size_t & len) {
+#ifdef LEAN_UTF8_X86_SIMD
+    if (sz >= 64 && has_avx2())
+        return validate_utf8_avx2(str, sz, len);
+#endif
+    return validate_utf8_scalar(str, sz, len);
+}
+
+extern "C" LEAN_EXPORT size_t lean_utf8_strlen(char const * str) {
+    return lean_utf8_n_strlen(str, strlen(str));
 }
 
 size_t utf8_strlen(char const * str) {
@@ -47,9 +228,21 @@ size_t utf8_strlen(char const * str) {
 }
 
 extern "C" LEAN_EXPORT size_t lean_utf8_n_strlen(char const * str, size_t sz) {
+#ifdef LEAN_UTF8_X86_SIMD
+    /* On valid input, the number of non-continuation bytes is the length.
+       Invalid input takes the slow path below, which defines its length. */
+    size_t len;
+    if (sz >= 64 && has_avx2() && validate_utf8_avx2(str, sz, len))
+        return len;
+#endif
     size_t r = 0;
     size_t i = 0;
     while (i < sz) {
+        size_t n = ascii_prefix(str + i, sz - i);
+        r += n;
+        i += n;
+        if (i >= sz)
+            break;
         unsigned d = get_utf8_size(str[i]);
         r++;
         i += d;
@@ -66,14 +259,18 @@ size_t utf8_strlen(std::string const & str) {
 }
 
 optional<size_t> utf8_char_pos(char const * str, size_t char_idx) {
-    size_t r = 0;
-    while (*str != 0) {
+    size_t sz = strlen(str);
+    size_t i  = 0;
+    while (i < sz) {
+        size_t n = ascii_prefix(str + i, std::min(sz - i, char_idx));
+        i        += n;
+        char_idx -= n;
+        if (i >= sz)
+            break;
         if (char_idx == 0)
-            return some<size_t>(r);
+            return some<size_t>(i);
         char_idx--;
-        unsigned sz = get_utf8_size(*str);
-        r += sz;
-        str += sz;
+        i += get_utf8_size(str[i]);
     }
     return optional<size_t>();
 }
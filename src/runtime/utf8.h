@@ -23,7 +23,12 @@ LEAN_EXPORT size_t utf8_strlen(std::string const & str);
 /* Return the length of the string `str` encoded using UTF8.
    `str` may contain null characters. */
 LEAN_EXPORT size_t utf8_strlen(char const * str, size_t sz);
+/* Return the byte offset of the unicode scalar value at index `char_idx` in the null terminated
+   string `str`, if there is one. */
 LEAN_EXPORT optional<size_t> utf8_char_pos(char const * str, size_t char_idx);
+/* Return true iff `str[0, sz)` is valid UTF-8, and store the number of unicode scalar values
+   in `len` in that case. Surrogates, overlong encodings and values above 0x10FFFF are rejected. */
+LEAN_EXPORT bool validate_utf8(char const * str, size_t sz, size_t & len);
 LEAN_EXPORT char const * get_utf8_last_char(char const * str);
 LEAN_EXPORT std::string utf8_trim(std::string const & s);
 LEAN_EXPORT unsigned utf8_to_unicode(uchar const * begin, uchar const * end);
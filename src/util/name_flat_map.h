@@ -0,0 +1,126 @@
+/*
+Copyright (c) 2024 Lean FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <vector>
+#include <utility>
+#include "util/name.h"
+
+namespace lean {
+/** \brief Mutable hash map from names to values of type `T`, using open addressing with linear probing.
+
+    Probing compares the hash codes cached in `name` objects, stored in a separate array, so a
+    lookup usually touches one cache line of hash codes and one entry. This is faster than
+    `name_map` (a red-black tree ordered by `quick_cmp`) and `name_hash_map` (chained buckets)
+    for hot caches. Unlike `name_map`, copying a `name_flat_map` copies its contents; use
+    `name_map` when cheap snapshots are needed.
+
+    Inserting may move the entries, invalidating pointers returned by `find`. */
+template<typename T> class name_flat_map {
+    typedef std::pair<name, T> entry;
+    static constexpr size_t   g_npos = static_cast<size_t>(-1);
+    static constexpr uint64_t g_used = static_cast<uint64_t>(1) << 63;
+    /* `m_hashes[i]` is `0` if slot `i` is empty, and the hash code of its key with `g_used` set otherwise. */
+    std::vector<uint64_t> m_hashes;
+    std::vector<entry>    m_entries;
+    unsigned              m_size = 0;
+
+    static uint64_t slot_hash(name const & k) { return k.hash() | g_used; }
+    size_t mask() const { return m_hashes.size() - 1; }
+
+    size_t find_slot(name const & k) const {
+        if (m_size == 0)
+            return g_npos;
+        uint64_t h = slot_hash(k);
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            if (m_hashes[i] == 0)
+                return g_npos;
+            if (m_hashes[i] == h && m_entries[i].first == k)
+                return i;
+        }
+    }
+
+    void grow() {
+        std::vector<uint64_t> hashes(m_hashes.empty() ? 8 : 2 * m_hashes.size(), 0);
+        std::vector<entry> entries(hashes.size());
+        hashes.swap(m_hashes);
+        entries.swap(m_entries);
+        for (size_t j = 0; j < hashes.size(); j++) {
+            if (hashes[j] != 0) {
+                size_t i = hashes[j] & mask();
+                while (m_hashes[i] != 0)
+                    i = (i + 1) & mask();
+                m_hashes[i]  = hashes[j];
+                m_entries[i] = std::move(entries[j]);
+            }
+        }
+    }
+
+public:
+    bool empty() const { return m_size == 0; }
+    unsigned size() const { return m_size; }
+    void clear() { m_hashes.clear(); m_entries.clear(); m_size = 0; }
+
+    T const * find(name const & k) const {
+        size_t i = find_slot(k);
+        return i == g_npos ? nullptr : &m_entries[i].second;
+    }
+    T * find(name const & k) {
+        size_t i = find_slot(k);
+        return i == g_npos ? nullptr : &m_entries[i].second;
+    }
+    bool contains(name const & k) const { return find_slot(k) != g_npos; }
+
+    /** \brief Map `k` to `v`, replacing the previous value of `k` if any. */
+    void insert(name const & k, T const & v) {
+        // keep the load factor below 1/2
+        if (2 * (m_size + 1) > m_hashes.size())
+            grow();
+        uint64_t h = slot_hash(k);
+        size_t i = h & mask();
+        for (; m_hashes[i] != 0; i = (i + 1) & mask()) {
+            if (m_hashes[i] == h && m_entries[i].first == k) {
+                m_entries[i].second = v;
+                return;
+            }
+        }
+        m_hashes[i]  = h;
+        m_entries[i] = entry(k, v);
+        m_size++;
+    }
+
+    void erase(name const & k) {
+        size_t i = find_slot(k);
+        if (i == g_npos)
+            return;
+        m_size--;
+        /* Backward-shift deletion: move later entries of the probe sequence into the hole
+           unless their home slot lies cyclically in `(i, j]`. */
+        for (size_t j = (i + 1) & mask(); m_hashes[j] != 0; j = (j + 1) & mask()) {
+            size_t home = m_hashes[j] & mask();
+            bool stays  = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays) {
+                m_hashes[i]  = m_hashes[j];
+                m_entries[i] = std::move(m_entries[j]);
+                i = j;
+            }
+        }
+        m_hashes[i]  = 0;
+        m_entries[i] = entry();
+    }
+
+    template<typename F>
+    void for_each(F && f) const {
+        for (size_t i = 0; i < m_hashes.size(); i++) {
+            if (m_hashes[i] != 0)
+                f(m_entries[i].first, m_entries[i].second);
+        }
+    }
+};
+
+template<typename T, typename F>
+void for_each(name_flat_map<T> const & m, F && f) {
+    return m.for_each(f);
+}
+}
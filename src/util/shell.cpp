@@ -29,6 +29,8 @@ Author: Leonardo de Moura
 #include "util/option_declarations.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
+#include "kernel/type_checker.h"
+#include "kernel/expr_cache.h"
 #include "library/formatter.h"
 #include "library/module.h"
 #include "library/time_task.h"
@@ -722,6 +724,8 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
 
         if (stats) {
             env.display_stats();
+            display_kernel_cache_stats(std::cout);
+            display_expr_cache_stats(std::cout);
         }
 
         if (run && ok) {
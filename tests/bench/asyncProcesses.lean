@@ -0,0 +1,38 @@
+/-!
+Waiting for many child processes at once, as a build system does: with one dedicated thread per
+child (`IO.asTask child.wait`) and with the I/O reactor (`readAsync`/`waitAsync`).
+-/
+
+def n := 500
+
+def spawnAll : IO (List (IO.Process.Child { stdout := .piped })) :=
+  (List.range n).mapM fun i => IO.Process.spawn {
+    cmd := "sh", args := #["-c", s!"sleep 0.2; echo {i}"], stdout := .piped }
+
+def bench (name : String) (act : IO Nat) : IO Unit := do
+  let start ← IO.monoMsNow
+  let k ← act
+  IO.println s!"{name} (ms): {(← IO.monoMsNow) - start}"
+  if k != n then
+    throw <| IO.userError "unexpected result"
+
+def main : IO Unit := do
+  bench "dedicated threads" do
+    let children ← spawnAll
+    let tasks ← children.mapM fun c => IO.asTask (prio := .dedicated) do
+      let out ← c.stdout.readToEnd
+      let _ ← c.wait
+      return out.length
+    let lens ← tasks.mapM fun t => do IO.ofExcept (← IO.wait t)
+    return lens.length
+  bench "reactor" do
+    let children ← spawnAll
+    let tasks ← children.mapM fun c => do
+      let out ← c.stdout.readAsync 100
+      let code ← c.waitAsync
+      return (out, code)
+    let lens ← tasks.mapM fun (out, code) => do
+      let out ← IO.ofExcept (← IO.wait out)
+      let _ ← IO.ofExcept (← IO.wait code)
+      return out.size
+    return lens.length
@@ -0,0 +1,49 @@
+import Lean
+open Lean System
+
+/-!
+Size and throughput of compressed `.olean` files: rewrites all stdlib `.olean` files in both formats
+and reads them back.
+-/
+
+def time (act : IO α) : IO (α × Nat) := do
+  let start ← IO.monoNanosNow
+  let a ← act
+  return (a, (← IO.monoNanosNow) - start)
+
+unsafe def main : IO Unit := do
+  let libDir := (← findSysroot) / "lib" / "lean"
+  let oleans := (← libDir.walkDir).filter (·.extension == some "olean")
+  let tmpDir : FilePath := "olean_compress.tmp"
+  IO.FS.createDirAll tmpDir
+  let raw := tmpDir / "raw.olean"
+  let compressed := tmpDir / "compressed.olean"
+  let mut rawSize := 0
+  let mut compressedSize := 0
+  let mut writeTime := 0
+  let mut writeCompressedTime := 0
+  let mut readTime := 0
+  let mut readCompressedTime := 0
+  for olean in oleans do
+    let (mod, region) ← readModuleData olean
+    let modName := Name.mkSimple (olean.fileStem.getD "")
+    let ((), t) ← time <| saveModuleData raw modName mod
+    writeTime := writeTime + t
+    let ((), t) ← time <| saveModuleDataCompressed compressed modName mod
+    writeCompressedTime := writeCompressedTime + t
+    region.free
+    let ((_, region), t) ← time <| readModuleData raw
+    readTime := readTime + t
+    region.free
+    let ((_, region), t) ← time <| readModuleData compressed
+    readCompressedTime := readCompressedTime + t
+    region.free
+    rawSize := rawSize + (← raw.metadata).byteSize.toNat
+    compressedSize := compressedSize + (← compressed.metadata).byteSize.toNat
+  IO.FS.removeDirAll tmpDir
+  IO.println s!"bytes .olean: {rawSize}"
+  IO.println s!"bytes compressed .olean: {compressedSize}"
+  IO.println s!"write .olean (ms): {writeTime / 1000000}"
+  IO.println s!"write compressed .olean (ms): {writeCompressedTime / 1000000}"
+  IO.println s!"read .olean (ms): {readTime / 1000000}"
+  IO.println s!"read compressed .olean (ms): {readCompressedTime / 1000000}"
@@ -0,0 +1,44 @@
+/-!
+Reading a large line-oriented file with `Handle.getLine`, and in chunks with `Handle.read` and
+`Handle.readInto`.
+-/
+
+def fileName : System.FilePath := "readLines.txt"
+
+/-- Writes `mb` MiB of lines of varying length. -/
+def writeFile (mb : Nat) : IO Unit := do
+  let mut chunk := ""
+  let mut i := 0
+  while chunk.utf8ByteSize < 1024 * 1024 do
+    chunk := chunk ++ String.mk (List.replicate (20 + i * 7919 % 120) 'x') ++ "\n"
+    i := i + 1
+  let chunk := chunk.toUTF8
+  IO.FS.withFile fileName .write fun h => do
+    for _ in [0:mb] do
+      h.write chunk
+
+def time (name : String) (act : IO Nat) : IO Unit := do
+  let start ← IO.monoMsNow
+  let n ← act
+  IO.println s!"{name} (ms): {(← IO.monoMsNow) - start}"
+  if n == 0 then
+    throw <| IO.userError "empty file"
+
+partial def countLines (h : IO.FS.Handle) (n : Nat) : IO Nat := do
+  if (← h.getLine).isEmpty then return n else countLines h (n + 1)
+
+partial def countBytes (h : IO.FS.Handle) (n : Nat) : IO Nat := do
+  let b ← h.read (1024 * 1024)
+  if b.isEmpty then return n else countBytes h (n + b.size)
+
+partial def countBytesInto (h : IO.FS.Handle) (buf : ByteArray) (n : Nat) : IO Nat := do
+  let buf ← h.readInto buf (1024 * 1024)
+  if buf.isEmpty then return n else countBytesInto h buf (n + buf.size)
+
+def main (args : List String) : IO Unit := do
+  let mb := (args.head? >>= String.toNat?).getD 2048
+  writeFile mb
+  time "getLine" <| IO.FS.withFile fileName .read (countLines · 0)
+  time "read" <| IO.FS.withFile fileName .read (countBytes · 0)
+  time "readInto" <| IO.FS.withFile fileName .read (countBytesInto · .empty 0)
+  IO.FS.removeFile fileName
@@ -0,0 +1,44 @@
+import Lean.Data.Rope
+open Lean
+
+/-!
+Building a large output while earlier states of the builder stay alive, as a backtracking
+emitter that keeps snapshots does. With `String`, every append to a shared builder copies it;
+`Rope` shares the chunks instead.
+-/
+
+def line (i : Nat) : String :=
+  s!"LEAN_EXPORT lean_object* l_decl_{i}(lean_object* x_1, lean_object* x_2); // αβ\n"
+
+def bench (name : String) (f : Unit → Nat) : IO Unit := do
+  let start ← IO.monoNanosNow
+  let n := f ()
+  let t := (← IO.monoNanosNow) - start
+  IO.println s!"{name} (ms): {t / 1000000}"
+  if n == 0 then
+    throw <| IO.userError "unexpected result"
+
+/-- Append `n` lines, keeping a snapshot of the builder every `every` lines. -/
+@[specialize] def build {β} (empty : β) (append : β → String → β) (n every : Nat) : β × Array β := Id.run do
+  let mut out := empty
+  let mut snapshots := #[]
+  for i in [0:n] do
+    if i % every == 0 then
+      snapshots := snapshots.push out
+    out := append out (line i)
+  return (out, snapshots)
+
+def main : IO Unit := do
+  let n := 40000
+  bench "string snapshots" fun _ =>
+    let (out, snaps) := build "" (· ++ ·) n 1
+    out.utf8ByteSize + snaps.size
+  bench "rope snapshots" fun _ =>
+    let (out, snaps) := build Rope.empty (· ++ ·) n 1
+    out.toString.utf8ByteSize + snaps.size
+  bench "string linear" fun _ =>
+    let (out, snaps) := build "" (· ++ ·) (50 * n) (100 * n)
+    out.utf8ByteSize + snaps.size
+  bench "rope linear" fun _ =>
+    let (out, snaps) := build Rope.empty (· ++ ·) (50 * n) (100 * n)
+    out.toString.utf8ByteSize + snaps.size
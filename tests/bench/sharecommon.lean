@@ -0,0 +1,29 @@
+import Lean
+open Lean ShareCommon
+
+/-!
+Maximal sharing of all types and values in the `Lean` environment, using the `HashMap`-based
+`objectFactory` and the native hash-consing table of `StateFactory.native`.
+-/
+
+def shareAll (σ : StateFactory) (es : Array Expr) : Array Expr :=
+  _root_.ShareCommonM.run (σ := σ) (withShareCommon es)
+
+def bench (name : String) (σ : StateFactory) (es : Array Expr) : IO Unit := do
+  let start ← IO.monoNanosNow
+  let r ← IO.lazyPure fun _ => shareAll σ es
+  let t := (← IO.monoNanosNow) - start
+  IO.println s!"{name} (ms): {t / 1000000}"
+  unless r.size == es.size do
+    throw <| IO.userError "unexpected result"
+
+def main : IO Unit := do
+  initSearchPath (← findSysroot)
+  let env ← importModules #[{ module := `Lean }] {}
+  let es := env.constants.fold (init := #[]) fun es _ c =>
+    match c.value? with
+    | some v => es.push c.type |>.push v
+    | none   => es.push c.type
+  IO.println s!"exprs: {es.size}"
+  bench "sharecommon HashMap" Lean.ShareCommon.objectFactory es
+  bench "sharecommon native" StateFactory.native es
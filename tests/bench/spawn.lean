@@ -0,0 +1,23 @@
+/-!
+Latency of spawning a process from a parent with a large heap, as `lake` does for every compiler
+invocation. With `fork`, each spawn copies the page tables of the parent.
+-/
+
+def spawnTrue (n : Nat) : IO Unit := do
+  for _ in [0:n] do
+    let child ← IO.Process.spawn { cmd := "true" }
+    let _ ← child.wait
+
+def main : IO Unit := do
+  let mut heap : Array (Array Nat) := #[]
+  for mb in [0, 256, 1024] do
+    -- an `Array` of `n` scalars occupies `8 * n` bytes
+    while heap.size < mb do
+      heap := heap.push (Array.mkArray (1024 * 1024 / 8) heap.size)
+    let n := 200
+    let start ← IO.monoNanosNow
+    spawnTrue n
+    let t := (← IO.monoNanosNow) - start
+    IO.println s!"spawn with {mb} MB heap (us): {t / n / 1000}"
+  if heap.size == 0 then
+    throw <| IO.userError "unexpected heap size"
@@ -0,0 +1,33 @@
+/-!
+String microbenchmarks for the UTF-8 primitives of the runtime: validation, counting the
+characters of byte arrays and substrings, and character-wise traversal.
+-/
+
+def mkText (n : Nat) (nonAscii : Nat) : String := Id.run do
+  let mut s := ""
+  for i in [0:n] do
+    s := s.push (if nonAscii > 0 && i % nonAscii == 0 then '∀' else Char.ofNat (97 + i % 26))
+  return s
+
+def bench (name : String) (reps : Nat) (f : Unit → Nat) : IO Unit := do
+  let start ← IO.monoNanosNow
+  let mut acc := 0
+  for _ in [0:reps] do
+    acc := acc + f ()
+  let t := (← IO.monoNanosNow) - start
+  IO.println s!"{name} (ms): {t / 1000000}"
+  if acc == 0 then
+    throw <| IO.userError "unexpected result"
+
+def suite (kind : String) (s : String) : IO Unit := do
+  let bytes := s.toUTF8
+  bench s!"{kind} fromUTF8Unchecked" 50 fun _ => (String.fromUTF8Unchecked bytes).length
+  bench s!"{kind} validateUTF8" 50 fun _ => if String.validateUTF8 bytes then 1 else 0
+  bench s!"{kind} fromUTF8?" 50 fun _ => (String.fromUTF8? bytes).map String.length |>.getD 0
+  bench s!"{kind} extract" 50 fun _ => (s.extract ⟨1⟩ ⟨s.utf8ByteSize / 2⟩).length
+  bench s!"{kind} foldl" 5 fun _ => s.foldl (fun n c => if c == 'a' then n + 1 else n) 0
+
+def main : IO Unit := do
+  suite "ascii" (mkText 8000000 0)
+  suite "mostly ascii" (mkText 8000000 40)
+  suite "unicode" (mkText 4000000 2)
@@ -0,0 +1,18 @@
+/-!
+Spawns a binary tree of fine-grained tasks from inside running tasks and combines their results
+via `bind`/`map`, measuring the spawn and resolution throughput of the runtime task manager.
+Run with different values of `LEAN_NUM_THREADS` to see how it scales with the number of workers.
+-/
+
+-- The index argument keeps the two subtrees from being merged by common sub-expression elimination
+partial def tree (d i : Nat) : Task Nat :=
+  if d = 0 then .pure 1
+  else
+    (Task.spawn fun _ => i).bind fun i =>
+      let l := tree (d - 1) (2 * i)
+      let r := tree (d - 1) (2 * i + 1)
+      l.bind fun a => r.map (a + ·)
+
+def main (args : List String) : IO Unit := do
+  let d := args.head!.toNat!
+  IO.println s!"leaves: {(tree d 0).get}"
@@ -0,0 +1,32 @@
+import Lean
+open Lean
+
+def mkThm (n : Name) (type value : Expr) : Declaration :=
+  .thmDecl { name := n, levelParams := [], type, value }
+
+def test (decls : List Declaration) : CoreM Unit := do
+  match (← getEnv).addDecls decls with
+  | .ok env => IO.println s!"ok {env.contains `thm2}"
+  | .error (.declTypeMismatch _ (.thmDecl v) _) => IO.println s!"mismatch {v.name}"
+  | .error _ => IO.println "error"
+
+/-- info: ok true -/
+#guard_msgs in
+#eval test [mkThm `thm1 (mkConst ``True) (mkConst ``True.intro),
+            mkThm `thm2 (mkConst ``True) (mkConst `thm1)]
+
+/-- info: mismatch thm2 -/
+#guard_msgs in
+#eval test [mkThm `thm1 (mkConst ``True) (mkConst ``True.intro),
+            mkThm `thm2 (mkConst ``True) (mkConst ``Nat.zero),
+            mkThm `thm3 (mkConst ``True) (mkConst ``Nat.zero)]
+
+/-- info: mismatch thm1 -/
+#guard_msgs in
+#eval test [mkThm `thm1 (mkConst ``True) (mkConst ``Nat.zero),
+            mkThm `thm1 (mkConst ``True) (mkConst ``True.intro)]
+
+/-- info: error -/
+#guard_msgs in
+#eval test [mkThm `thm1 (mkConst ``True) (mkConst ``True.intro),
+            mkThm `thm1 (mkConst ``True) (mkConst ``Nat.zero)]
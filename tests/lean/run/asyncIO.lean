@@ -0,0 +1,31 @@
+/-!
+Timers, handle reads and writes, and process exit awaited through tasks.
+-/
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+def await (t : Task (Except IO.Error α)) : IO α := do
+  IO.ofExcept (← IO.wait t)
+
+def test : IO Unit := do
+  let start ← IO.monoMsNow
+  let timers ← (List.range 100).mapM fun i => IO.sleepAsync (50 + (i % 10).toUInt32)
+  for t in timers do IO.wait t
+  check ((← IO.monoMsNow) - start ≥ 59) "timers finished early"
+  if System.Platform.isWindows then return
+  let children ← (List.range 20).mapM fun i => IO.Process.spawn {
+    cmd := "sh", args := #["-c", s!"echo {i}; exit {i % 3}"], stdout := .piped }
+  for (c, i) in children.zip (List.range 20) do
+    let out ← await (← c.stdout.readAsync 100)
+    check (String.fromUTF8Unchecked out == s!"{i}\n") s!"output of child {i}"
+    let code ← await (← c.waitAsync)
+    check (code == (i % 3).toUInt32) s!"exit code of child {i}"
+  let c ← IO.Process.spawn { cmd := "wc", args := #["-c"], stdin := .piped, stdout := .piped }
+  let out ← c.stdout.readAsync 100
+  await (← c.stdin.writeAsync (ByteArray.mk (Array.mkArray 1000000 65)))
+  let (_, c) ← c.takeStdin
+  check ((String.fromUTF8Unchecked (← await out)).trim == "1000000") "output of wc"
+  check ((← await (← c.waitAsync)) == 0) "exit code of wc"
+
+#eval test
@@ -0,0 +1,67 @@
+/-!
+Arithmetic on `Nat`s with hundreds of digits. Without GMP, these go through the Karatsuba/Toom-3
+multiplication, divide-and-conquer division and decimal conversion in `runtime/mpn.cpp`.
+-/
+
+def big (k : Nat) : Nat := 3 ^ k + 7
+
+#guard (big 5000 * big 7000) / big 7000 == big 5000
+#guard (big 5000 * big 7000 + 12345) % big 5000 == 12345
+#guard (big 7000 * big 7000) / big 7000 == big 7000
+#guard (2 ^ 20000 / 3 ^ 5000) * 3 ^ 5000 + 2 ^ 20000 % 3 ^ 5000 == 2 ^ 20000
+#guard (2 ^ 20000 - 1) % (2 ^ 10000 - 1) == 0
+#guard (toString (10 ^ 3000)).length == 3001
+#guard toString (10 ^ 2000 - 1) == String.mk (List.replicate 2000 '9')
+#guard toString (10 ^ 1000 * 10 ^ 1000 + 1) == "1" ++ String.mk (List.replicate 1999 '0') ++ "1"
+
+/-!
+Products and quotients checked against a schoolbook reference on 16-bit limbs, which only needs
+small `Nat`s. The operand sizes cross the Karatsuba (24 digits) and Toom-3 (256 digits) thresholds
+at the top level and in the recursion, and include unbalanced operands and all-ones digits, which
+produce the largest intermediate values in the interpolation.
+-/
+
+def toLimbs (n : Nat) : Array Nat := Id.run do
+  let mut r := #[]
+  let mut n := n
+  while n > 0 do
+    r := r.push (n % 65536)
+    n := n >>> 16
+  return r
+
+def fromLimbs (ls : Array Nat) : Nat :=
+  ls.foldr (fun l n => (n <<< 16) + l) 0
+
+def refMul (a b : Nat) : Nat := Id.run do
+  let xs := toLimbs a
+  let ys := toLimbs b
+  let mut r := mkArray (xs.size + ys.size + 1) 0
+  for i in [0:xs.size] do
+    let mut carry := 0
+    for j in [0:ys.size] do
+      let t := r[i + j]! + xs[i]! * ys[j]! + carry
+      r := r.set! (i + j) (t % 65536)
+      carry := t / 65536
+    let mut k := i + ys.size
+    while carry > 0 do
+      let t := r[k]! + carry
+      r := r.set! k (t % 65536)
+      carry := t / 65536
+      k := k + 1
+  return fromLimbs r
+
+/-- A number of `n` 32-bit digits, all ones or pseudo-random. -/
+def digits (n : Nat) (seed : Nat) : Nat :=
+  if seed == 0 then 2 ^ (32 * n) - 1
+  else (List.range n).foldl (fun acc i => (acc <<< 32) + (i * 2654435761 + seed * 40503) % 4294967296) 1
+
+def checkMulDiv (a b : Nat) : Bool :=
+  let p := a * b
+  p == refMul a b &&
+  -- the quotient and remainder are checked with the reference product
+  let q := p / (b + 1)
+  let r := p % (b + 1)
+  r ≤ b && refMul q (b + 1) + r == p
+
+#guard [(5, 5), (24, 24), (40, 40), (257, 257), (300, 37), (520, 260)].all
+  fun (m, n) => [(0, 0), (1, 2), (3, 0)].all fun (s, t) => checkMulDiv (digits m s) (digits n t)
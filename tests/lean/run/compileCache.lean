@@ -0,0 +1,96 @@
+import Lean
+open Lean Elab Command
+
+/-!
+Reusing compiler results stored in the directory given by `compiler.cache_dir`.
+-/
+
+def dir : System.FilePath := "compileCache.dir"
+
+#eval do
+  if ← dir.pathExists then IO.FS.removeDirAll dir
+  IO.FS.createDirAll dir
+
+set_option compiler.cache_dir "compileCache.dir"
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+def entries : IO Nat :=
+  return (← dir.readDir).size
+
+/--
+Elaborate `cmds` without keeping the declarations they add, so that the same names can be defined again, and return
+the number of cache entries that were added.
+-/
+def elabScratch (cmds : Array Syntax) : CommandElabM Nat := do
+  let before ← entries
+  withoutModifyingEnv do
+    for cmd in cmds do
+      elabCommand cmd
+  return (← entries) - before
+
+elab "#reused " cmds:command* " #end" : command => do
+  let n ← elabScratch cmds
+  unless n == 0 do throwError "{n} new cache entries"
+
+elab "#recompiled " cmds:command* " #end" : command => do
+  unless (← elabScratch cmds) > 0 do throwError "no new cache entries"
+
+@[specialize] def sumBy (f : Nat → Nat) : List Nat → Nat
+  | []      => 0
+  | x :: xs => f x + sumBy f xs
+
+def table : List Nat := List.range 10
+
+class Step (α : Type) where
+  step : α → α
+
+-- compiling the same declarations twice reuses all entries
+#recompiled
+  def sumSquares (xs : List Nat) : Nat :=
+    sumBy (fun x => x * x) xs + table.length
+  #eval check (sumSquares table == 295) "sumSquares"
+#end
+#reused
+  def sumSquares (xs : List Nat) : Nat :=
+    sumBy (fun x => x * x) xs + table.length
+  #eval check (sumSquares table == 295) "sumSquares"
+#end
+
+-- changing a direct dependency
+#recompiled
+  def base : Nat := 10
+  def addBase (x : Nat) : Nat := x + base
+  #eval check (addBase 1 == 11) "addBase"
+#end
+#recompiled
+  def base : Nat := 20
+  def addBase (x : Nat) : Nat := x + base
+  #eval check (addBase 1 == 21) "addBase"
+#end
+
+/-
+Changing a transitive dependency: `next` is inlined into `next'` through the instance, whose code only refers to
+`next` by name and therefore does not change.
+-/
+#recompiled
+  @[inline] def next (x : Nat) : Nat := x + 1
+  instance : Step Nat := ⟨next⟩
+  def next' (x : Nat) : Nat := Step.step x
+  #eval check (next' 1 == 2) "next'"
+#end
+#reused
+  @[inline] def next (x : Nat) : Nat := x + 1
+  instance : Step Nat := ⟨next⟩
+  def next' (x : Nat) : Nat := Step.step x
+  #eval check (next' 1 == 2) "next'"
+#end
+#recompiled
+  @[inline] def next (x : Nat) : Nat := x + 2
+  instance : Step Nat := ⟨next⟩
+  def next' (x : Nat) : Nat := Step.step x
+  #eval check (next' 1 == 3) "next'"
+#end
+
+#eval IO.FS.removeDirAll dir
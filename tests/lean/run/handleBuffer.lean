@@ -0,0 +1,43 @@
+/-!
+Handle reads and writes crossing the buffer boundary, and `Handle.readInto`.
+-/
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+def lines : Array String := Id.run do
+  let mut ls := #[]
+  for i in [0:2000] do
+    -- include lines longer than the handle buffer
+    let n := if i % 500 == 7 then 100000 + i else i % 97
+    ls := ls.push (String.mk (List.replicate n (Char.ofNat (97 + i % 26))))
+  return ls
+
+def test : IO Unit := do
+  let fn : System.FilePath := "handleBuffer.txt"
+  IO.FS.withFile fn .write fun h => do
+    for l in lines do
+      h.putStrLn l
+    h.write "no newline".toUTF8
+  let expected := String.intercalate "\n" lines.toList ++ "\nno newline"
+  IO.FS.withFile fn .read fun h => do
+    for l in lines do
+      check ((← h.getLine) == l ++ "\n") "getLine"
+    check ((← h.getLine) == "no newline") "last line"
+    check ((← h.getLine) == "") "end of file"
+    h.rewind
+    let mut buf := ByteArray.empty
+    let mut contents := ByteArray.empty
+    repeat
+      buf ← h.readInto buf 4096
+      if buf.isEmpty then break
+      contents := contents ++ buf
+    check (contents.data == expected.toUTF8.data) "readInto"
+  IO.FS.withFile fn .readWrite fun h => do
+    let _ ← h.getLine
+    h.putStr "x"
+    h.truncate
+  check ((← IO.FS.readFile fn) == "\nx") "write after read"
+  IO.FS.removeFile fn
+
+#eval test
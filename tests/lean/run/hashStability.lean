@@ -0,0 +1,23 @@
+import Lean
+open Lean
+
+/-!
+`String.hash` must not change: `Name`s stored in .olean files cache hash codes derived from it.
+-/
+
+#guard "hello".hash == 9821865621596011261
+#guard (String.join (List.replicate 100 "abcdefghij")).hash == 15206333717772176847
+#guard [97, 98, 99, 100].toByteArray.hash == 11774739814239950349
+
+/-! Long strings read from .olean files answer `hash` from a cached slot; it agrees with a fresh copy. -/
+#eval show MetaM Unit from do
+  let some doc ← findDocString? (← getEnv) ``Nat.log2 | throwError "missing docstring"
+  unless doc.utf8ByteSize ≥ 64 && doc.hash == (String.mk doc.toList).hash do
+    throwError "cached hash mismatch"
+
+/-! Long byte arrays use a faster hash function. -/
+def bytes (n : Nat) : ByteArray := (List.range n).foldl (fun a i => a.push (i * 7 % 251).toUInt8) .empty
+
+#guard (bytes 1000).hash == (bytes 1000).hash
+#guard (bytes 1000).hash != ((bytes 1000).set! 500 0).hash
+#guard (bytes 1000).hash != (bytes 999).hash
@@ -0,0 +1,42 @@
+/-!
+The interpreter runs IR lowered to bytecode by default; `interpreter.bytecode false` selects the
+IR tree-walker. Both must agree, including on join points, tail calls, reset/reuse and closures.
+-/
+
+def sumTo : Nat → Nat → Nat
+  | 0, acc => acc
+  | n+1, acc => sumTo n (acc + n + 1)
+
+def swapN : Nat → Nat → Nat → Nat
+  | 0, a, _ => a
+  | n+1, a, b => swapN n b a
+
+def fib : Nat → Nat
+  | 0 => 0
+  | 1 => 1
+  | n+2 => fib n + fib (n+1)
+
+def mapSucc (xs : List Nat) : List Nat := xs.map (· + 1)
+
+def sumScalars (xs : Array UInt64) : UInt64 := Id.run do
+  let mut s : UInt64 := 0
+  for x in xs do
+    if x % 3 == 0 then continue
+    s := s + x * 2
+  return s
+
+def applyTwice (f : Nat → Nat → Nat) (a : Nat) : Nat :=
+  let g := f a
+  g (g 1)
+
+def test : String :=
+  toString (sumTo 100000 0, swapN 7 1 2, fib 20, (mapSucc (List.range 1000)).foldl (· + ·) 0,
+    sumScalars ((Array.range 100).map Nat.toUInt64), applyTwice (· + ·) 10, "abc".push 'd')
+
+/-- info: "(5000050000, 2, 6765, 500500, 6534, 21, abcd)" -/
+#guard_msgs in #eval test
+
+/-- info: "(5000050000, 2, 6765, 500500, 6534, 21, abcd)" -/
+#guard_msgs in
+set_option interpreter.bytecode false in
+#eval test
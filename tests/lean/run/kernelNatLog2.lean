@@ -0,0 +1,16 @@
+/-!
+`Nat.log2` on literals is evaluated by both the elaborator and the kernel instead of unfolding its
+well-founded definition.
+-/
+
+example : Nat.log2 0 = 0 := by decide
+example : Nat.log2 1 = 0 := by decide
+example : Nat.log2 1024 = 10 := by decide
+example : Nat.log2 (2 ^ 1000) = 1000 := by decide
+example : Nat.log2 (2 ^ 1000 - 1) = 999 := by decide
+example : Nat.log2 (2 ^ 1000) = 1000 := rfl
+
+-- The same operations on big literals reached through different terms.
+def big : Nat := 3 ^ 5000
+
+example : big * big % 1000007 + big * big % 1000007 = 2 * (big * big % 1000007) := by decide
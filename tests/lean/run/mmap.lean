@@ -0,0 +1,33 @@
+/-!
+Mapping files into memory with `IO.FS.mmap`.
+-/
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+unsafe def test : IO Unit := do
+  let fn : System.FilePath := "mmap.txt"
+  -- sizes around the page size check that the string view is terminated
+  for s in ["", "hello ∀ world\n", String.mk (List.replicate 4096 'a'), String.mk (List.replicate 70000 'b')] do
+    IO.FS.writeFile fn s
+    let m ← IO.FS.mmap fn
+    check (m.bytes.data == s.toUTF8.data) "bytes"
+    check (m.toString? == some s) "toString?"
+    check ((m.toString?.getD "").length == s.length) "length"
+    -- modifying the views copies them
+    check ((m.bytes.push 0).size == s.utf8ByteSize + 1 && m.bytes.size == s.utf8ByteSize) "push"
+    check ((m.toString?.getD "").push 'x' == s.push 'x') "String.push"
+    -- keep `m` alive while the views above are in use
+    check (m.bytes.size == s.utf8ByteSize) "size"
+  IO.FS.writeBinFile fn (ByteArray.mk #[0xff, 0xfe])
+  let m ← IO.FS.mmap fn
+  check (m.bytes.size == 2 && m.toString?.isNone) "invalid UTF-8"
+  IO.FS.removeFile fn
+  try
+    let _ ← IO.FS.mmap fn
+    throw <| IO.userError "mapped a missing file"
+  catch
+    | .noFileOrDirectory .. => pure ()
+    | e => throw e
+
+#eval test
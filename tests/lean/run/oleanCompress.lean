@@ -0,0 +1,65 @@
+import Lean
+open Lean System Lean.Internal
+
+/-!
+Round trips through compressed `.olean` files and the underlying codec.
+-/
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+def roundTrip (data : ByteArray) : IO Unit := do
+  let c := lzCompress data
+  check ((lzDecompress? c data.size).map (·.data) == some data.data) s!"round trip of {data.size} bytes"
+  if data.size > 0 then
+    check (lzDecompress? c (data.size - 1)).isNone "smaller size"
+  check (lzDecompress? c (data.size + 1)).isNone "larger size"
+  if c.size > 1 then
+    check (lzDecompress? (c.extract 0 (c.size - 1)) data.size).isNone "truncated"
+
+def testCodec : IO Unit := do
+  roundTrip .empty
+  roundTrip (ByteArray.mk #[1, 2, 3])
+  -- long literal runs, long matches, and overlapping matches
+  roundTrip (ByteArray.mk (Array.range 100000 |>.map fun i => (i * 7919 % 251).toUInt8))
+  roundTrip (ByteArray.mk (mkArray 100000 0))
+  roundTrip ("abc".toUTF8 ++ (String.join (List.replicate 1000 "abcabd")).toUTF8)
+  let c := lzCompress (ByteArray.mk (mkArray 1000 42))
+  check (c.size < 100) "repetitive data is not compressed"
+  -- a match before the beginning of the output
+  check (lzDecompress? (ByteArray.mk #[0x10, 1, 5, 0]) 5).isNone "invalid offset"
+  check (lzDecompress? (ByteArray.mk #[0x10, 1, 0, 0]) 5).isNone "zero offset"
+  -- a literal length that is continued past the end of the input
+  check (lzDecompress? (ByteArray.mk #[0xf0, 255]) 300).isNone "missing length"
+  check (lzDecompress? (ByteArray.mk #[0x30, 1]) 3).isNone "missing literals"
+
+def testOlean : IO Unit := do
+  initSearchPath (← findSysroot)
+  let olean ← findOLean `Init.Prelude
+  let (mod, _) ← readModuleData olean
+  let raw : FilePath := "oleanCompress.olean"
+  let compressed : FilePath := "oleanCompress.compressed.olean"
+  saveModuleData raw `Init.Prelude mod
+  saveModuleDataCompressed compressed `Init.Prelude mod
+  check ((← IO.FS.readBinFile compressed).size < (← IO.FS.readBinFile raw).size) "not smaller"
+  for fn in [raw, compressed] do
+    let (mod', _) ← readModuleData fn
+    check (mod'.imports.map toString == mod.imports.map toString) "imports"
+    check (mod'.constNames == mod.constNames) "constNames"
+    check (mod'.constants.map (·.type) == mod.constants.map (·.type)) "constant types"
+    check (mod'.constants.map (·.value?) == mod.constants.map (·.value?)) "constant values"
+    check (mod'.entries.map (·.1) == mod.entries.map (·.1)) "entries"
+  -- truncated files are rejected
+  let bytes ← IO.FS.readBinFile compressed
+  for size in [bytes.size - 1, bytes.size / 2, 100] do
+    IO.FS.writeBinFile compressed (bytes.extract 0 size)
+    try
+      let _ ← readModuleData compressed
+      throw <| IO.userError s!"read file truncated to {size} bytes"
+    catch e =>
+      check ((toString e).startsWith "failed to read file") (toString e)
+  IO.FS.removeFile raw
+  IO.FS.removeFile compressed
+
+#eval testCodec
+#eval testOlean
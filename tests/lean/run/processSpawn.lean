@@ -0,0 +1,29 @@
+/-!
+Environment, working directory and stdio configuration of spawned processes, and errors for
+programs that cannot be started. Where `posix_spawn` is used, these errors are reported by `spawn`
+itself; otherwise the forked child exits with a nonzero code.
+-/
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+def test : IO Unit := do
+  if System.Platform.isWindows then return
+  let out ← IO.Process.output {
+    cmd := "sh", args := #["-c", "echo $SPAWN_NEW,${SPAWN_GONE-unset}"]
+    env := #[("SPAWN_NEW", some "new"), ("SPAWN_GONE", none)] }
+  check (out.stdout == "new,unset\n") s!"env: {out.stdout}"
+  let out ← IO.Process.output { cmd := "pwd", cwd := some "/" }
+  check (out.stdout == "/\n") s!"cwd: {out.stdout}"
+  let out ← IO.Process.output { cmd := "sh", args := #["-c", "cat; echo err >&2; exit 3"], stdin := .null }
+  check (out.stdout == "" && out.stderr == "err\n" && out.exitCode == 3) s!"stdio: {out.stdout}, {out.stderr}"
+  let out ← IO.Process.output { cmd := "sh", args := #["-c", "echo found"], env := #[("PATH", some "/nonexistent:/bin:/usr/bin")] }
+  check (out.stdout == "found\n") s!"PATH: {out.stdout}"
+  match ← (IO.Process.output { cmd := "sh", env := #[("PATH", some "/nonexistent")] }).toBaseIO with
+  | .ok out => check (out.exitCode != 0) "spawning a program missing from `PATH` should fail"
+  | .error _ => pure ()
+  match ← (IO.Process.output { cmd := "pwd", cwd := some "/nonexistent" }).toBaseIO with
+  | .ok out => check (out.exitCode != 0) "spawning in a missing directory should fail"
+  | .error _ => pure ()
+
+#eval test
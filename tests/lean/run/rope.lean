@@ -0,0 +1,31 @@
+import Lean.Data.Rope
+open Lean
+
+/-! `Rope` agrees with the `String` operations it replaces. -/
+
+def chunks : List String :=
+  (List.range 400).map fun i => s!"chunk {i} αβγ ∀ {if i % 7 == 0 then String.mk (List.replicate 300 'x') else ""};"
+
+def rope : Rope := chunks.foldl (· ++ ·) Rope.empty
+def str : String := chunks.foldl (· ++ ·) ""
+
+#guard rope.toString == str
+#guard rope.length == str.length
+#guard rope.utf8ByteSize == str.utf8ByteSize
+#guard rope.height < 20
+
+-- Prepending and appending in alternation keeps the tree balanced.
+def mixed : Rope := (List.range 1000).foldl (init := Rope.empty) fun r i =>
+  if i % 2 == 0 then r.push 'a' else Rope.ofString "λ" ++ r
+#guard mixed.toString == String.mk (List.replicate 500 'λ' ++ List.replicate 500 'a')
+#guard mixed.height < 20
+
+def positions : List String.Pos :=
+  [0, 1, 9, 100, 255, 1000, str.length].map fun k => ⟨(str.take k).utf8ByteSize⟩
+
+#guard positions.all fun b => positions.all fun e =>
+  (rope.extract b e).toString == str.extract b e
+
+#guard (rope.splitAt ⟨1003⟩).1.toString ++ (rope.splitAt ⟨1003⟩).2.toString == str
+#guard Rope.empty.isEmpty && (Rope.ofString "" ++ Rope.empty).isEmpty
+#guard (Rope.ofString "ab" ++ "cd") == Rope.ofString "abcd"
@@ -145,3 +145,14 @@ check $ ptrAddrUnsafe a != ptrAddrUnsafe c
 pure ()
 
 #eval (tst6 2).run
+
+unsafe def tstNativeShared : IO Unit := do
+  let s : ShareCommon.State ShareCommon.StateFactory.native := default
+  let (x, s) := s.shareCommon [1, 2]
+  -- `s` is shared by the next two calls, so the table is copied
+  let (y, _) := s.shareCommon ([0, 1].map (· + 1))
+  let (z, _) := s.shareCommon ([1, 2].map id)
+  unless ptrAddrUnsafe x == ptrAddrUnsafe y && ptrAddrUnsafe x == ptrAddrUnsafe z do
+    throw <| IO.userError "check failed"
+
+#eval tstNativeShared
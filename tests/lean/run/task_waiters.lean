@@ -0,0 +1,23 @@
+/-!
+Many threads blocked on the same promise and on distinct tasks at once, together with dependent tasks
+of tasks that are dropped again before they finish.
+-/
+
+def waiters : IO Unit := do
+  let p ← IO.Promise.new (α := Nat)
+  let ws ← (List.range 16).mapM fun i =>
+    IO.asTask (prio := .dedicated) do return p.result.get + i
+  let ts := (List.range 64).map fun i => Task.spawn fun _ => i * i
+  let ds ← ts.mapM fun t => IO.asTask (prio := .dedicated) do return t.get + 1
+  for i in [0:100] do
+    discard <| IO.mapTask (fun j => pure (j + i)) (Task.spawn fun _ => dbgSleep 1 fun _ => i)
+    discard <| IO.bindTask (Task.spawn fun _ => i) fun j => IO.asTask (pure (j * 2))
+  p.resolve 100
+  let mut sum := 0
+  for w in ws ++ ds do
+    sum := sum + (← IO.ofExcept w.get)
+  IO.println sum
+
+/-- info: 87128 -/
+#guard_msgs in
+#eval waiters
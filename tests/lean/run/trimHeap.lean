@@ -0,0 +1,34 @@
+def churn (n : Nat) : IO Nat := do
+  let mut arrs : Array (Array Nat) := #[]
+  for i in [0:n] do
+    arrs := arrs.push (mkArray 16 i)
+  return arrs.foldl (fun s a => s + a.size) 0
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+/-- Retry while the thread that ran the task has not exited yet and its heap is still in use. -/
+partial def trimUntilReleased (attempts : Nat) : IO Nat := do
+  let r ← IO.trimHeap
+  if r > 0 || attempts == 0 then
+    return r
+  IO.sleep 10
+  trimUntilReleased (attempts - 1)
+
+def test : IO Nat := do
+  let s ← churn 100000
+  -- only the small object allocator (the `SMALL_ALLOCATOR` build option) reports the memory it releases
+  let reportsReleased := (← IO.trimHeap) > 0
+  let s' ← churn 100000
+  let _ ← IO.trimHeap
+  -- small objects allocated and freed by a dedicated thread are released once it has exited
+  let t ← IO.asTask (prio := .dedicated) do
+    return (List.range 1000000).foldl (· + ·) 0
+  check (t.get matches .ok 499999500000) "task"
+  if reportsReleased then
+    check ((← trimUntilReleased 100) > 0) "nothing released"
+  return s + s'
+
+/-- info: 3200000 -/
+#guard_msgs in
+#eval test
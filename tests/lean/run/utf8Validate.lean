@@ -0,0 +1,22 @@
+def bytes (l : List UInt8) : ByteArray := ⟨l.toArray⟩
+
+#guard String.validateUTF8 "".toUTF8
+#guard String.validateUTF8 "hello ∀ x, λ → 😀".toUTF8
+#guard String.fromUTF8? "hello ∀ x, λ → 😀".toUTF8 == some "hello ∀ x, λ → 😀"
+#guard (String.fromUTF8? "hello ∀ x, λ → 😀".toUTF8).map String.length == some 16
+-- long enough for the vectorized path
+#guard String.validateUTF8 (String.join (List.replicate 100 "abc∀😀")).toUTF8
+#guard (String.fromUTF8Unchecked (String.join (List.replicate 100 "abc∀😀")).toUTF8).length == 500
+
+-- truncated sequence
+#guard !String.validateUTF8 (bytes [0x61, 0xE2, 0x88])
+-- stray continuation byte
+#guard !String.validateUTF8 (bytes [0x80])
+-- overlong encoding of '/'
+#guard !String.validateUTF8 (bytes [0xC0, 0xAF])
+-- surrogate
+#guard !String.validateUTF8 (bytes [0xED, 0xA0, 0x80])
+-- above 0x10FFFF
+#guard !String.validateUTF8 (bytes [0xF4, 0x90, 0x80, 0x80])
+#guard String.fromUTF8? (bytes [0xFF]) == none
+#guard !String.validateUTF8 ((String.join (List.replicate 100 "abc∀")).toUTF8.push 0xE2)